@@ -1,2 +1,34 @@
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// Allocations of a page or more come back page-aligned and padded to whole pages, so a decoded image can be handed to
+//  Metal as a buffer without a copy. Smaller ones, like the decoders' scratch buffers, stay on malloc.
+static void* stbiAllocate(size_t size) {
+    const size_t pageSize = static_cast<size_t>(getpagesize());
+    if (size < pageSize) {
+        return malloc(size);
+    }
+    
+    void* pointer = nullptr;
+    if (posix_memalign(&pointer, pageSize, (size + pageSize - 1) / pageSize * pageSize) != 0) {
+        return nullptr;
+    }
+    return pointer;
+}
+
+static void* stbiReallocate(void* pointer, size_t oldSize, size_t newSize) {
+    void* moved = stbiAllocate(newSize);
+    if (moved && pointer) {
+        memcpy(moved, pointer, oldSize < newSize ? oldSize : newSize);
+        free(pointer);
+    }
+    return moved;
+}
+
+#define STBI_MALLOC(size) stbiAllocate(size)
+#define STBI_REALLOC_SIZED(pointer, oldSize, newSize) stbiReallocate(pointer, oldSize, newSize)
+#define STBI_FREE(pointer) free(pointer)
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
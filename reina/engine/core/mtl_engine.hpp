@@ -22,17 +22,18 @@
 #include "instance_acc_struct.hpp"
 #include "shared.hpp"
 #include "scene.hpp"
+#include "scene_loader.hpp"
 
 #include <Metal/Metal.hpp>
 
 class MTLEngine {
 public:
-    void init();
+    void init(const std::string& scenePath);
     void run();
     void cleanup();
     
     void createBuffers();
-    void createAccStructs();
+    void createScene(const SceneFile& sceneFile);
     void createSquare();
     void createDefaultLibrary();
     void createCommandQueue();
@@ -53,12 +54,15 @@ public:
 private:
     void initDevice();
     void initWindow();
+    void printMemoryReport() const;
 
     static constexpr uint WIDTH = 600;
     static constexpr uint HEIGHT = 600;
     int drawableWidth;
     int drawableHeight;
     
+    SceneCamera camera;
+    
     NS::SharedPtr<MTL::Device> device;
     GLFWwindow* glfwWindow;
     NSWindow* metalWindow;
@@ -74,6 +78,7 @@ private:
     NS::SharedPtr<MTL::RenderPipelineState> metalRenderPSO;
     NS::SharedPtr<MTL::Buffer> squareVertexBuffer;
     NS::SharedPtr<MTL::Buffer> frameParamsBuffer;
+    NS::SharedPtr<MTL::Buffer> emptyTileStamps;
     FrameParams frameParams;
 
     std::unique_ptr<Texture> rtPing;
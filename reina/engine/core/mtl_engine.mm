@@ -3,25 +3,59 @@
 #include <simd/simd.h>
 #include <iostream>
 #include <chrono>
+#include <cmath>
 
 #include "buffers.hpp"
 #include "model.hpp"
 #include "tri_acc_struct.hpp"
 #include "matmath.hpp"
 #include "scene.hpp"
-
-
-void MTLEngine::init() {
-    initDevice();
-    initWindow();
+#include "texture_tile_cache.hpp"
+#include "task_graph.hpp"
+#include "memory_report.hpp"
+
+
+void MTLEngine::init(const std::string& scenePath) {
+    // Startup runs as a task graph, so every step starts as soon as what it needs is ready. Asset loads and their BLAS
+    //  builds overlap with each other and with the window, library and pipeline setup, and the scene build only waits on
+    //  those and on the texture atlases, which are packed once every texture has loaded. The window stays on the main
+    //  thread as AppKit requires.
+    SceneFile sceneFile(scenePath);
+    TaskGraph graph;
+    
+    auto deviceTask = graph.add("device", [&] { initDevice(); });
+    auto windowTask = graph.add("window", [&] { initWindow(); }, {deviceTask}, true);
+    auto queueTask = graph.add("command queue", [&] { createCommandQueue(); }, {deviceTask});
+    auto libraryTask = graph.add("library", [&] { createDefaultLibrary(); }, {deviceTask});
+    graph.add("compute PSOs", [&] { createAllComputePSOs(); }, {libraryTask});
+    graph.add("render pipeline", [&] { createRenderPipeline(); }, {libraryTask, windowTask});
+    graph.add("fullscreen quad", [&] { createSquare(); }, {windowTask});
+    
+    scene = std::make_unique<Scene>();
+    std::vector<TaskGraph::TaskId> sceneInputs = {windowTask};
+    std::vector<TaskGraph::TaskId> textureLoads = {queueTask};
+    for (size_t asset = 0; asset < sceneFile.getAssets().size(); asset++) {
+        const SceneFile::Asset& info = sceneFile.getAssets()[asset];
+        std::string filename = std::filesystem::path(info.path).filename().string();
+        
+        auto loadTask = graph.add("load " + filename, [&, asset] { sceneFile.loadAsset(asset, device.get(), cmdQueue.get()); }, {queueTask});
+        if (info.isModel) {
+            loadTask = graph.add("BLAS " + filename, [&, model = info.index] {
+                scene->prebuildAccStructs(device.get(), cmdQueue.get(), sceneFile.getModel(model));
+            }, {loadTask});
+            sceneInputs.push_back(loadTask);
+        } else {
+            textureLoads.push_back(loadTask);
+        }
+    }
+    sceneInputs.push_back(graph.add("texture atlases", [&] { sceneFile.packAtlases(device.get(), cmdQueue.get()); }, textureLoads));
     
-    createSquare();
-    createDefaultLibrary();
-    createAllComputePSOs();
-    createCommandQueue();
-    createRenderPipeline();
-    createAccStructs();
-    createBuffers();
+    auto sceneTask = graph.add("scene build", [&] { createScene(sceneFile); }, sceneInputs);
+    graph.add("buffers", [&] { createBuffers(); }, {sceneTask});
+    
+    graph.run();
+    graph.printTimeline();
+    printMemoryReport();
 }
 
 void MTLEngine::updateBuffers() {
@@ -45,11 +79,20 @@ void MTLEngine::run() {
             auto start = std::chrono::steady_clock::now();
             runRaytrace();
             auto end = std::chrono::steady_clock::now();
+            
+            // The frame has finished, so its tile stamps are complete
+            TextureTileCache* tileCache = scene->getTileCache();
+            if (tileCache) {
+                tileCache->update(cmdQueue.get(), frameParams.frameIndex + 1);
+            }
             tonemap();
             sendRenderCommand();
             
             std::chrono::duration<double> elapsed = end - start;
             std::cout << "Samples: " << samples << " Time: " << elapsed.count() * 1000 << " ms\n";
+            if (tileCache) {
+                tileCache->printReport();
+            }
         }
         
         updateBuffers();
@@ -67,18 +110,22 @@ void MTLEngine::initDevice() {
 }
 
 void MTLEngine::createBuffers() {
-    simd::float4x4 proj = makePerspective(1.57f / 3.0f, float(WIDTH)/float(HEIGHT), 0.01f, 1e6);
-    simd::float4x4 view = lookAt(simd::float3{0, 0, -5}, simd::float3{0, 0, 0}, simd::float3{0, 1, 0});
+    simd::float4x4 proj = makePerspective(camera.fovy, float(WIDTH)/float(HEIGHT), 0.01f, 1e6);
+    simd::float4x4 view = lookAt(camera.position, camera.target, camera.up);
     
     CameraData viewProjBufferContents{
         .invView = simd::inverse(view),
-        .invProj = simd::inverse(proj)
+        .invProj = simd::inverse(proj),
+        .pixelSpreadAngle = std::atan(2.0f * std::tan(camera.fovy * 0.5f) / static_cast<float>(drawableHeight))
     };
     
     viewProjBuffer = NS::TransferPtr(makePrivateBuffer(device.get(), cmdQueue.get(), &viewProjBufferContents, sizeof(CameraData)));
     
     frameParams = FrameParams(0, 64);
     frameParamsBuffer = NS::TransferPtr(device->newBuffer(&frameParams, sizeof(FrameParams), MTL::ResourceStorageModeManaged));
+    
+    // Bound in place of the tile cache's stamps when the scene has none. Nothing reads it, since no texture is sparse.
+    emptyTileStamps = NS::TransferPtr(device->newBuffer(sizeof(uint32_t), MTL::ResourceStorageModeShared));
 }
 
 void MTLEngine::initWindow() {
@@ -102,32 +149,28 @@ void MTLEngine::initWindow() {
     metalWindow.contentView.wantsLayer = YES;
 }
 
-void MTLEngine::createAccStructs() {
-    std::shared_ptr<Model> cornell = std::make_shared<Model>(device.get(), cmdQueue.get(), "assets/cornell_box.obj");
-    std::shared_ptr<Model> cornellLight = std::make_shared<Model>(device.get(), cmdQueue.get(), "assets/cornell_light.obj");
-    std::shared_ptr<Model> triangle = std::make_shared<Model>(device.get(), cmdQueue.get(), "assets/triangle.obj");
-    std::shared_ptr<Model> bunny = std::make_shared<Model>(device.get(), cmdQueue.get(), "assets/bunny.obj");
-    std::shared_ptr<Model> ball = std::make_shared<Model>(device.get(), cmdQueue.get(), "assets/uv_sphere_highres.obj");
+void MTLEngine::createScene(const SceneFile& sceneFile) {
+    sceneFile.populate(*scene, camera);
     
-    scene = std::make_unique<Scene>();
-    std::shared_ptr<Material> red = std::make_shared<Material>(0, -1, -1, -1, simd::float3{0.9f, 0.7f, 0.6f}, simd::float3{0, 0, 0}, 0);
-    std::shared_ptr<Material> mirror = std::make_shared<Material>(1, -1, -1, -1, simd::float3(0.9f), simd::float3{0, 0, 0}, 0);
-    std::shared_ptr<Material> white = std::make_shared<Material>(0, -1, -1, -1, simd::float3{0.9f, 0.9f, 0.9f}, 0);
-    std::shared_ptr<Material> textured = std::make_shared<Material>(1, 0, 1, 2, simd::float3(1), 0);
-    std::shared_ptr<Material> emissive = std::make_shared<Material>(0, -1, -1, -1, simd::float3{0.9f, 0.7f, 0.6f}, simd::float3{10, 10, 10}, 0);
-//    scene->addObject(ball, red, matrix_identity_float4x4);
-//    scene->addObject(triangle, white, matrix_identity_float4x4);
-//    scene->addObject(cornell, white, matrix_identity_float4x4);
-    scene->addObject(cornellLight, emissive, matrix_identity_float4x4);
-    scene->addObject(ball, mirror, matrix_identity_float4x4);
+    scene->setLodCamera(camera.position, camera.fovy, drawableHeight);
+    scene->build(device.get(), cmdQueue.get());
+    scene->finalize();
     
-    auto tex = std::make_shared<Texture>("assets/Leather037_2K-PNG/Leather037_2K-PNG_Color.png", device.get(), MTL::TextureUsageShaderRead, MTL::PixelFormatRGBA8Unorm);
-    auto normal = std::make_shared<Texture>("assets/Leather037_2K-PNG/Leather037_2K-PNG_NormalGL.png", device.get(), MTL::TextureUsageShaderRead, MTL::PixelFormatRGBA8Unorm);
-    auto roughness = std::make_shared<Texture>("assets/Leather037_2K-PNG/Leather037_2K-PNG_Roughness.png", device.get(), MTL::TextureUsageShaderRead, MTL::PixelFormatR8Unorm);
-    scene->addTexture(tex);
-    scene->addTexture(normal);
+    sceneFile.getTextureManager().printReport();
+}
+
+void MTLEngine::printMemoryReport() const {
+    MemoryReport report;
+    scene->addMemoryUsage(report);
     
-    scene->build(device.get(), cmdQueue.get());
+    size_t framebufferBytes = 0;
+    for (const Texture* target : {rtPing.get(), rtPong.get(), tonemapped.get()}) {
+        framebufferBytes += target->texture->allocatedSize();
+    }
+    report.add(MemorySubsystem::Framebuffers, 0, framebufferBytes);
+    report.add(MemorySubsystem::Staging, 0, getPeakStagingBytes());
+    
+    report.print();
 }
 
 void MTLEngine::createSquare() {
@@ -221,15 +264,25 @@ void MTLEngine::runRaytrace() {
     encoder->setTexture(rtPong->texture, OUTPUT_TEXTURE_IDX);
     encoder->setAccelerationStructure(scene->getInstanceAccStruct().getAccelerationStructure(), ACC_STRUCT_BUFFER_IDX);
     encoder->setBuffer(viewProjBuffer.get(), 0, CAMERA_BUFFER_IDX);
-    encoder->setBuffer(scene->getVertexBuffer(), 0, VERTICES_BUFFER_IDX);
-    encoder->setBuffer(scene->getIndexBuffer(), 0, INDICES_BUFFER_IDX);
+    encoder->setBuffer(scene->getArena(), scene->getSectionOffset(SceneSection::Positions), POSITION_BUFFER_IDX);
+    encoder->setBuffer(scene->getArena(), scene->getSectionOffset(SceneSection::Shading), SHADING_BUFFER_IDX);
+    encoder->setBuffer(scene->getArena(), scene->getSectionOffset(SceneSection::Indices), INDICES_BUFFER_IDX);
     encoder->setBuffer(frameParamsBuffer.get(), 0, FRAME_PARAMS_BUFFER_IDX);
-    encoder->setBuffer(scene->getInstanceDataBuffer(), 0, INSTANCE_DATA_BUFFER_IDX);
-    encoder->setBuffer(scene->getMaterialBuffer(), 0, MATERIAL_BUFFER_IDX);
+    encoder->setBuffer(scene->getArena(), scene->getSectionOffset(SceneSection::InstanceData), INSTANCE_DATA_BUFFER_IDX);
+    encoder->setBuffer(scene->getArena(), scene->getSectionOffset(SceneSection::Materials), MATERIAL_BUFFER_IDX);
+    encoder->setBuffer(scene->getArena(), scene->getSectionOffset(SceneSection::Submeshes), SUBMESH_BUFFER_IDX);
+    encoder->setBuffer(scene->getArena(), scene->getSectionOffset(SceneSection::InstanceMaterials), INSTANCE_MATERIAL_BUFFER_IDX);
     
+    TextureTileCache* tileCache = scene->getTileCache();
+    SparseTextureInfo sparseInfos[NUM_TEXTURES] = {};
     for (uint32_t i = 0; i < scene->getTextures().size(); i++) {
         encoder->setTexture(scene->getTextures()[i]->texture, i + TEXTURE_ARRAY_IDX);
+        if (tileCache) {
+            sparseInfos[i] = tileCache->getInfo(*scene->getTextures()[i]);
+        }
     }
+    encoder->setBytes(sparseInfos, sizeof(sparseInfos), SPARSE_TEXTURE_INFO_BUFFER_IDX);
+    encoder->setBuffer(tileCache ? tileCache->getStampBuffer() : emptyTileStamps.get(), 0, TILE_STAMP_BUFFER_IDX);
     
     MTL::Size gridSize = MTL::Size(rtPing->width, rtPing->height, 1);
     MTL::Size threadgroupSize = MTL::Size(8, 8, 1);
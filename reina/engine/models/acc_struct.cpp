@@ -6,6 +6,7 @@
 //
 
 #include "acc_struct.hpp"
+#include "memory_report.hpp"
 
 MTL::AccelerationStructure* AccelerationStructure::getAccelerationStructure() const {
     return m_accStruct;
@@ -21,6 +22,7 @@ void AccelerationStructure::build(MTL::Device* device, MTL::CommandQueue* cmdQue
     
     // Make scratch buffer
     MTL::Buffer* scratchBuffer = device->newBuffer(sizes.buildScratchBufferSize, MTL::ResourceStorageModePrivate);
+    trackStagingAlloc(sizes.buildScratchBufferSize);
     
     // Encode build command
     MTL::CommandBuffer* cmdBuffer = cmdQueue->commandBuffer();
@@ -30,6 +32,9 @@ void AccelerationStructure::build(MTL::Device* device, MTL::CommandQueue* cmdQue
     
     cmdBuffer->commit();
     cmdBuffer->waitUntilCompleted();
+    
+    scratchBuffer->release();
+    trackStagingRelease(sizes.buildScratchBufferSize);
 }
 
 void AccelerationStructure::compact(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
@@ -56,5 +61,8 @@ void AccelerationStructure::compact(MTL::Device* device, MTL::CommandQueue* cmdQ
     compactCmdBuffer->commit();
     compactCmdBuffer->waitUntilCompleted();
     
+    // The uncompacted structure is a second copy of the same BVH, so it goes as soon as the compacted one is written
+    sizeBuffer->release();
+    m_accStruct->release();
     m_accStruct = compacted;
 }
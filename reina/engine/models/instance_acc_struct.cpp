@@ -1,15 +1,16 @@
 #include "instance_acc_struct.hpp"
 
 #include "matmath.hpp"
+#include "memory_report.hpp"
 
-InstanceAccelerationStructure::InstanceAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::vector<MTL::AccelerationStructure*>& accStructs, std::vector<simd::float4x4> transforms) {
+InstanceAccelerationStructure::InstanceAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::vector<MTL::AccelerationStructure*>& accStructs, std::vector<simd::float4x4> transforms, const std::vector<uint32_t>& masks) {
     
     // 1. Create descriptor
     MTL::InstanceAccelerationStructureDescriptor* instanceASDesc =
         MTL::InstanceAccelerationStructureDescriptor::alloc()->init();
-
+    
     NS::Array* accStructsArray = NS::Array::array(reinterpret_cast<const NS::Object *const*>(accStructs.data()), accStructs.size());
-
+    
     instanceASDesc->setInstanceCount(accStructs.size());
     instanceASDesc->setInstancedAccelerationStructures(accStructsArray);
     instanceASDesc->setInstanceDescriptorType(MTL::AccelerationStructureInstanceDescriptorTypeDefault);
@@ -25,17 +26,23 @@ InstanceAccelerationStructure::InstanceAccelerationStructure(MTL::Device* device
         desc.options = 0;
         
         desc.accelerationStructureIndex = instanceIdx;
-        desc.mask = 0xFFFFFFFF;
+        desc.mask = masks[instanceIdx];
         
         desc.transformationMatrix = simdToMTL(transforms[instanceIdx]);
     }
     
-
-    MTL::Buffer* instanceDescriptorBuffer = device->newBuffer(instanceDescriptors.data(), sizeof(MTL::AccelerationStructureInstanceDescriptor) * instanceDescriptors.size(), MTL::StorageModeShared);
+    
+    const size_t descriptorBytes = sizeof(MTL::AccelerationStructureInstanceDescriptor) * instanceDescriptors.size();
+    MTL::Buffer* instanceDescriptorBuffer = device->newBuffer(instanceDescriptors.data(), descriptorBytes, MTL::StorageModeShared);
+    trackStagingAlloc(descriptorBytes);
     
     instanceASDesc->setInstanceDescriptorBuffer(instanceDescriptorBuffer);
     
     // 3. Build
     build(device, cmdQueue, instanceASDesc);
     compact(device, cmdQueue);
+    
+    // The build copied the instance descriptors into the acceleration structure
+    instanceDescriptorBuffer->release();
+    trackStagingRelease(descriptorBytes);
 }
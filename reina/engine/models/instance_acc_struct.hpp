@@ -10,7 +10,7 @@
 
 class InstanceAccelerationStructure : public AccelerationStructure {
 public:
-    InstanceAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::vector<MTL::AccelerationStructure*>& accStructs, std::vector<simd::float4x4> transforms);
+    InstanceAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::vector<MTL::AccelerationStructure*>& accStructs, std::vector<simd::float4x4> transforms, const std::vector<uint32_t>& masks);
 };
 
 #endif /* instance_acc_struct_hpp */
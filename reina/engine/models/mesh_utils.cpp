@@ -0,0 +1,721 @@
+#include "mesh_utils.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <list>
+#include <unordered_map>
+#include <queue>
+#include <functional>
+#include <array>
+#include <tuple>
+#include <cmath>
+#include <cassert>
+#include <utility>
+
+namespace {
+
+uint32_t expandBits10(uint32_t v) {
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+uint32_t morton3D(simd::float3 unitPos) {
+    uint32_t x = static_cast<uint32_t>(std::clamp(unitPos.x * 1023.0f, 0.0f, 1023.0f));
+    uint32_t y = static_cast<uint32_t>(std::clamp(unitPos.y * 1023.0f, 0.0f, 1023.0f));
+    uint32_t z = static_cast<uint32_t>(std::clamp(unitPos.z * 1023.0f, 0.0f, 1023.0f));
+    return (expandBits10(x) << 2) | (expandBits10(y) << 1) | expandBits10(z);
+}
+
+}
+
+void reorderTrianglesMorton(std::vector<uint32_t>& indices, const std::vector<ModelVertexData>& vertices, const std::vector<SubmeshData>& submeshes, simd::float3 boundsMin, simd::float3 boundsExtent) {
+    simd::float3 invExtent = 1.0f / simd::max(boundsExtent, simd::float3(EPS));
+    
+    std::vector<uint32_t> reordered(indices.size());
+    for (const SubmeshData& submesh : submeshes) {
+        size_t firstTri = submesh.indexOffset / 3;
+        size_t triCount = submesh.indexCount / 3;
+        
+        std::vector<std::pair<uint32_t, uint32_t>> keys(triCount);  // (morton code, triangle)
+        for (size_t t = 0; t < triCount; t++) {
+            const uint32_t* tri = &indices[(firstTri + t) * 3];
+            simd::float3 centroid = (vertices[tri[0]].pos + vertices[tri[1]].pos + vertices[tri[2]].pos) / 3.0f;
+            keys[t] = { morton3D((centroid - boundsMin) * invExtent), static_cast<uint32_t>(firstTri + t) };
+        }
+        
+        std::sort(keys.begin(), keys.end());
+        
+        for (size_t t = 0; t < triCount; t++) {
+            for (size_t v = 0; v < 3; v++) {
+                reordered[(firstTri + t) * 3 + v] = indices[keys[t].second * 3 + v];
+            }
+        }
+    }
+    
+    indices = std::move(reordered);
+}
+
+void reorderVerticesFirstTouch(std::vector<ModelVertexData>& vertices, std::vector<uint32_t>& indices) {
+    constexpr uint32_t unassigned = UINT32_MAX;
+    std::vector<uint32_t> remap(vertices.size(), unassigned);
+    std::vector<ModelVertexData> reordered;
+    reordered.reserve(vertices.size());
+    
+    for (uint32_t& idx : indices) {
+        if (remap[idx] == unassigned) {
+            remap[idx] = static_cast<uint32_t>(reordered.size());
+            reordered.push_back(vertices[idx]);
+        }
+        
+        idx = remap[idx];
+    }
+    
+    // Vertices no triangle references are dropped
+    vertices = std::move(reordered);
+}
+
+float computeACMR(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize) {
+    if (indices.empty()) {
+        return 0;
+    }
+    
+    // FIFO cache: a vertex is resident if it was inserted within the last cacheSize misses
+    std::vector<size_t> insertedAt(vertexCount, SIZE_MAX);
+    size_t misses = 0;
+    
+    for (uint32_t idx : indices) {
+        if (insertedAt[idx] == SIZE_MAX || misses - insertedAt[idx] >= cacheSize) {
+            insertedAt[idx] = misses;
+            misses++;
+        }
+    }
+    
+    return static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+}
+
+float computeVertexFetchMissRate(const std::vector<uint32_t>& indices, size_t vertexStride, size_t cacheBytes) {
+    if (indices.empty()) {
+        return 0;
+    }
+    
+    constexpr size_t lineBytes = 64;
+    const size_t lineCount = std::max<size_t>(cacheBytes / lineBytes, 1);
+    
+    std::list<size_t> lru;
+    std::unordered_map<size_t, std::list<size_t>::iterator> resident;
+    size_t misses = 0;
+    
+    for (uint32_t idx : indices) {
+        size_t line = idx * vertexStride / lineBytes;
+        
+        auto it = resident.find(line);
+        if (it != resident.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            continue;
+        }
+        
+        misses++;
+        lru.push_front(line);
+        resident[line] = lru.begin();
+        
+        if (lru.size() > lineCount) {
+            resident.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+    
+    return static_cast<float>(misses) / static_cast<float>(indices.size());
+}
+
+namespace {
+
+/// Symmetric 4x4 error quadric stored as its upper triangle
+struct Quadric {
+    double a2 = 0, ab = 0, ac = 0, ad = 0;
+    double b2 = 0, bc = 0, bd = 0;
+    double c2 = 0, cd = 0;
+    double d2 = 0;
+    
+    static Quadric fromPlane(simd::float3 n, float d, double weight) {
+        Quadric q;
+        q.a2 = weight * n.x * n.x; q.ab = weight * n.x * n.y; q.ac = weight * n.x * n.z; q.ad = weight * n.x * d;
+        q.b2 = weight * n.y * n.y; q.bc = weight * n.y * n.z; q.bd = weight * n.y * d;
+        q.c2 = weight * n.z * n.z; q.cd = weight * n.z * d;
+        q.d2 = weight * d * d;
+        return q;
+    }
+    
+    Quadric& operator+=(const Quadric& o) {
+        a2 += o.a2; ab += o.ab; ac += o.ac; ad += o.ad;
+        b2 += o.b2; bc += o.bc; bd += o.bd;
+        c2 += o.c2; cd += o.cd;
+        d2 += o.d2;
+        return *this;
+    }
+    
+    double error(simd::float3 p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+             + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+             + c2 * z * z + 2 * cd * z
+             + d2;
+    }
+};
+
+struct Collapse {
+    double cost;
+    uint32_t from, to;
+    uint32_t fromVersion, toVersion;
+    
+    bool operator>(const Collapse& o) const { return cost > o.cost; }
+};
+
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<ModelVertexData>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float* outError, float* outDistance) {
+    const size_t triCount = indices.size() / 3;
+    std::vector<uint32_t> tris = indices;
+    std::vector<bool> triAlive(triCount, true);
+    size_t aliveCount = triCount;
+    
+    // Vertex -> triangle adjacency. Lists may hold stale entries after collapses; triangles are re-checked on use.
+    std::vector<std::vector<uint32_t>> vertexTris(vertices.size());
+    for (uint32_t t = 0; t < triCount; t++) {
+        for (int k = 0; k < 3; k++) {
+            vertexTris[tris[t * 3 + k]].push_back(t);
+        }
+    }
+    
+    // Vertices sharing a position are one point of the surface split by a uv or normal seam. Quadrics are kept per
+    //  position so both sides of a seam see the whole surface around it.
+    std::vector<uint32_t> positionOf(vertices.size());
+    std::vector<uint32_t> positionCount(vertices.size(), 0);
+    std::vector<uint32_t> sibling(vertices.size(), UINT32_MAX);  // The other vertex at a position shared by exactly two
+    {
+        struct PosHash {
+            size_t operator()(const simd::float3& p) const noexcept {
+                auto h = std::hash<float>{};
+                return h(p.x) ^ (h(p.y) * 0x9e3779b97f4a7c15ULL) ^ (h(p.z) * 0xc2b2ae3d27d4eb4fULL);
+            }
+        };
+        struct PosEqual {
+            bool operator()(const simd::float3& a, const simd::float3& b) const noexcept {
+                return a.x == b.x && a.y == b.y && a.z == b.z;
+            }
+        };
+        
+        std::unordered_map<simd::float3, uint32_t, PosHash, PosEqual> firstAtPos;
+        for (uint32_t v = 0; v < vertices.size(); v++) {
+            auto [it, inserted] = firstAtPos.emplace(vertices[v].pos, v);
+            positionOf[v] = it->second;
+            positionCount[it->second]++;
+            if (!inserted) {
+                sibling[v] = it->second;
+                sibling[it->second] = v;
+            }
+        }
+    }
+    
+    // An edge used by one triangle is open: between positions it is a border of the surface, and between vertices that
+    //  aren't on a border it is one side of a seam
+    std::vector<uint32_t> openEdges(vertices.size(), 0);
+    std::vector<bool> onBorder(vertices.size(), false);  // Per position
+    {
+        auto edgeKey = [](uint32_t a, uint32_t b) { return (uint64_t(std::min(a, b)) << 32) | std::max(a, b); };
+        std::unordered_map<uint64_t, uint32_t> edgeUses;
+        std::unordered_map<uint64_t, uint32_t> positionEdgeUses;
+        for (uint32_t t = 0; t < triCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t a = tris[t * 3 + k], b = tris[t * 3 + (k + 1) % 3];
+                edgeUses[edgeKey(a, b)]++;
+                positionEdgeUses[edgeKey(positionOf[a], positionOf[b])]++;
+            }
+        }
+        for (const auto& [edge, uses] : edgeUses) {
+            if (uses == 1) {
+                openEdges[edge >> 32]++;
+                openEdges[edge & 0xFFFFFFFF]++;
+            }
+        }
+        for (const auto& [edge, uses] : positionEdgeUses) {
+            if (uses == 1) {
+                onBorder[edge >> 32] = true;
+                onBorder[edge & 0xFFFFFFFF] = true;
+            }
+        }
+    }
+    
+    // Free vertices collapse onto any neighbour. A seam vertex, one of two at its position with the seam passing straight
+    //  through, only moves along the seam together with its sibling. Borders, seam ends and corners where several seams
+    //  meet are locked so the surface can't tear apart.
+    enum class VertexKind : uint8_t { Free, Seam, Locked };
+    std::vector<VertexKind> kind(vertices.size(), VertexKind::Locked);
+    for (uint32_t v = 0; v < vertices.size(); v++) {
+        const uint32_t p = positionOf[v];
+        if (onBorder[p]) {
+            continue;
+        }
+        if (positionCount[p] == 1 && openEdges[v] == 0) {
+            kind[v] = VertexKind::Free;
+        } else if (positionCount[p] == 2 && openEdges[v] == 2 && openEdges[sibling[v]] == 2) {
+            kind[v] = VertexKind::Seam;
+        }
+    }
+    
+    std::vector<Quadric> quadrics(vertices.size());
+    for (uint32_t t = 0; t < triCount; t++) {
+        simd::float3 p0 = vertices[tris[t * 3]].pos, p1 = vertices[tris[t * 3 + 1]].pos, p2 = vertices[tris[t * 3 + 2]].pos;
+        simd::float3 c = simd::cross(p1 - p0, p2 - p0);
+        float area2 = simd::length(c);
+        if (area2 <= EPS) {
+            continue;
+        }
+        
+        simd::float3 n = c / area2;
+        Quadric q = Quadric::fromPlane(n, -simd::dot(n, p0), area2 * 0.5);
+        for (int k = 0; k < 3; k++) {
+            quadrics[positionOf[tris[t * 3 + k]]] += q;
+        }
+    }
+    
+    std::vector<uint32_t> version(vertices.size(), 0);
+    std::vector<bool> removed(vertices.size(), false);
+    std::vector<uint32_t> collapsedTo(vertices.size(), UINT32_MAX);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+    
+    auto pushCollapses = [&](uint32_t v) {
+        for (uint32_t t : vertexTris[v]) {
+            if (!triAlive[t]) {
+                continue;
+            }
+            
+            for (int k = 0; k < 3; k++) {
+                uint32_t u = tris[t * 3 + k];
+                if (u == v) {
+                    continue;
+                }
+                
+                Quadric q = quadrics[positionOf[u]];
+                q += quadrics[positionOf[v]];
+                
+                if (kind[u] != VertexKind::Locked) {
+                    heap.push({ q.error(vertices[v].pos), u, v, version[u], version[v] });
+                }
+                if (kind[v] != VertexKind::Locked) {
+                    heap.push({ q.error(vertices[u].pos), v, u, version[v], version[u] });
+                }
+            }
+        }
+    };
+    
+    // Whether moving from onto to would flip a surviving triangle
+    auto flips = [&](uint32_t from, uint32_t to) {
+        for (uint32_t t : vertexTris[from]) {
+            if (!triAlive[t]) {
+                continue;
+            }
+            
+            const uint32_t* tri = &tris[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                continue;
+            }
+            
+            simd::float3 p[3], moved[3];
+            for (int k = 0; k < 3; k++) {
+                p[k] = vertices[tri[k]].pos;
+                moved[k] = tri[k] == from ? vertices[to].pos : p[k];
+            }
+            
+            simd::float3 before = simd::cross(p[1] - p[0], p[2] - p[0]);
+            simd::float3 after = simd::cross(moved[1] - moved[0], moved[2] - moved[0]);
+            if (simd::dot(before, after) <= 0) {
+                return true;
+            }
+        }
+        return false;
+    };
+    
+    auto collapse = [&](uint32_t from, uint32_t to) {
+        for (uint32_t t : vertexTris[from]) {
+            if (!triAlive[t]) {
+                continue;
+            }
+            
+            uint32_t* tri = &tris[t * 3];
+            if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                triAlive[t] = false;
+                aliveCount--;
+                continue;
+            }
+            
+            for (int k = 0; k < 3; k++) {
+                if (tri[k] == from) {
+                    tri[k] = to;
+                }
+            }
+            vertexTris[to].push_back(t);
+        }
+        
+        removed[from] = true;
+        collapsedTo[from] = to;
+        vertexTris[from].clear();
+        version[to]++;
+    };
+    
+    for (uint32_t v = 0; v < vertices.size(); v++) {
+        pushCollapses(v);
+    }
+    
+    double maxError = 0;
+    while (aliveCount * 3 > targetIndexCount && !heap.empty()) {
+        Collapse c = heap.top();
+        heap.pop();
+        
+        if (removed[c.from] || removed[c.to] || version[c.from] != c.fromVersion || version[c.to] != c.toVersion) {
+            continue;
+        }
+        
+        // The sibling of a seam vertex needs its own neighbour at the target's position, which is only there when the
+        //  edge runs along the seam. Both sides then collapse, so the seam stays closed.
+        uint32_t siblingTo = UINT32_MAX;
+        if (kind[c.from] == VertexKind::Seam) {
+            if (positionOf[c.from] == positionOf[c.to]) {
+                continue;
+            }
+            for (uint32_t t : vertexTris[sibling[c.from]]) {
+                for (int k = 0; triAlive[t] && k < 3; k++) {
+                    const uint32_t u = tris[t * 3 + k];
+                    if (positionOf[u] == positionOf[c.to] && (kind[c.to] != VertexKind::Seam || u == sibling[c.to])) {
+                        siblingTo = u;
+                    }
+                }
+            }
+            if (siblingTo == UINT32_MAX || flips(sibling[c.from], siblingTo)) {
+                continue;
+            }
+        }
+        
+        if (flips(c.from, c.to)) {
+            continue;
+        }
+        
+        collapse(c.from, c.to);
+        if (siblingTo != UINT32_MAX) {
+            collapse(sibling[c.from], siblingTo);
+        }
+        quadrics[positionOf[c.to]] += quadrics[positionOf[c.from]];
+        maxError = std::max(maxError, c.cost);
+        
+        pushCollapses(c.to);
+        if (siblingTo != UINT32_MAX && siblingTo != c.to) {
+            pushCollapses(siblingTo);
+        }
+    }
+    
+    std::vector<uint32_t> result;
+    result.reserve(aliveCount * 3);
+    for (uint32_t t = 0; t < triCount; t++) {
+        if (triAlive[t]) {
+            result.insert(result.end(), &tris[t * 3], &tris[t * 3] + 3);
+        }
+    }
+    
+    if (outError) {
+        *outError = static_cast<float>(maxError);
+    }
+    
+    if (outDistance) {
+        // Follow each vertex down its chain of collapses to the vertex that survived, shortening the chain on the way
+        auto survivor = [&](uint32_t v) {
+            uint32_t s = v;
+            while (collapsedTo[s] != UINT32_MAX) {
+                s = collapsedTo[s];
+            }
+            while (collapsedTo[v] != UINT32_MAX) {
+                v = std::exchange(collapsedTo[v], s);
+            }
+            return s;
+        };
+        
+        float maxDistance = 0;
+        for (uint32_t v : indices) {
+            maxDistance = std::max(maxDistance, simd::distance(vertices[v].pos, vertices[survivor(v)].pos));
+        }
+        *outDistance = maxDistance;
+    }
+    
+    return result;
+}
+
+std::vector<uint32_t> weldPositions(const std::vector<simd::float3>& positions, float epsilon, size_t* outWeldedCount) {
+    std::vector<uint32_t> remap(positions.size());
+    size_t weldedCount = 0;
+    
+    const float cellSize = epsilon > 0 ? epsilon : 1.0f;
+    auto cellKey = [](int64_t x, int64_t y, int64_t z) {
+        return static_cast<uint64_t>(x) * 73856093ull ^ static_cast<uint64_t>(y) * 19349663ull ^ static_cast<uint64_t>(z) * 83492791ull;
+    };
+    
+    // Representatives keep their own position. Points within epsilon of a representative can only be in its cell or a
+    //  neighbouring one, and hash collisions between cells just add candidates that fail the distance check.
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+    cells.reserve(positions.size());
+    
+    for (uint32_t i = 0; i < positions.size(); i++) {
+        const simd::float3 p = positions[i];
+        const int64_t cx = static_cast<int64_t>(std::floor(p.x / cellSize));
+        const int64_t cy = static_cast<int64_t>(std::floor(p.y / cellSize));
+        const int64_t cz = static_cast<int64_t>(std::floor(p.z / cellSize));
+        
+        uint32_t match = i;
+        for (int64_t dx = -1; dx <= 1 && match == i; dx++) {
+            for (int64_t dy = -1; dy <= 1 && match == i; dy++) {
+                for (int64_t dz = -1; dz <= 1 && match == i; dz++) {
+                    auto it = cells.find(cellKey(cx + dx, cy + dy, cz + dz));
+                    if (it == cells.end()) {
+                        continue;
+                    }
+                    
+                    for (uint32_t candidate : it->second) {
+                        if (simd::distance(positions[candidate], p) <= epsilon) {
+                            match = candidate;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        
+        remap[i] = match;
+        if (match == i) {
+            cells[cellKey(cx, cy, cz)].push_back(i);
+        } else {
+            weldedCount++;
+        }
+    }
+    
+    if (outWeldedCount) {
+        *outWeldedCount = weldedCount;
+    }
+    
+    return remap;
+}
+
+std::vector<bool> findRedundantTriangles(const std::vector<uint32_t>& positionIndices, const std::vector<simd::float3>& positions, TriangleCleanupStats& stats) {
+    const size_t triCount = positionIndices.size() / 3;
+    std::vector<bool> redundant(triCount, false);
+    
+    // Triangles rotated so their smallest index comes first, which keeps the winding but makes equal triangles compare equal
+    std::vector<std::array<uint32_t, 4>> keys;
+    keys.reserve(triCount);
+    
+    for (uint32_t tri = 0; tri < triCount; tri++) {
+        uint32_t a = positionIndices[tri * 3];
+        uint32_t b = positionIndices[tri * 3 + 1];
+        uint32_t c = positionIndices[tri * 3 + 2];
+        
+        // Zero area relative to the triangle's own size, so needles and collapsed corners go regardless of model scale
+        simd::float3 e0 = positions[b] - positions[a];
+        simd::float3 e1 = positions[c] - positions[a];
+        simd::float3 e2 = positions[c] - positions[b];
+        float longestEdge2 = std::max({simd::length_squared(e0), simd::length_squared(e1), simd::length_squared(e2)});
+        
+        if (a == b || b == c || a == c || simd::length(simd::cross(e0, e1)) <= 1e-6f * longestEdge2) {
+            redundant[tri] = true;
+            stats.degenerate++;
+            continue;
+        }
+        
+        while (a > b || a > c) {
+            std::tie(a, b, c) = std::make_tuple(b, c, a);
+        }
+        keys.push_back({a, b, c, tri});
+    }
+    
+    // Sorting puts copies next to each other with the earliest triangle first, which is the one that survives
+    std::sort(keys.begin(), keys.end());
+    for (size_t i = 1; i < keys.size(); i++) {
+        if (keys[i][0] == keys[i - 1][0] && keys[i][1] == keys[i - 1][1] && keys[i][2] == keys[i - 1][2]) {
+            redundant[keys[i][3]] = true;
+            stats.duplicate++;
+        }
+    }
+    
+    return redundant;
+}
+
+MeshClusters buildClusters(const std::vector<ModelVertexData>& vertices, std::vector<uint32_t>& indices, const std::vector<SubmeshData>& submeshes, size_t maxVertices, size_t maxTriangles) {
+    assert(maxVertices >= 3 && maxVertices <= 256);
+    
+    MeshClusters result;
+    std::vector<uint32_t> reordered(indices.size());
+    
+    // Per-vertex state, reset through stamps so nothing is cleared between clusters
+    std::vector<uint32_t> localIndex(vertices.size());
+    std::vector<uint32_t> clusterStamp(vertices.size(), UINT32_MAX);
+    std::vector<uint32_t> submeshVertex(vertices.size());
+    std::vector<uint32_t> submeshStamp(vertices.size(), UINT32_MAX);
+    
+    for (uint32_t submeshIdx = 0; submeshIdx < submeshes.size(); submeshIdx++) {
+        const SubmeshData& submesh = submeshes[submeshIdx];
+        const uint32_t firstTri = submesh.indexOffset / 3;
+        const uint32_t triCount = submesh.indexCount / 3;
+        
+        // Vertices the submesh references, numbered from 0, so its adjacency is sized by them rather than the whole mesh
+        uint32_t submeshVertexCount = 0;
+        for (uint32_t i = submesh.indexOffset; i < submesh.indexOffset + triCount * 3; i++) {
+            if (submeshStamp[indices[i]] != submeshIdx) {
+                submeshStamp[indices[i]] = submeshIdx;
+                submeshVertex[indices[i]] = submeshVertexCount++;
+            }
+        }
+        
+        // Vertex to triangle adjacency within the submesh in CSR form, as submesh-relative triangle numbers
+        std::vector<uint32_t> adjacencyOffsets(submeshVertexCount + 1, 0);
+        for (uint32_t i = submesh.indexOffset; i < submesh.indexOffset + triCount * 3; i++) {
+            adjacencyOffsets[submeshVertex[indices[i]] + 1]++;
+        }
+        std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+        
+        std::vector<uint32_t> adjacency(triCount * 3);
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (uint32_t t = 0; t < triCount; t++) {
+            for (size_t corner = 0; corner < 3; corner++) {
+                adjacency[fill[submeshVertex[indices[(firstTri + t) * 3 + corner]]]++] = t;
+            }
+        }
+        
+        std::vector<bool> assigned(triCount, false);
+        uint32_t writeTri = firstTri;
+        uint32_t seed = 0;
+        
+        while (true) {
+            while (seed < triCount && assigned[seed]) {
+                seed++;
+            }
+            if (seed == triCount) {
+                break;
+            }
+            
+            const uint32_t clusterIdx = static_cast<uint32_t>(result.clusters.size());
+            MeshCluster cluster{};
+            cluster.indexOffset = writeTri * 3;
+            cluster.vertexOffset = static_cast<uint32_t>(result.vertices.size());
+            cluster.materialSlot = submesh.materialSlot;
+            
+            std::vector<uint32_t> candidates{seed};
+            simd::float3 centroidSum = simd::float3(0);
+            
+            while (cluster.triangleCount < maxTriangles) {
+                // Cheapest candidate: fewest vertices not yet in the cluster, then closest to the cluster centroid
+                int best = -1;
+                uint32_t bestNew = 4;
+                float bestDistance = 0;
+                simd::float3 centroid = centroidSum / std::max<float>(cluster.vertexCount, 1);
+                
+                for (size_t c = 0; c < candidates.size(); c++) {
+                    uint32_t t = candidates[c];
+                    if (assigned[t]) {
+                        // Drop triangles that another pick already took so the list stays short
+                        candidates[c--] = candidates.back();
+                        candidates.pop_back();
+                        continue;
+                    }
+                    
+                    const uint32_t* tri = &indices[(firstTri + t) * 3];
+                    uint32_t newVertices = 0;
+                    for (size_t corner = 0; corner < 3; corner++) {
+                        newVertices += clusterStamp[tri[corner]] != clusterIdx;
+                    }
+                    if (cluster.vertexCount + newVertices > maxVertices) {
+                        continue;
+                    }
+                    
+                    simd::float3 triCentroid = (vertices[tri[0]].pos + vertices[tri[1]].pos + vertices[tri[2]].pos) / 3.0f;
+                    float distance = simd::distance_squared(triCentroid, centroid);
+                    if (newVertices < bestNew || (newVertices == bestNew && distance < bestDistance)) {
+                        best = static_cast<int>(c);
+                        bestNew = newVertices;
+                        bestDistance = distance;
+                    }
+                }
+                
+                if (best < 0) {
+                    break;
+                }
+                
+                uint32_t t = candidates[best];
+                candidates[best] = candidates.back();
+                candidates.pop_back();
+                assigned[t] = true;
+                
+                const uint32_t* tri = &indices[(firstTri + t) * 3];
+                for (size_t corner = 0; corner < 3; corner++) {
+                    uint32_t v = tri[corner];
+                    if (clusterStamp[v] != clusterIdx) {
+                        clusterStamp[v] = clusterIdx;
+                        localIndex[v] = cluster.vertexCount++;
+                        result.vertices.push_back(v);
+                        centroidSum += vertices[v].pos;
+                        
+                        for (uint32_t i = adjacencyOffsets[submeshVertex[v]]; i < adjacencyOffsets[submeshVertex[v] + 1]; i++) {
+                            if (!assigned[adjacency[i]]) {
+                                candidates.push_back(adjacency[i]);
+                            }
+                        }
+                    }
+                    
+                    result.triangles.push_back(static_cast<uint8_t>(localIndex[v]));
+                    reordered[writeTri * 3 + corner] = v;
+                }
+                
+                writeTri++;
+                cluster.triangleCount++;
+            }
+            
+            // Bounds and bounding sphere around the AABB centre
+            cluster.boundsMin = vertices[result.vertices[cluster.vertexOffset]].pos;
+            cluster.boundsMax = cluster.boundsMin;
+            for (uint32_t i = 0; i < cluster.vertexCount; i++) {
+                simd::float3 p = vertices[result.vertices[cluster.vertexOffset + i]].pos;
+                cluster.boundsMin = simd::min(cluster.boundsMin, p);
+                cluster.boundsMax = simd::max(cluster.boundsMax, p);
+            }
+            
+            cluster.sphereCenter = (cluster.boundsMin + cluster.boundsMax) * 0.5f;
+            cluster.sphereRadius = 0;
+            for (uint32_t i = 0; i < cluster.vertexCount; i++) {
+                cluster.sphereRadius = std::max(cluster.sphereRadius, simd::distance(cluster.sphereCenter, vertices[result.vertices[cluster.vertexOffset + i]].pos));
+            }
+            
+            // Normal cone from the face normals
+            std::vector<simd::float3> faceNormals;
+            simd::float3 axis = simd::float3(0);
+            for (uint32_t t = 0; t < cluster.triangleCount; t++) {
+                const uint32_t* tri = &reordered[cluster.indexOffset + t * 3];
+                simd::float3 n = simd::cross(vertices[tri[1]].pos - vertices[tri[0]].pos, vertices[tri[2]].pos - vertices[tri[0]].pos);
+                float length = simd::length(n);
+                if (length > EPS) {
+                    faceNormals.push_back(n / length);
+                    axis += n / length;
+                }
+            }
+            
+            float axisLength = simd::length(axis);
+            cluster.coneAxis = axisLength > EPS ? axis / axisLength : simd::float3{0, 0, 1};
+            cluster.coneCutoff = axisLength > EPS ? 1.0f : -1.0f;
+            for (simd::float3 n : faceNormals) {
+                cluster.coneCutoff = std::min(cluster.coneCutoff, simd::dot(cluster.coneAxis, n));
+            }
+            
+            result.clusters.push_back(cluster);
+        }
+    }
+    
+    indices = std::move(reordered);
+    return result;
+}
@@ -0,0 +1,70 @@
+#ifndef mesh_utils_hpp
+#define mesh_utils_hpp
+
+#include <simd/simd.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "shared.hpp"
+
+/// Sorts the triangles of each submesh along a Morton curve over their centroids. Submesh ranges are left in place.
+void reorderTrianglesMorton(std::vector<uint32_t>& indices, const std::vector<ModelVertexData>& vertices, const std::vector<SubmeshData>& submeshes, simd::float3 boundsMin, simd::float3 boundsExtent);
+
+/// Renumbers vertices in the order the index buffer first references them, so consecutive triangles read nearby vertices.
+void reorderVerticesFirstTouch(std::vector<ModelVertexData>& vertices, std::vector<uint32_t>& indices);
+
+/// Average number of post-transform cache misses per triangle for a FIFO cache of the given size.
+float computeACMR(const std::vector<uint32_t>& indices, size_t vertexCount, size_t cacheSize = 32);
+
+/// Fraction of vertex fetches that miss a simulated LRU cache of 64-byte lines over a stream with the given stride.
+float computeVertexFetchMissRate(const std::vector<uint32_t>& indices, size_t vertexStride, size_t cacheBytes = 32 * 1024);
+
+/// Quadric-error-metric edge collapse down to at most targetIndexCount indices. Vertices are collapsed onto existing
+/// vertices so the vertex pool is shared with the source mesh. Vertices on open borders stay locked, and the two vertices
+/// either side of an attribute seam only collapse together along it, so seams simplify without opening.
+/// Returns the simplified indices, the largest collapse error through outError if given, and the largest distance any
+/// vertex moved to the vertex it was collapsed onto through outDistance if given.
+std::vector<uint32_t> simplifyMesh(const std::vector<ModelVertexData>& vertices, const std::vector<uint32_t>& indices, size_t targetIndexCount, float* outError = nullptr, float* outDistance = nullptr);
+
+/// Maps every position onto the first earlier position within epsilon of it, found through a spatial hash with cells of
+/// size epsilon. An epsilon of 0 only welds bit-identical positions. Returns the remap table, and the number of positions
+/// that were welded away through outWeldedCount if given.
+std::vector<uint32_t> weldPositions(const std::vector<simd::float3>& positions, float epsilon, size_t* outWeldedCount = nullptr);
+
+struct TriangleCleanupStats {
+    size_t degenerate = 0;
+    size_t duplicate = 0;
+};
+
+/// Flags triangles, given as position indices, that have (near) zero area or repeat an earlier triangle with the same
+/// winding. Opposite-winding copies are kept since they are how double-sided surfaces are modelled.
+std::vector<bool> findRedundantTriangles(const std::vector<uint32_t>& positionIndices, const std::vector<simd::float3>& positions, TriangleCleanupStats& stats);
+
+/// A small group of neighbouring triangles from one submesh with its own local vertex list
+struct MeshCluster {
+    uint32_t indexOffset;    // First index of the cluster in the reordered index buffer
+    uint32_t triangleCount;
+    uint32_t vertexOffset;   // First entry in MeshClusters::vertices
+    uint32_t vertexCount;
+    uint32_t materialSlot;
+    simd::float3 boundsMin;
+    simd::float3 boundsMax;
+    simd::float3 sphereCenter;
+    float sphereRadius;
+    simd::float3 coneAxis;   // Average facing of the triangles
+    float coneCutoff;        // Cosine of the cone half angle; <= 0 means the cluster can face every direction
+};
+
+struct MeshClusters {
+    std::vector<MeshCluster> clusters;
+    std::vector<uint32_t> vertices;   // Local vertex lists as model vertex indices
+    std::vector<uint8_t> triangles;   // Local indices into the cluster's vertex list, parallel to the reordered index buffer
+};
+
+/// Greedily grows clusters of at most maxVertices vertices and maxTriangles triangles within each submesh, preferring
+/// the adjacent triangle that adds the fewest vertices. Reorders indices so every cluster is one contiguous range.
+MeshClusters buildClusters(const std::vector<ModelVertexData>& vertices, std::vector<uint32_t>& indices, const std::vector<SubmeshData>& submeshes, size_t maxVertices, size_t maxTriangles);
+
+#endif /* mesh_utils_hpp */
@@ -1,32 +1,146 @@
 #include "model.hpp"
 
 #include "buffers.hpp"
+#include "mesh_utils.hpp"
+#include "hash.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tinyobjloader/tinyobjloader.h>
 
 #include <unordered_map>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <istream>
 #include <vector>
 #include <string>
-#include <unordered_map>
 #include <functional>   // std::hash
 #include <cstddef>      // size_t
+#include <limits>
+
+namespace {
+
+/// Read-only stream over bytes already in memory, so tinyobj parses a batched read without copying it into a string
+struct MemoryStreamBuf : std::streambuf {
+    explicit MemoryStreamBuf(std::span<const uint8_t> bytes) {
+        char* begin = const_cast<char*>(reinterpret_cast<const char*>(bytes.data()));
+        setg(begin, begin, begin + bytes.size());
+    }
+};
+
+/// What the MikkTSpace callbacks see: the triangles of mesh starting at firstIndex
+struct TangentRange {
+    Model* mesh;
+    size_t firstIndex;
+    size_t triangleCount;
+};
+
+}
+
+Model::Model(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::string& filepath, const ModelLoadOptions& options)
+    : Model(device, cmdQueue, filepath, std::span<const uint8_t>{}, options) {}
+
+Model::Model(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::string& filepath, std::span<const uint8_t> contents, const ModelLoadOptions& options) {
+    if (filepath.ends_with(".glb")) {
+        loadGlb(filepath);
+    } else if (filepath.ends_with(".ply")) {
+        loadPly(filepath);
+    } else {
+        loadObj(filepath, contents, options);
+    }
+    
+    computeBounds();
+    
+    if (options.optimizeLocality) {
+        optimizeLocality();
+    }
+    
+    if (options.buildClusters) {
+        clusterize(options);
+    }
+    
+    if (!options.lodRatios.empty()) {
+        generateLods(options.lodRatios);
+    }
+    
+#ifdef DEBUG_VALIDATE_VERTEX_COMPRESSION
+    validateVertexCompression();
+#endif
+    
+    computeContentHash();
+    uploadVertexStreams(device, cmdQueue);
+    uploadIndices(device, cmdQueue);
+}
 
-Model::Model(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::string& filepath) {
+void Model::loadObj(const std::string& filepath, std::span<const uint8_t> contents, const ModelLoadOptions& options) {
     tinyobj::ObjReaderConfig readerConfig;
     tinyobj::ObjReader reader;
-    if (!reader.ParseFromFile(filepath, readerConfig)) {
-      if (!reader.Error().empty()) {
-          std::cerr << "TinyObjReader: " << reader.Error();
+    tinyobj::attrib_t objAttrib;
+    std::vector<tinyobj::shape_t> objShapes;
+    std::vector<tinyobj::material_t> objMaterials;
+    std::string objWarning, objError;
+    
+    bool parsed;
+    if (contents.empty()) {
+        parsed = reader.ParseFromFile(filepath, readerConfig);
+    } else {
+        // Same as ParseFromFile, with .mtl files still found next to the OBJ
+        size_t slash = filepath.find_last_of('/');
+        tinyobj::MaterialFileReader materialReader(slash == std::string::npos ? "" : filepath.substr(0, slash));
+        MemoryStreamBuf buffer(contents);
+        std::istream stream(&buffer);
+        
+        parsed = tinyobj::LoadObj(&objAttrib, &objShapes, &objMaterials, &objWarning, &objError, &stream, &materialReader,
+                                  readerConfig.triangulate, readerConfig.vertex_color);
+    }
+    
+    if (!parsed) {
+      const std::string& error = contents.empty() ? reader.Error() : objError;
+      if (!error.empty()) {
+          std::cerr << "TinyObjReader: " << error;
       }
       exit(1);
     }
     
-    auto& attrib = reader.GetAttrib();
-    auto& shapes = reader.GetShapes();
+    auto& attrib = contents.empty() ? reader.GetAttrib() : objAttrib;
+    auto& shapes = contents.empty() ? reader.GetShapes() : objShapes;
+    auto& materials = contents.empty() ? reader.GetMaterials() : objMaterials;
+    
+    // Group the faces of every shape by material so each material slot becomes one contiguous index range. Faces without
+    //  a material (id -1) share slot 0 with the first material.
+    materialSlotCount = std::max<size_t>(materials.size(), 1);
+    std::vector<std::vector<tinyobj::index_t>> slotIndices(materialSlotCount);
     
-    const tinyobj::shape_t& shape = shapes[0];
+    for (const tinyobj::shape_t& shape : shapes) {
+        for (size_t face = 0; face < shape.mesh.num_face_vertices.size(); face++) {
+            int materialID = face < shape.mesh.material_ids.size() ? shape.mesh.material_ids[face] : -1;
+            size_t slot = (materialID >= 0 && materialID < materialSlotCount) ? materialID : 0;
+            
+            // Triangulation is on by default in the reader config so every face has 3 vertices
+            for (size_t vert = 0; vert < 3; vert++) {
+                slotIndices[slot].push_back(shape.mesh.indices[face * 3 + vert]);
+            }
+        }
+    }
+    
+    std::vector<tinyobj::index_t> indices;
+    submeshes = std::vector<SubmeshData>{};
+    for (uint32_t slot = 0; slot < slotIndices.size(); slot++) {
+        if (slotIndices[slot].empty()) {
+            continue;
+        }
+        
+        submeshes.push_back(SubmeshData{
+            .indexOffset = static_cast<uint32_t>(indices.size()),
+            .indexCount = static_cast<uint32_t>(slotIndices[slot].size()),
+            .materialSlot = slot
+        });
+        
+        indices.insert(indices.end(), slotIndices[slot].begin(), slotIndices[slot].end());
+    }
     
     std::vector<simd::float3> vertices(attrib.vertices.size() / 3);
     for (size_t i = 0; i < attrib.vertices.size(); i += 3) {
@@ -43,16 +157,330 @@ Model::Model(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::string
         texcoords[i / 2] = simd::float2{attrib.texcoords[i], attrib.texcoords[i + 1]};
     }
     
-    buildVertexData(vertices, normals, texcoords, shape.mesh.indices);
+    if (options.weldVertices) {
+        weldGeometry(vertices, indices, options.weldEpsilon);
+    }
+    
+    buildVertexData(vertices, normals, texcoords, indices);
     computeTBNs();
+}
+
+void Model::weldGeometry(const std::vector<simd::float3>& vertices, std::vector<tinyobj::index_t>& indices, float epsilon) {
+    auto start = std::chrono::steady_clock::now();
+    
+    size_t weldedCount = 0;
+    std::vector<uint32_t> remap = weldPositions(vertices, epsilon, &weldedCount);
+    
+    std::vector<uint32_t> positionIndices(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i].vertex_index = static_cast<int>(remap[indices[i].vertex_index]);
+        positionIndices[i] = indices[i].vertex_index;
+    }
+    
+    TriangleCleanupStats stats;
+    std::vector<bool> redundant = findRedundantTriangles(positionIndices, vertices, stats);
+    
+    // Compact the surviving triangles in place and shrink each submesh range to match
+    size_t write = 0;
+    for (SubmeshData& submesh : submeshes) {
+        size_t submeshStart = write;
+        for (size_t i = submesh.indexOffset; i < submesh.indexOffset + submesh.indexCount; i += 3) {
+            if (redundant[i / 3]) {
+                continue;
+            }
+            
+            for (size_t vert = 0; vert < 3; vert++) {
+                indices[write++] = indices[i + vert];
+            }
+        }
+        
+        submesh.indexOffset = static_cast<uint32_t>(submeshStart);
+        submesh.indexCount = static_cast<uint32_t>(write - submeshStart);
+    }
+    indices.resize(write);
+    
+    std::erase_if(submeshes, [](const SubmeshData& submesh) { return submesh.indexCount == 0; });
+    
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Weld (" << elapsed.count() * 1000 << " ms): " << weldedCount << " of " << vertices.size() << " positions welded, "
+              << stats.degenerate << " degenerate and " << stats.duplicate << " duplicate triangles removed\n";
+}
+
+void Model::computeBounds() {
+    if (finalVertices.empty()) {
+        return;
+    }
+    
+    simd::float3 lo = finalVertices[0].pos;
+    simd::float3 hi = finalVertices[0].pos;
+    for (const ModelVertexData& v : finalVertices) {
+        lo = simd::min(lo, v.pos);
+        hi = simd::max(hi, v.pos);
+    }
+    
+    boundsMin = lo;
+    boundsExtent = hi - lo;
+}
+
+void Model::optimizeLocality() {
+    float acmrBefore = computeACMR(finalIndices, finalVertices.size());
+    float missRateBefore = computeVertexFetchMissRate(finalIndices, sizeof(VertexPosition));
+    
+    auto start = std::chrono::steady_clock::now();
+    reorderTrianglesMorton(finalIndices, finalVertices, submeshes, boundsMin, boundsExtent);
+    reorderVerticesFirstTouch(finalVertices, finalIndices);
+    auto end = std::chrono::steady_clock::now();
+    
+    vertexCount = finalVertices.size();
+    
+    float acmrAfter = computeACMR(finalIndices, finalVertices.size());
+    float missRateAfter = computeVertexFetchMissRate(finalIndices, sizeof(VertexPosition));
+    
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Locality reorder (" << elapsed.count() * 1000 << " ms): ACMR " << acmrBefore << " -> " << acmrAfter
+              << ", position fetch miss rate " << missRateBefore * 100 << "% -> " << missRateAfter * 100 << "%\n";
+}
+
+void Model::clusterize(const ModelLoadOptions& options) {
+    auto start = std::chrono::steady_clock::now();
+    clusters = buildClusters(finalVertices, finalIndices, submeshes, options.clusterMaxVertices, options.clusterMaxTriangles);
+    auto end = std::chrono::steady_clock::now();
+    
+    // Clusters stay inside their submesh, so each one maps onto a geometry entry with the submesh's material slot
+    clusterSubmeshes = std::vector<SubmeshData>{};
+    clusterSubmeshes.reserve(clusters.clusters.size());
+    
+    size_t minTriangles = SIZE_MAX;
+    size_t totalVertices = 0;
+    size_t cullable = 0;
+    double radiusSum = 0;
+    double coneAngleSum = 0;
+    for (const MeshCluster& cluster : clusters.clusters) {
+        clusterSubmeshes.push_back(SubmeshData{
+            .indexOffset = cluster.indexOffset,
+            .indexCount = cluster.triangleCount * 3,
+            .materialSlot = cluster.materialSlot
+        });
+        
+        minTriangles = std::min<size_t>(minTriangles, cluster.triangleCount);
+        totalVertices += cluster.vertexCount;
+        cullable += cluster.coneCutoff > 0;
+        radiusSum += cluster.sphereRadius;
+        coneAngleSum += std::acos(std::clamp(cluster.coneCutoff, -1.0f, 1.0f));
+    }
+    
+    if (clusters.clusters.empty()) {
+        return;
+    }
+    
+    // Cluster quality: how full clusters are, how many vertices each triangle costs (lower means better reuse), how
+    //  tight the bounds are relative to the model, and how many clusters a normal cone could backface-cull
+    const double clusterCount = static_cast<double>(clusters.clusters.size());
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Clusters (" << elapsed.count() * 1000 << " ms): " << clusters.clusters.size() << " clusters, "
+              << triangleCount / clusterCount << " triangles avg (" << minTriangles << " min, "
+              << 100.0 * triangleCount / (clusterCount * options.clusterMaxTriangles) << "% full), "
+              << totalVertices / clusterCount << " vertices avg, "
+              << static_cast<double>(totalVertices) / triangleCount << " vertices/triangle, "
+              << "bounding radius " << radiusSum / clusterCount / std::max(simd::length(boundsExtent), EPS) << " of model diagonal, "
+              << 100.0 * cullable / clusterCount << "% cone-cullable, "
+              << coneAngleSum / clusterCount * 180.0 / M_PI << " deg avg cone\n";
+}
+
+void Model::computeContentHash() {
+    // Field by field, since the simd vectors carry an undefined padding lane
+    uint64_t hash = hashCombine(0, static_cast<uint64_t>(materialSlotCount));
+    for (const ModelVertexData& v : finalVertices) {
+        hash = hashCombine(hash, v.pos.x); hash = hashCombine(hash, v.pos.y); hash = hashCombine(hash, v.pos.z);
+        hash = hashCombine(hash, v.normal.x); hash = hashCombine(hash, v.normal.y); hash = hashCombine(hash, v.normal.z);
+        hash = hashCombine(hash, v.tangent.x); hash = hashCombine(hash, v.tangent.y); hash = hashCombine(hash, v.tangent.z);
+        hash = hashCombine(hash, v.uv.x); hash = hashCombine(hash, v.uv.y);
+        hash = hashCombine(hash, v.sign);
+    }
+    
+    for (size_t lod = 0; lod < getLodCount(); lod++) {
+        const std::vector<uint32_t>& lodIndices = getIndices(lod);
+        const std::vector<SubmeshData>& lodSubmeshes = getSubmeshes(lod);
+        hash = hashBytes(lodIndices.data(), lodIndices.size() * sizeof(uint32_t), hash);
+        hash = hashBytes(lodSubmeshes.data(), lodSubmeshes.size() * sizeof(SubmeshData), hash);
+    }
+    
+    contentHash = hash;
+}
+
+bool Model::hasSameGeometry(const Model& other) const {
+    if (contentHash != other.contentHash || materialSlotCount != other.materialSlotCount || getLodCount() != other.getLodCount()
+        || finalVertices.size() != other.finalVertices.size() || cpuGeometryReleased || other.cpuGeometryReleased) {
+        return false;
+    }
+    
+    auto sameVector = [](simd::float3 a, simd::float3 b) { return a.x == b.x && a.y == b.y && a.z == b.z; };
+    for (size_t i = 0; i < finalVertices.size(); i++) {
+        const ModelVertexData& a = finalVertices[i];
+        const ModelVertexData& b = other.finalVertices[i];
+        if (!sameVector(a.pos, b.pos) || !sameVector(a.normal, b.normal) || !sameVector(a.tangent, b.tangent)
+            || a.uv.x != b.uv.x || a.uv.y != b.uv.y || a.sign != b.sign) {
+            return false;
+        }
+    }
+    
+    for (size_t lod = 0; lod < getLodCount(); lod++) {
+        const std::vector<SubmeshData>& a = getSubmeshes(lod);
+        const std::vector<SubmeshData>& b = other.getSubmeshes(lod);
+        if (getIndices(lod) != other.getIndices(lod) || a.size() != b.size()
+            || std::memcmp(a.data(), b.data(), a.size() * sizeof(SubmeshData)) != 0) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+void Model::generateLods(const std::vector<float>& ratios) {
+    auto start = std::chrono::steady_clock::now();
+    
+    for (float ratio : ratios) {
+        ModelLod lod;
+        
+        // Simplify each submesh on its own so material ranges survive
+        for (const SubmeshData& submesh : submeshes) {
+            std::vector<uint32_t> submeshIndices(finalIndices.begin() + submesh.indexOffset, finalIndices.begin() + submesh.indexOffset + submesh.indexCount);
+            size_t target = std::max<size_t>(static_cast<size_t>(submesh.indexCount * ratio) / 3 * 3, 3);
+            
+            float error = 0;
+            float distance = 0;
+            std::vector<uint32_t> simplified = simplifyMesh(finalVertices, submeshIndices, target, &error, &distance);
+            if (simplified.empty()) {
+                continue;
+            }
+            
+            lod.submeshes.push_back(SubmeshData{
+                .indexOffset = static_cast<uint32_t>(lod.indices.size()),
+                .indexCount = static_cast<uint32_t>(simplified.size()),
+                .materialSlot = submesh.materialSlot
+            });
+            lod.indices.insert(lod.indices.end(), simplified.begin(), simplified.end());
+            lod.error = std::max(lod.error, error);
+            lod.distance = std::max(lod.distance, distance);
+        }
+        
+        // A level that simplified away or stopped shrinking would only add an empty or redundant BLAS, and the ratios
+        //  after it can't do better
+        lod.triangleCount = lod.indices.size() / 3;
+        if (lod.triangleCount == 0 || lod.triangleCount >= (lods.empty() ? triangleCount : lods.back().triangleCount)) {
+            break;
+        }
+        lods.push_back(std::move(lod));
+    }
+    
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    
+    std::cout << "LODs (" << elapsed.count() * 1000 << " ms): " << triangleCount;
+    for (const ModelLod& lod : lods) {
+        std::cout << " -> " << lod.triangleCount << " (error " << lod.error << ")";
+    }
+    std::cout << " triangles\n";
+}
+
+void Model::uploadVertexStreams(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
+    // Split the interleaved vertices into a tight position stream and a compressed shading stream
+    std::vector<VertexPosition> positions(finalVertices.size());
+    std::vector<VertexShadingData> shading(finalVertices.size());
+    
+    for (size_t i = 0; i < finalVertices.size(); i++) {
+        const ModelVertexData& v = finalVertices[i];
+        
+#ifdef QUANTIZE_POSITIONS
+        positions[i] = encodeQuantizedPosition(v.pos, boundsMin, boundsExtent);
+#else
+        positions[i] = VertexPosition{v.pos.x, v.pos.y, v.pos.z};
+#endif
+        shading[i] = VertexShadingData{
+            .normal = encodeOctahedral(v.normal),
+            .tangent = encodeTangent(v.tangent, v.sign),
+            .uv = encodeHalf2(v.uv)
+        };
+    }
     
-    vertexBuffer = makePrivateBuffer(device, cmdQueue, finalVertices.data(), static_cast<uint32_t>(finalVertices.size() * sizeof(ModelVertexData)));
-    indexBuffer = makePrivateBuffer(device, cmdQueue, finalIndices.data(), static_cast<uint32_t>(finalIndices.size() * sizeof(uint32_t)));
+    positionBuffer = makePrivateBuffer(device, cmdQueue, positions.data(), positions.size() * sizeof(VertexPosition));
+    shadingBuffer = makePrivateBuffer(device, cmdQueue, shading.data(), shading.size() * sizeof(VertexShadingData));
     
-    vertexBuffer->setLabel(NS::String::string("Vertex Buffer", NS::UTF8StringEncoding));
+    positionBuffer->setLabel(NS::String::string("Position Buffer", NS::UTF8StringEncoding));
+    shadingBuffer->setLabel(NS::String::string("Shading Buffer", NS::UTF8StringEncoding));
+}
+
+void Model::uploadIndices(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
+    // Indices are local to the model, so any model that addresses fewer than 2^16 vertices can use 16-bit indices
+    indexType = vertexCount <= UINT16_MAX + 1 ? MTL::IndexTypeUInt16 : MTL::IndexTypeUInt32;
+    
+    indexBuffer = uploadIndexBuffer(device, cmdQueue, finalIndices);
     indexBuffer->setLabel(NS::String::string("Index Buffer", NS::UTF8StringEncoding));
+    
+    for (ModelLod& lod : lods) {
+        lod.indexBuffer = uploadIndexBuffer(device, cmdQueue, lod.indices);
+        lod.indexBuffer->setLabel(NS::String::string("LOD Index Buffer", NS::UTF8StringEncoding));
+    }
 }
 
+MTL::Buffer* Model::uploadIndexBuffer(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::vector<uint32_t>& indices) const {
+    if (indexType == MTL::IndexTypeUInt32) {
+        return makePrivateBuffer(device, cmdQueue, indices.data(), indices.size() * sizeof(uint32_t));
+    }
+    
+    // Padded to a whole number of 32-bit words since blit copies on macOS must be 4-byte multiples
+    std::vector<uint16_t> narrowIndices(indices.begin(), indices.end());
+    if (narrowIndices.size() % 2 != 0) {
+        narrowIndices.push_back(0);
+    }
+    
+    return makePrivateBuffer(device, cmdQueue, narrowIndices.data(), narrowIndices.size() * sizeof(uint16_t));
+}
+
+#ifdef DEBUG_VALIDATE_VERTEX_COMPRESSION
+void Model::validateVertexCompression() const {
+    // Error bounds implied by the encodings: snorm16 octahedral directions are within ~1e-4 rad, half UVs within half an ulp
+    //  of their magnitude, and unorm16 positions within half a quantization step of the bounds, plus the float rounding
+    //  of decoding relative to boundsMin, which dominates for small models far from the origin.
+    constexpr float maxDirectionError = 2e-4f;
+    const simd::float3 maxPositionError = boundsExtent / 65535.0f * 0.5f
+        + (simd::abs(boundsMin) + boundsExtent) * (4 * std::numeric_limits<float>::epsilon());
+    
+    float worstNormal = 0, worstTangent = 0, worstUV = 0, worstPos = 0;
+    for (const ModelVertexData& v : finalVertices) {
+        simd::float3 n = decodeOctahedral(encodeOctahedral(v.normal));
+        uint32_t tangentBits = encodeTangent(v.tangent, v.sign);
+        simd::float3 t = decodeTangent(tangentBits);
+        simd::float2 uv = decodeHalf2(encodeHalf2(v.uv));
+        simd::float3 p = decodeQuantizedPosition(encodeQuantizedPosition(v.pos, boundsMin, boundsExtent), boundsMin, boundsExtent);
+        
+        if (simd::length(v.normal) > EPS) {
+            worstNormal = std::max(worstNormal, simd::length(n - simd::normalize(v.normal)));
+        }
+        if (simd::length(v.tangent) > EPS) {
+            worstTangent = std::max(worstTangent, simd::length(t - simd::normalize(v.tangent)));
+        }
+        
+        // Half precision has 11 significant bits, so the allowed error scales with the magnitude of the coordinate
+        simd::float2 uvError = simd::abs(uv - v.uv) / simd::max(simd::abs(v.uv), simd::float2(1.0f / 1024.0f));
+        worstUV = std::max(worstUV, simd::reduce_max(uvError));
+        
+        simd::float3 posError = simd::abs(p - v.pos) - maxPositionError;
+        worstPos = std::max(worstPos, simd::reduce_max(posError));
+        
+        assert(decodeTangentSign(tangentBits) == (v.sign >= 0 ? 1.0f : -1.0f));
+    }
+    
+    std::cout << "Vertex compression error: normal " << worstNormal << ", tangent " << worstTangent << ", uv (relative) " << worstUV << ", position over bound " << worstPos << "\n";
+    
+    assert(worstNormal <= maxDirectionError);
+    assert(worstTangent <= maxDirectionError);
+    assert(worstUV <= 1.0f / 1024.0f);
+    assert(worstPos <= 0);
+}
+#endif
+
 void Model::buildVertexData(const std::vector<simd::float3>& vertices, const std::vector<simd::float3>& normals, const std::vector<simd::float2>& texcoords, const std::vector<tinyobj::index_t>& indices) {
     
     finalVertices = std::vector<ModelVertexData>{};
@@ -60,7 +488,7 @@ void Model::buildVertexData(const std::vector<simd::float3>& vertices, const std
     std::unordered_map<ModelVertexData, int, ModelVertexHash> idxMap;
     
     for (const tinyobj::index_t& idx : indices) {
-        simd::float2 texcoord = texcoords.size() == 0 ? simd::float2(0) : texcoords[idx.texcoord_index];
+        simd::float2 texcoord = (idx.texcoord_index >= 0 && idx.texcoord_index < texcoords.size()) ? texcoords[idx.texcoord_index] : simd::float2(0);
         
         ModelVertexData vertex{
             .pos = vertices[idx.vertex_index],
@@ -84,7 +512,9 @@ void Model::buildVertexData(const std::vector<simd::float3>& vertices, const std
     vertexCount = finalVertices.size();
 }
 
-void Model::computeTBNs() {
+void Model::computeTBNs(size_t indexBegin, size_t indexEnd) {
+    TangentRange range{this, indexBegin, (std::min(indexEnd, finalIndices.size()) - indexBegin) / 3};
+    
     SMikkTSpaceInterface mikkInterface = {
         .m_getNumFaces = getNumFaces,
         .m_getNumVerticesOfFace = getNumVerticesOfFace,
@@ -96,38 +526,148 @@ void Model::computeTBNs() {
     
     SMikkTSpaceContext mikkContext{
         .m_pInterface = &mikkInterface,
-        .m_pUserData = this
+        .m_pUserData = &range
     };
 
     genTangSpaceDefault(&mikkContext);
 }
 
-MTL::Buffer* Model::getVertexBuffer() const {
-    return vertexBuffer;
+void Model::computeFlatAveragedNormals(uint32_t vertexBase, size_t indexBase) {
+    // For formats that may come without normals. Shared vertices get the area-weighted face normal average, which is the
+    //  flat normal for unshared vertices and avoids splitting the vertex pool.
+    for (size_t i = indexBase; i + 2 < finalIndices.size(); i += 3) {
+        ModelVertexData& v0 = finalVertices[finalIndices[i]];
+        ModelVertexData& v1 = finalVertices[finalIndices[i + 1]];
+        ModelVertexData& v2 = finalVertices[finalIndices[i + 2]];
+        
+        simd::float3 faceNormal = simd::cross(v1.pos - v0.pos, v2.pos - v0.pos);
+        v0.normal += faceNormal;
+        v1.normal += faceNormal;
+        v2.normal += faceNormal;
+    }
+    
+    for (size_t i = vertexBase; i < finalVertices.size(); i++) {
+        float length = simd::length(finalVertices[i].normal);
+        finalVertices[i].normal = length > EPS ? finalVertices[i].normal / length : simd::float3{0, 1, 0};
+    }
+}
+
+MTL::Buffer* Model::getPositionBuffer() const {
+    return positionBuffer;
 }
 
-MTL::Buffer* Model::getIndexBuffer() const {
-    return indexBuffer;
+MTL::Buffer* Model::getShadingBuffer() const {
+    return shadingBuffer;
 }
 
-size_t Model::getTriangleCount() const {
-    return triangleCount;
+MTL::Buffer* Model::getIndexBuffer(size_t lod) const {
+    return lod == 0 ? indexBuffer : lods[lod - 1].indexBuffer;
+}
+
+size_t Model::getTriangleCount(size_t lod) const {
+    return lod == 0 ? triangleCount : lods[lod - 1].triangleCount;
+}
+
+size_t Model::getLodCount() const {
+    return lods.size() + 1;
+}
+
+float Model::getLodDistance(size_t lod) const {
+    return lod == 0 ? 0.0f : lods[lod - 1].distance;
 }
 
 size_t Model::getVertexCount() const {
     return vertexCount;
 }
 
-const std::vector<uint32_t>& Model::getIndices() const {
-    return finalIndices;
+MTL::IndexType Model::getIndexType() const {
+    return indexType;
+}
+
+size_t Model::getIndexStride() const {
+    return indexType == MTL::IndexTypeUInt16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+simd::float3 Model::getBoundsMin() const {
+    return boundsMin;
+}
+
+simd::float3 Model::getBoundsExtent() const {
+    return boundsExtent;
+}
+
+uint64_t Model::getContentHash() const {
+    return contentHash;
+}
+
+const std::vector<uint32_t>& Model::getIndices(size_t lod) const {
+    return lod == 0 ? finalIndices : lods[lod - 1].indices;
 }
 const std::vector<ModelVertexData>& Model::getVertices() const {
     return finalVertices;
 }
 
+void Model::releaseGpuBuffers() {
+    for (MTL::Buffer** buffer : {&positionBuffer, &shadingBuffer, &indexBuffer}) {
+        if (*buffer) {
+            (*buffer)->release();
+            *buffer = nullptr;
+        }
+    }
+    for (ModelLod& lod : lods) {
+        if (lod.indexBuffer) {
+            lod.indexBuffer->release();
+            lod.indexBuffer = nullptr;
+        }
+    }
+}
+
+void Model::releaseCpuGeometry() {
+    std::vector<ModelVertexData>().swap(finalVertices);
+    std::vector<uint32_t>().swap(finalIndices);
+    for (ModelLod& lod : lods) {
+        std::vector<uint32_t>().swap(lod.indices);
+    }
+    cpuGeometryReleased = true;
+}
+
+size_t Model::getCpuGeometryBytes() const {
+    size_t bytes = finalVertices.capacity() * sizeof(ModelVertexData) + finalIndices.capacity() * sizeof(uint32_t);
+    for (const ModelLod& lod : lods) {
+        bytes += lod.indices.capacity() * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+size_t Model::getGpuGeometryBytes() const {
+    size_t bytes = 0;
+    for (MTL::Buffer* buffer : {positionBuffer, shadingBuffer, indexBuffer}) {
+        bytes += buffer ? buffer->allocatedSize() : 0;
+    }
+    for (const ModelLod& lod : lods) {
+        bytes += lod.indexBuffer ? lod.indexBuffer->allocatedSize() : 0;
+    }
+    return bytes;
+}
+
+const std::vector<SubmeshData>& Model::getSubmeshes(size_t lod) const {
+    if (lod > 0) {
+        return lods[lod - 1].submeshes;
+    }
+    return clusterSubmeshes.empty() ? submeshes : clusterSubmeshes;
+}
+
+const MeshClusters& Model::getClusters() const {
+    return clusters;
+}
+
+size_t Model::getMaterialSlotCount() const {
+    return materialSlotCount;
+}
+
 int getNumFaces(const SMikkTSpaceContext* ctx) {
-    Model* mesh = (Model*)ctx->m_pUserData;
-    return static_cast<int>(mesh->getTriangleCount());
+    const TangentRange* range = (const TangentRange*)ctx->m_pUserData;
+    return static_cast<int>(range->triangleCount);
 }
 
 int getNumVerticesOfFace(const SMikkTSpaceContext* ctx, int face) {
@@ -135,8 +675,9 @@ int getNumVerticesOfFace(const SMikkTSpaceContext* ctx, int face) {
 }
 
 void getPosition(const SMikkTSpaceContext* ctx, float fvPosOut[3], int face, int vert) {
-    Model* mesh = (Model*)ctx->m_pUserData;
-    uint32_t idx = mesh->getIndices()[face * 3 + vert];
+    const TangentRange* range = (const TangentRange*)ctx->m_pUserData;
+    Model* mesh = range->mesh;
+    uint32_t idx = mesh->getIndices()[range->firstIndex + face * 3 + vert];
     
     const std::vector<ModelVertexData>& vertices = mesh->getVertices();
     fvPosOut[0] = vertices[idx].pos.x;
@@ -145,8 +686,9 @@ void getPosition(const SMikkTSpaceContext* ctx, float fvPosOut[3], int face, int
 }
 
 void getNormal(const SMikkTSpaceContext* ctx, float fvNormOut[3], int face, int vert) {
-    Model* mesh = (Model*)ctx->m_pUserData;
-    uint32_t idx = mesh->getIndices()[face * 3 + vert];
+    const TangentRange* range = (const TangentRange*)ctx->m_pUserData;
+    Model* mesh = range->mesh;
+    uint32_t idx = mesh->getIndices()[range->firstIndex + face * 3 + vert];
     
     const std::vector<ModelVertexData>& vertices = mesh->getVertices();
     fvNormOut[0] = vertices[idx].normal.x;
@@ -155,8 +697,9 @@ void getNormal(const SMikkTSpaceContext* ctx, float fvNormOut[3], int face, int
 }
 
 void getTexCoord(const SMikkTSpaceContext* ctx, float fvTexcOut[2], int face, int vert) {
-    Model* mesh = (Model*)ctx->m_pUserData;
-    uint32_t idx = mesh->getIndices()[face * 3 + vert];
+    const TangentRange* range = (const TangentRange*)ctx->m_pUserData;
+    Model* mesh = range->mesh;
+    uint32_t idx = mesh->getIndices()[range->firstIndex + face * 3 + vert];
     
     const std::vector<ModelVertexData>& vertices = mesh->getVertices();
     fvTexcOut[0] = vertices[idx].uv.x;
@@ -164,8 +707,9 @@ void getTexCoord(const SMikkTSpaceContext* ctx, float fvTexcOut[2], int face, in
 }
 
 void setTSpaceBasic(const SMikkTSpaceContext* ctx, const float fvTangent[3], float fSign, int face, int vert) {
-    Model* mesh = (Model*)ctx->m_pUserData;
-    uint32_t idx = mesh->getIndices()[face * 3 + vert];
+    const TangentRange* range = (const TangentRange*)ctx->m_pUserData;
+    Model* mesh = range->mesh;
+    uint32_t idx = mesh->getIndices()[range->firstIndex + face * 3 + vert];
     
     std::vector<ModelVertexData>& vertices = mesh->finalVertices;  // this is a friend function so we cand o this
     vertices[idx].tangent = simd::float3{fvTangent[0], fvTangent[1], fvTangent[2]};
@@ -5,11 +5,13 @@
 #include <QuartzCore/CAMetalLayer.hpp>
 #include <simd/simd.h>
 #include <cstdint>
+#include <span>
 #include <mikktspace/mikktspace.h>
 
 #include <tinyobjloader/tinyobjloader.h>
 
 #include "shared.hpp"
+#include "mesh_utils.hpp"
 
 namespace MTL { class Device; class Buffer; }
 
@@ -38,16 +40,77 @@ struct ModelVertexHash {
     }
 };
 
+struct ModelLoadOptions {
+    /// Welds positions closer than weldEpsilon (in model units) and drops degenerate and duplicate triangles on OBJ import
+    bool weldVertices = false;
+    float weldEpsilon = 1e-5f;
+    
+    /// Reorders triangles along a Morton curve and renumbers vertices in first-touch order after import
+    bool optimizeLocality = false;
+    
+    /// Splits LOD 0 into clusters of neighbouring triangles, each its own BLAS geometry
+    bool buildClusters = false;
+    uint32_t clusterMaxVertices = 64;
+    uint32_t clusterMaxTriangles = 124;
+    
+    /// Triangle ratios of the simplified LODs to generate after LOD 0, e.g. {0.5, 0.25, 0.1}
+    std::vector<float> lodRatios;
+};
+
+/// A simplified version of the model that shares its vertex pool
+struct ModelLod {
+    std::vector<uint32_t> indices;
+    std::vector<SubmeshData> submeshes;
+    MTL::Buffer* indexBuffer = nullptr;
+    size_t triangleCount = 0;
+    float error = 0;
+    float distance = 0;  // Largest distance a vertex moved from LOD 0, in model space
+};
+
 class Model {
 public:
-    Model(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::string& filepath);
+    Model(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::string& filepath, const ModelLoadOptions& options = ModelLoadOptions{});
+    
+    /// Parses an OBJ from bytes already read from filepath, e.g. by BatchFileReader. The path still locates .mtl files.
+    /// GLB and PLY files are memory-mapped instead, so contents is ignored for them.
+    Model(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::string& filepath, std::span<const uint8_t> contents, const ModelLoadOptions& options = ModelLoadOptions{});
 
-    [[nodiscard]] MTL::Buffer* getVertexBuffer() const;
-    [[nodiscard]] MTL::Buffer* getIndexBuffer() const;
-    [[nodiscard]] const std::vector<uint32_t>& getIndices() const;
+    [[nodiscard]] MTL::Buffer* getPositionBuffer() const;
+    [[nodiscard]] MTL::Buffer* getShadingBuffer() const;
+    [[nodiscard]] MTL::Buffer* getIndexBuffer(size_t lod = 0) const;
+    [[nodiscard]] const std::vector<uint32_t>& getIndices(size_t lod = 0) const;
     [[nodiscard]] const std::vector<ModelVertexData>& getVertices() const;
-    [[nodiscard]] size_t getTriangleCount() const;
+    [[nodiscard]] const std::vector<SubmeshData>& getSubmeshes(size_t lod = 0) const;
+    [[nodiscard]] const MeshClusters& getClusters() const;
+    [[nodiscard]] size_t getMaterialSlotCount() const;
+    [[nodiscard]] size_t getTriangleCount(size_t lod = 0) const;
+    [[nodiscard]] size_t getLodCount() const;
+    
+    /// Largest distance a vertex of the LOD moved away from LOD 0 in simplification, in model space. 0 for LOD 0.
+    [[nodiscard]] float getLodDistance(size_t lod) const;
     [[nodiscard]] size_t getVertexCount() const;
+    [[nodiscard]] MTL::IndexType getIndexType() const;
+    [[nodiscard]] size_t getIndexStride() const;
+    [[nodiscard]] simd::float3 getBoundsMin() const;
+    [[nodiscard]] simd::float3 getBoundsExtent() const;
+    
+    /// Hash of the processed geometry (vertices, every LOD's indices and geometry tables), equal for equal content
+    [[nodiscard]] uint64_t getContentHash() const;
+    
+    /// Full comparison of the processed geometry, to confirm a content hash match. False once either model's CPU
+    /// geometry was released, since there is nothing left to compare.
+    [[nodiscard]] bool hasSameGeometry(const Model& other) const;
+    
+    /// Frees the model's own GPU buffers once they have been copied elsewhere, e.g. into the scene arena and BLASes. The
+    /// buffer getters return nullptr afterwards.
+    void releaseGpuBuffers();
+    
+    /// Frees the CPU vertices and indices. Counts, bounds and submesh tables stay, so the model can still be laid out
+    /// and LOD-selected.
+    void releaseCpuGeometry();
+    
+    [[nodiscard]] size_t getCpuGeometryBytes() const;
+    [[nodiscard]] size_t getGpuGeometryBytes() const;
     
     friend void setTSpaceBasic(const SMikkTSpaceContext* ctx, const float fvTangent[3], float fSign, int face, int vert);
     
@@ -55,15 +118,45 @@ private:
     // MikkTSpace Callback:
     void buildVertexData(const std::vector<simd::float3>& vertices, const std::vector<simd::float3>& normals, const std::vector<simd::float2>& texcoords, const std::vector<tinyobj::index_t>& indices);
     
-    void computeTBNs();
+    void loadObj(const std::string& filepath, std::span<const uint8_t> contents, const ModelLoadOptions& options);
+    void loadGlb(const std::string& filepath);
+    void loadPly(const std::string& filepath);
+    void computeFlatAveragedNormals(uint32_t vertexBase, size_t indexBase);
+    void weldGeometry(const std::vector<simd::float3>& vertices, std::vector<tinyobj::index_t>& indices, float epsilon);
+    /// MikkTSpace tangents for the triangles of indices [indexBegin, indexEnd)
+    void computeTBNs(size_t indexBegin = 0, size_t indexEnd = SIZE_MAX);
+    void computeBounds();
+    void optimizeLocality();
+    void clusterize(const ModelLoadOptions& options);
+    void generateLods(const std::vector<float>& ratios);
+    void computeContentHash();
+    void uploadVertexStreams(MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    void uploadIndices(MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    MTL::Buffer* uploadIndexBuffer(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::vector<uint32_t>& indices) const;
+    
+#ifdef DEBUG_VALIDATE_VERTEX_COMPRESSION
+    void validateVertexCompression() const;
+#endif
     
     std::vector<uint32_t> finalIndices;
     std::vector<ModelVertexData> finalVertices;
+    std::vector<SubmeshData> submeshes;
+    MeshClusters clusters;
+    std::vector<SubmeshData> clusterSubmeshes;  // One entry per cluster, replaces submeshes as the LOD 0 geometry table
+    std::vector<ModelLod> lods;  // LOD 1 onwards; LOD 0 is finalIndices/submeshes
+    bool cpuGeometryReleased = false;
     
-    MTL::Buffer* vertexBuffer = nullptr;
+    MTL::Buffer* positionBuffer = nullptr;
+    MTL::Buffer* shadingBuffer = nullptr;
     MTL::Buffer* indexBuffer = nullptr;
     size_t triangleCount = 0;
     size_t vertexCount = 0;
+    size_t materialSlotCount = 1;
+    
+    MTL::IndexType indexType = MTL::IndexTypeUInt32;
+    simd::float3 boundsMin = simd::float3(0);
+    simd::float3 boundsExtent = simd::float3(0);
+    uint64_t contentHash = 0;
 };
 
 #endif /* model_hpp */
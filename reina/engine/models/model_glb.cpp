@@ -0,0 +1,484 @@
+#include "model.hpp"
+
+#include "mapped_file.hpp"
+#include "json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <string>
+
+namespace {
+
+constexpr uint32_t GLB_MAGIC = 0x46546C67;       // "glTF"
+constexpr uint32_t GLB_CHUNK_JSON = 0x4E4F534A;  // "JSON"
+constexpr uint32_t GLB_CHUNK_BIN = 0x004E4942;   // "BIN\0"
+
+constexpr int GLTF_BYTE = 5120;
+constexpr int GLTF_UNSIGNED_BYTE = 5121;
+constexpr int GLTF_SHORT = 5122;
+constexpr int GLTF_UNSIGNED_SHORT = 5123;
+constexpr int GLTF_UNSIGNED_INT = 5125;
+constexpr int GLTF_FLOAT = 5126;
+constexpr int GLTF_MODE_TRIANGLES = 4;
+
+/// An accessor resolved to a strided range of the mapped BIN chunk
+struct GlbAccessor {
+    const uint8_t* data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int componentType = 0;
+    int components = 0;
+    bool normalized = false;
+};
+
+[[noreturn]] void glbError(const std::string& filepath, const std::string& message) {
+    std::cerr << "GLB loader: " << filepath << ": " << message << "\n";
+    exit(1);
+}
+
+uint32_t readU32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+size_t componentSize(int componentType) {
+    switch (componentType) {
+        case GLTF_BYTE: return 1;
+        case GLTF_UNSIGNED_BYTE: return 1;
+        case GLTF_SHORT: return 2;
+        case GLTF_UNSIGNED_SHORT: return 2;
+        case GLTF_UNSIGNED_INT: return 4;
+        case GLTF_FLOAT: return 4;
+        default: return 0;
+    }
+}
+
+int componentCount(const std::string& type) {
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+
+GlbAccessor resolveAccessor(const std::string& filepath, const JsonValue& gltf, size_t accessorIdx, const uint8_t* bin, size_t binSize) {
+    const JsonValue* accessors = gltf.find("accessors");
+    const JsonValue* bufferViews = gltf.find("bufferViews");
+    if (!accessors || accessorIdx >= accessors->array.size()) {
+        glbError(filepath, "accessor " + std::to_string(accessorIdx) + " out of range");
+    }
+
+    const JsonValue& accessor = accessors->array[accessorIdx];
+    if (accessor.find("sparse")) {
+        glbError(filepath, "sparse accessors are not supported");
+    }
+
+    GlbAccessor view;
+    view.count = static_cast<size_t>(accessor.getNumber("count", 0));
+    view.componentType = static_cast<int>(accessor.getNumber("componentType", 0));
+    view.components = componentCount(accessor.getString("type"));
+    view.normalized = accessor.getBool("normalized", false);
+
+    size_t elementSize = componentSize(view.componentType) * view.components;
+    if (elementSize == 0) {
+        glbError(filepath, "accessor " + std::to_string(accessorIdx) + " has an unsupported layout");
+    }
+
+    const JsonValue* bufferViewIdx = accessor.find("bufferView");
+    if (!bufferViewIdx || !bufferViews || bufferViewIdx->number >= bufferViews->array.size()) {
+        glbError(filepath, "accessor " + std::to_string(accessorIdx) + " has no buffer view");
+    }
+
+    const JsonValue& bufferView = bufferViews->array[static_cast<size_t>(bufferViewIdx->number)];
+    if (bufferView.getNumber("buffer", 0) != 0) {
+        glbError(filepath, "only the embedded BIN buffer is supported");
+    }
+
+    size_t viewOffset = static_cast<size_t>(bufferView.getNumber("byteOffset", 0));
+    size_t viewLength = static_cast<size_t>(bufferView.getNumber("byteLength", 0));
+    size_t accessorOffset = static_cast<size_t>(accessor.getNumber("byteOffset", 0));
+    view.stride = static_cast<size_t>(bufferView.getNumber("byteStride", 0));
+    if (view.stride == 0) {
+        view.stride = elementSize;
+    }
+
+    if (viewOffset + viewLength > binSize || (view.count > 0 && accessorOffset + view.stride * (view.count - 1) + elementSize > viewLength)) {
+        glbError(filepath, "accessor " + std::to_string(accessorIdx) + " reads past its buffer view");
+    }
+
+    view.data = bin + viewOffset + accessorOffset;
+    return view;
+}
+
+/// Whether readFloats decodes the accessor's components: floats, or 8 and 16 bit integers as KHR_mesh_quantization allows
+bool isFloatReadable(const GlbAccessor& view) {
+    return view.componentType == GLTF_FLOAT || view.componentType == GLTF_BYTE || view.componentType == GLTF_UNSIGNED_BYTE
+        || view.componentType == GLTF_SHORT || view.componentType == GLTF_UNSIGNED_SHORT;
+}
+
+/// Reads one element of a float or integer accessor straight out of the mapping. Normalized integers map to [0, 1], or
+/// [-1, 1] if signed, and the rest keep their integer values.
+void readFloats(const GlbAccessor& view, size_t i, float* out) {
+    const uint8_t* element = view.data + i * view.stride;
+    for (int c = 0; c < view.components; c++) {
+        switch (view.componentType) {
+            case GLTF_FLOAT:
+                std::memcpy(&out[c], element + c * sizeof(float), sizeof(float));
+                break;
+            case GLTF_SHORT: {
+                int16_t v;
+                std::memcpy(&v, element + c * sizeof(int16_t), sizeof(int16_t));
+                out[c] = view.normalized ? std::max(v / 32767.0f, -1.0f) : static_cast<float>(v);
+                break;
+            }
+            case GLTF_UNSIGNED_SHORT: {
+                uint16_t v;
+                std::memcpy(&v, element + c * sizeof(uint16_t), sizeof(uint16_t));
+                out[c] = view.normalized ? v / 65535.0f : static_cast<float>(v);
+                break;
+            }
+            case GLTF_BYTE: {
+                int8_t v = static_cast<int8_t>(element[c]);
+                out[c] = view.normalized ? std::max(v / 127.0f, -1.0f) : static_cast<float>(v);
+                break;
+            }
+            case GLTF_UNSIGNED_BYTE:
+                out[c] = view.normalized ? element[c] / 255.0f : static_cast<float>(element[c]);
+                break;
+        }
+    }
+}
+
+uint32_t readIndex(const GlbAccessor& view, size_t i) {
+    const uint8_t* element = view.data + i * view.stride;
+    switch (view.componentType) {
+        case GLTF_UNSIGNED_BYTE:
+            return element[0];
+        case GLTF_UNSIGNED_SHORT: {
+            uint16_t v;
+            std::memcpy(&v, element, sizeof(v));
+            return v;
+        }
+        default:
+            return readU32(element);
+    }
+}
+
+/// A node's local transform: its "matrix", or translation * rotation * scale with rotation as a unit quaternion (x, y, z, w)
+simd::float4x4 nodeTransform(const JsonValue& node) {
+    if (const JsonValue* matrix = node.find("matrix"); matrix && matrix->array.size() == 16) {
+        simd::float4x4 result;
+        for (int i = 0; i < 16; i++) {
+            result.columns[i / 4][i % 4] = static_cast<float>(matrix->array[i].number);
+        }
+        return result;
+    }
+
+    auto read = [&](const char* key, simd::float4 fallback) {
+        if (const JsonValue* value = node.find(key)) {
+            for (size_t i = 0; i < std::min<size_t>(value->array.size(), 4); i++) {
+                fallback[i] = static_cast<float>(value->array[i].number);
+            }
+        }
+        return fallback;
+    };
+    simd::float4 t = read("translation", simd::float4{0, 0, 0, 1});
+    simd::float4 q = read("rotation", simd::float4{0, 0, 0, 1});
+    simd::float4 s = read("scale", simd::float4{1, 1, 1, 0});
+
+    return simd::float4x4{
+        simd::float4{1 - 2 * (q.y * q.y + q.z * q.z), 2 * (q.x * q.y + q.z * q.w), 2 * (q.x * q.z - q.y * q.w), 0} * s.x,
+        simd::float4{2 * (q.x * q.y - q.z * q.w), 1 - 2 * (q.x * q.x + q.z * q.z), 2 * (q.y * q.z + q.x * q.w), 0} * s.y,
+        simd::float4{2 * (q.x * q.z + q.y * q.w), 2 * (q.y * q.z - q.x * q.w), 1 - 2 * (q.x * q.x + q.y * q.y), 0} * s.z,
+        simd::float4{t.x, t.y, t.z, 1}
+    };
+}
+
+struct GlbPrimitive {
+    const JsonValue* primitive;
+    uint32_t materialSlot;
+    simd::float4x4 transform;  // Of the node that places it, baked into its vertices
+};
+
+}
+
+void Model::loadGlb(const std::string& filepath) {
+    auto start = std::chrono::steady_clock::now();
+
+    MappedFile file(filepath);
+    const uint8_t* bytes = file.data();
+
+    if (file.size() < 20 || readU32(bytes) != GLB_MAGIC || readU32(bytes + 4) != 2) {
+        glbError(filepath, "not a glTF 2.0 binary");
+    }
+
+    // Chunks follow the 12 byte header. JSON must come first and BIN, if present, second.
+    size_t jsonLength = readU32(bytes + 12);
+    if (readU32(bytes + 16) != GLB_CHUNK_JSON || 20 + jsonLength > file.size()) {
+        glbError(filepath, "missing JSON chunk");
+    }
+    std::string_view jsonText(reinterpret_cast<const char*>(bytes + 20), jsonLength);
+
+    const uint8_t* bin = nullptr;
+    size_t binSize = 0;
+    size_t binHeader = 20 + ((jsonLength + 3) & ~size_t(3));
+    if (binHeader + 8 <= file.size() && readU32(bytes + binHeader + 4) == GLB_CHUNK_BIN) {
+        binSize = std::min<size_t>(readU32(bytes + binHeader), file.size() - binHeader - 8);
+        bin = bytes + binHeader + 8;
+    }
+
+    JsonValue gltf;
+    std::string jsonError;
+    if (!parseJson(jsonText, gltf, jsonError)) {
+        glbError(filepath, "bad JSON chunk: " + jsonError);
+    }
+
+    const JsonValue* gltfMaterials = gltf.find("materials");
+    materialSlotCount = std::max<size_t>(gltfMaterials ? gltfMaterials->array.size() : 0, 1);
+
+    // Collect triangle primitives of every mesh, grouped by material like the OBJ path so each material slot is one
+    //  contiguous index range
+    std::vector<GlbPrimitive> primitives;
+    const JsonValue* meshes = gltf.find("meshes");
+    auto addMesh = [&](size_t meshIdx, const simd::float4x4& transform) {
+        if (!meshes || meshIdx >= meshes->array.size()) {
+            glbError(filepath, "mesh " + std::to_string(meshIdx) + " out of range");
+        }
+
+        const JsonValue* meshPrimitives = meshes->array[meshIdx].find("primitives");
+        if (!meshPrimitives) {
+            return;
+        }
+
+        for (const JsonValue& primitive : meshPrimitives->array) {
+            if (primitive.getNumber("mode", GLTF_MODE_TRIANGLES) != GLTF_MODE_TRIANGLES) {
+                std::cerr << "GLB loader: " << filepath << ": skipping non-triangle primitive\n";
+                continue;
+            }
+
+            int materialID = static_cast<int>(primitive.getNumber("material", -1));
+            uint32_t slot = (materialID >= 0 && materialID < materialSlotCount) ? materialID : 0;
+            primitives.push_back(GlbPrimitive{&primitive, slot, transform});
+        }
+    };
+
+    // Meshes are placed by the node hierarchy of the default scene, or of every root node if there is no scene, so a
+    //  mesh used by several nodes is baked in once per node. A file without nodes gets each mesh untransformed.
+    const JsonValue* nodes = gltf.find("nodes");
+    if (nodes && !nodes->array.empty()) {
+        std::vector<size_t> roots;
+        const JsonValue* scenes = gltf.find("scenes");
+        if (scenes && !scenes->array.empty()) {
+            size_t sceneIdx = static_cast<size_t>(gltf.getNumber("scene", 0));
+            if (sceneIdx >= scenes->array.size()) {
+                glbError(filepath, "scene " + std::to_string(sceneIdx) + " out of range");
+            }
+            if (const JsonValue* sceneNodes = scenes->array[sceneIdx].find("nodes")) {
+                for (const JsonValue& node : sceneNodes->array) {
+                    roots.push_back(static_cast<size_t>(node.number));
+                }
+            }
+        } else {
+            std::vector<bool> isChild(nodes->array.size(), false);
+            for (const JsonValue& node : nodes->array) {
+                if (const JsonValue* children = node.find("children")) {
+                    for (const JsonValue& child : children->array) {
+                        isChild[std::min(static_cast<size_t>(child.number), isChild.size() - 1)] = true;
+                    }
+                }
+            }
+            for (size_t i = 0; i < nodes->array.size(); i++) {
+                if (!isChild[i]) {
+                    roots.push_back(i);
+                }
+            }
+        }
+
+        // Each node has at most one parent, so a walk visiting more nodes than there are has followed a cycle. Nodes are
+        //  pushed in reverse to come off the stack in file order.
+        std::vector<std::pair<size_t, simd::float4x4>> stack;
+        for (auto root = roots.rbegin(); root != roots.rend(); root++) {
+            stack.emplace_back(*root, matrix_identity_float4x4);
+        }
+        size_t visited = 0;
+        while (!stack.empty()) {
+            auto [nodeIdx, parent] = stack.back();
+            stack.pop_back();
+            if (nodeIdx >= nodes->array.size() || ++visited > nodes->array.size()) {
+                glbError(filepath, "node " + std::to_string(nodeIdx) + " is out of range or part of a cycle");
+            }
+
+            const JsonValue& node = nodes->array[nodeIdx];
+            simd::float4x4 transform = parent * nodeTransform(node);
+            if (const JsonValue* mesh = node.find("mesh")) {
+                addMesh(static_cast<size_t>(mesh->number), transform);
+            }
+            if (const JsonValue* children = node.find("children")) {
+                for (auto child = children->array.rbegin(); child != children->array.rend(); child++) {
+                    stack.emplace_back(static_cast<size_t>(child->number), transform);
+                }
+            }
+        }
+    } else if (meshes) {
+        for (size_t i = 0; i < meshes->array.size(); i++) {
+            addMesh(i, matrix_identity_float4x4);
+        }
+    }
+
+    std::stable_sort(primitives.begin(), primitives.end(), [](const GlbPrimitive& a, const GlbPrimitive& b) {
+        return a.materialSlot < b.materialSlot;
+    });
+
+    finalVertices = std::vector<ModelVertexData>{};
+    finalIndices = std::vector<uint32_t>{};
+    submeshes = std::vector<SubmeshData>{};
+    std::vector<std::pair<size_t, size_t>> tangentRanges;  // Index ranges of primitives that came without tangents
+
+    for (const GlbPrimitive& entry : primitives) {
+        const JsonValue* attributes = entry.primitive->find("attributes");
+        const JsonValue* positionIdx = attributes ? attributes->find("POSITION") : nullptr;
+        if (!positionIdx) {
+            glbError(filepath, "primitive without POSITION");
+        }
+
+        auto checkAttribute = [&](const char* name, const GlbAccessor& view, int components) {
+            if (view.data && (!isFloatReadable(view) || view.components != components)) {
+                glbError(filepath, std::string(name) + " must be VEC" + std::to_string(components) + " of floats or 8 or 16 bit integers");
+            }
+        };
+        auto optionalAccessor = [&](const char* name, int components) {
+            const JsonValue* idx = attributes->find(name);
+            GlbAccessor view = idx ? resolveAccessor(filepath, gltf, static_cast<size_t>(idx->number), bin, binSize) : GlbAccessor{};
+            checkAttribute(name, view, components);
+            return view;
+        };
+        GlbAccessor positions = optionalAccessor("POSITION", 3);
+        GlbAccessor normals = optionalAccessor("NORMAL", 3);
+        GlbAccessor texcoords = optionalAccessor("TEXCOORD_0", 2);
+        GlbAccessor tangents = optionalAccessor("TANGENT", 4);
+
+        const uint32_t vertexBase = static_cast<uint32_t>(finalVertices.size());
+        const size_t indexBase = finalIndices.size();
+
+        // Normals go through the cofactor matrix, the inverse transpose scaled by the determinant, with the determinant's
+        //  sign taken back out. A mirroring node also reverses the winding and the tangent handedness.
+        const simd::float4x4& m = entry.transform;
+        const simd::float3 axes[3] = {
+            simd::float3{m.columns[0].x, m.columns[0].y, m.columns[0].z},
+            simd::float3{m.columns[1].x, m.columns[1].y, m.columns[1].z},
+            simd::float3{m.columns[2].x, m.columns[2].y, m.columns[2].z}
+        };
+        const float handedness = simd::dot(axes[0], simd::cross(axes[1], axes[2])) < 0 ? -1.0f : 1.0f;
+        const simd::float3 normalAxes[3] = {
+            simd::cross(axes[1], axes[2]) * handedness, simd::cross(axes[2], axes[0]) * handedness, simd::cross(axes[0], axes[1]) * handedness
+        };
+        auto unit = [](simd::float3 v) {
+            float length = simd::length(v);
+            return length > EPS ? v / length : v;
+        };
+
+        // Vertices are read in place from the mapped buffer views into their final array, with no intermediate copy
+        finalVertices.resize(vertexBase + positions.count);
+        for (size_t i = 0; i < positions.count; i++) {
+            ModelVertexData& vertex = finalVertices[vertexBase + i];
+            float p[4] = {0, 0, 0, 1};
+
+            readFloats(positions, i, p);
+            vertex.pos = axes[0] * p[0] + axes[1] * p[1] + axes[2] * p[2] + simd::float3{m.columns[3].x, m.columns[3].y, m.columns[3].z};
+
+            vertex.normal = simd::float3(0);
+            if (normals.data && i < normals.count) {
+                readFloats(normals, i, p);
+                vertex.normal = unit(normalAxes[0] * p[0] + normalAxes[1] * p[1] + normalAxes[2] * p[2]);
+            }
+
+            // glTF puts the UV origin at the top left, textures here are flipped on load to the OBJ bottom-left origin
+            vertex.uv = simd::float2(0);
+            if (texcoords.data && i < texcoords.count) {
+                readFloats(texcoords, i, p);
+                vertex.uv = simd::float2{p[0], 1.0f - p[1]};
+            }
+
+            vertex.tangent = simd::float3(0);
+            vertex.sign = 1;
+            if (tangents.data && i < tangents.count) {
+                readFloats(tangents, i, p);
+                vertex.tangent = unit(axes[0] * p[0] + axes[1] * p[1] + axes[2] * p[2]);
+                vertex.sign = (p[3] < 0 ? -1.0f : 1.0f) * handedness;
+            }
+        }
+
+        if (const JsonValue* indicesIdx = entry.primitive->find("indices")) {
+            GlbAccessor indexView = resolveAccessor(filepath, gltf, static_cast<size_t>(indicesIdx->number), bin, binSize);
+            if (indexView.components != 1 || (indexView.componentType != GLTF_UNSIGNED_BYTE && indexView.componentType != GLTF_UNSIGNED_SHORT
+                                              && indexView.componentType != GLTF_UNSIGNED_INT)) {
+                glbError(filepath, "indices must be SCALAR unsigned integers");
+            }
+
+            finalIndices.resize(indexBase + indexView.count / 3 * 3);
+            if (vertexBase == 0 && indexView.componentType == GLTF_UNSIGNED_INT && indexView.stride == sizeof(uint32_t)) {
+                // Same layout as ours, so the whole range is one copy
+                std::memcpy(finalIndices.data() + indexBase, indexView.data, (finalIndices.size() - indexBase) * sizeof(uint32_t));
+            } else {
+                for (size_t i = indexBase; i < finalIndices.size(); i++) {
+                    finalIndices[i] = vertexBase + readIndex(indexView, i - indexBase);
+                }
+            }
+        } else {
+            finalIndices.resize(indexBase + positions.count / 3 * 3);
+            for (size_t i = indexBase; i < finalIndices.size(); i++) {
+                finalIndices[i] = vertexBase + static_cast<uint32_t>(i - indexBase);
+            }
+        }
+
+        for (size_t i = indexBase; i < finalIndices.size(); i++) {
+            if (finalIndices[i] >= finalVertices.size()) {
+                glbError(filepath, "index out of range");
+            }
+        }
+        if (handedness < 0) {
+            for (size_t i = indexBase; i + 2 < finalIndices.size(); i += 3) {
+                std::swap(finalIndices[i + 1], finalIndices[i + 2]);
+            }
+        }
+
+        if (!normals.data) {
+            computeFlatAveragedNormals(vertexBase, indexBase);
+        }
+        if (!tangents.data) {
+            if (!tangentRanges.empty() && tangentRanges.back().second == indexBase) {
+                tangentRanges.back().second = finalIndices.size();
+            } else {
+                tangentRanges.emplace_back(indexBase, finalIndices.size());
+            }
+        }
+
+        size_t indexCount = finalIndices.size() - indexBase;
+        if (!submeshes.empty() && submeshes.back().materialSlot == entry.materialSlot) {
+            submeshes.back().indexCount += static_cast<uint32_t>(indexCount);
+        } else if (indexCount > 0) {
+            submeshes.push_back(SubmeshData{
+                .indexOffset = static_cast<uint32_t>(indexBase),
+                .indexCount = static_cast<uint32_t>(indexCount),
+                .materialSlot = entry.materialSlot
+            });
+        }
+    }
+
+    triangleCount = finalIndices.size() / 3;
+    vertexCount = finalVertices.size();
+
+    // Tangents from the file are used as-is. MikkTSpace only runs over the primitives that came without them.
+    for (const auto& [begin, end] : tangentRanges) {
+        computeTBNs(begin, end);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "GLB load (" << elapsed.count() * 1000 << " ms): " << vertexCount << " vertices, " << triangleCount
+              << " triangles, " << primitives.size() << " primitives" << (tangentRanges.empty() ? ", tangents from file" : ", tangents generated") << "\n";
+}
@@ -0,0 +1,423 @@
+#include "model.hpp"
+
+#include "mapped_file.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+
+namespace {
+
+// Elements are converted in windows of this many file bytes, and each window's pages are dropped once it is done. This
+//  bounds the mapping's resident pages only: the converted vertices and indices are still held in full.
+constexpr size_t PLY_STREAM_WINDOW = 256ull << 20;
+constexpr size_t PLY_MIN_CHUNK = 1 << 16;
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64, Invalid };
+
+struct PlyProperty {
+    std::string name;
+    PlyType type = PlyType::Invalid;
+    bool isList = false;
+    PlyType countType = PlyType::Invalid;
+    size_t offset = 0;  // Within the record, only meaningful for fixed-size records
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+    size_t recordSize = 0;  // 0 if the element has list properties
+};
+
+[[noreturn]] void plyError(const std::string& filepath, const std::string& message) {
+    std::cerr << "PLY loader: " << filepath << ": " << message << "\n";
+    exit(1);
+}
+
+PlyType parseType(const std::string& name) {
+    if (name == "char" || name == "int8") return PlyType::Int8;
+    if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+    if (name == "short" || name == "int16") return PlyType::Int16;
+    if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+    if (name == "int" || name == "int32") return PlyType::Int32;
+    if (name == "uint" || name == "uint32") return PlyType::UInt32;
+    if (name == "float" || name == "float32") return PlyType::Float32;
+    if (name == "double" || name == "float64") return PlyType::Float64;
+    return PlyType::Invalid;
+}
+
+size_t typeSize(PlyType type) {
+    switch (type) {
+        case PlyType::Int8: case PlyType::UInt8: return 1;
+        case PlyType::Int16: case PlyType::UInt16: return 2;
+        case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+        case PlyType::Float64: return 8;
+        default: return 0;
+    }
+}
+
+template <typename T>
+T load(const uint8_t* p) {
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return v;
+}
+
+double readScalar(const uint8_t* p, PlyType type) {
+    switch (type) {
+        case PlyType::Int8: return static_cast<int8_t>(p[0]);
+        case PlyType::UInt8: return p[0];
+        case PlyType::Int16: return load<int16_t>(p);
+        case PlyType::UInt16: return load<uint16_t>(p);
+        case PlyType::Int32: return load<int32_t>(p);
+        case PlyType::UInt32: return load<uint32_t>(p);
+        case PlyType::Float32: return load<float>(p);
+        case PlyType::Float64: return load<double>(p);
+        default: return 0;
+    }
+}
+
+uint32_t readIndex(const uint8_t* p, PlyType type) {
+    switch (type) {
+        case PlyType::Int8: case PlyType::UInt8: return p[0];
+        case PlyType::Int16: case PlyType::UInt16: return load<uint16_t>(p);
+        default: return load<uint32_t>(p);
+    }
+}
+
+const PlyProperty* findProperty(const PlyElement& element, std::initializer_list<const char*> names) {
+    for (const char* name : names) {
+        for (const PlyProperty& property : element.properties) {
+            if (property.name == name) {
+                return &property;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/// Byte size of one variable-size record, reading its list counts
+size_t recordSize(const PlyElement& element, const uint8_t* record) {
+    size_t size = 0;
+    for (const PlyProperty& property : element.properties) {
+        if (property.isList) {
+            size_t count = static_cast<size_t>(readScalar(record + size, property.countType));
+            size += typeSize(property.countType) + count * typeSize(property.type);
+        } else {
+            size += typeSize(property.type);
+        }
+    }
+    return size;
+}
+
+/// Any unit vector perpendicular to n, for meshes without UVs where MikkTSpace has nothing to work from
+simd::float3 perpendicular(simd::float3 n) {
+    simd::float3 axis = std::abs(n.x) < 0.9f ? simd::float3{1, 0, 0} : simd::float3{0, 1, 0};
+    simd::float3 t = simd::cross(n, axis);
+    float length = simd::length(t);
+    return length > EPS ? t / length : simd::float3{1, 0, 0};
+}
+
+/// Converts the face element starting at offset into triangle indices and returns the offset just past it
+size_t loadFaces(const std::string& filepath, const MappedFile& file, const PlyElement& element, size_t offset, uint32_t vertexLimit, std::vector<uint32_t>& finalIndices) {
+    const uint8_t* bytes = file.data();
+    
+    const PlyProperty* list = findProperty(element, {"vertex_indices", "vertex_index"});
+    if (!list || !list->isList) {
+        plyError(filepath, "faces have no vertex index list");
+    }
+    
+    // Offsets of the scalar properties before the list. Anything after the list is assumed to be fixed size too.
+    size_t before = 0;
+    size_t after = 0;
+    bool seenList = false;
+    for (const PlyProperty& property : element.properties) {
+        if (&property == list) {
+            seenList = true;
+        } else if (property.isList) {
+            plyError(filepath, "faces with more than one list property are not supported");
+        } else {
+            (seenList ? after : before) += typeSize(property.type);
+        }
+    }
+    
+    const size_t countSize = typeSize(list->countType);
+    const size_t indexSize = typeSize(list->type);
+    const size_t triangleRecord = before + countSize + 3 * indexSize + after;
+    
+    // Fast path: if every face is a triangle the records have a fixed stride and can be converted in parallel chunks
+    bool allTriangles = offset + element.count * triangleRecord <= file.size();
+    if (allTriangles) {
+        finalIndices.resize(element.count * 3);
+        std::atomic<bool> notTriangle = false;
+        std::atomic<bool> outOfRange = false;
+        
+        const size_t windowFaces = std::max<size_t>(PLY_STREAM_WINDOW / triangleRecord, 1);
+        for (size_t windowStart = 0; windowStart < element.count && !notTriangle; windowStart += windowFaces) {
+            size_t windowCount = std::min(windowFaces, element.count - windowStart);
+            const uint8_t* windowData = bytes + offset + windowStart * triangleRecord;
+            
+            parallelFor(windowCount, PLY_MIN_CHUNK, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    const uint8_t* record = windowData + i * triangleRecord + before;
+                    if (readScalar(record, list->countType) != 3) {
+                        notTriangle = true;
+                        return;
+                    }
+                    
+                    for (size_t corner = 0; corner < 3; corner++) {
+                        uint32_t idx = readIndex(record + countSize + corner * indexSize, list->type);
+                        outOfRange = outOfRange || idx >= vertexLimit;
+                        finalIndices[(windowStart + i) * 3 + corner] = idx;
+                    }
+                }
+            });
+            
+            file.release(windowData - bytes, windowCount * triangleRecord);
+        }
+        
+        if (outOfRange && !notTriangle) {
+            plyError(filepath, "face index out of range");
+        }
+        if (!notTriangle) {
+            return offset + element.count * triangleRecord;
+        }
+        
+        finalIndices.clear();
+    }
+    
+    // Mixed polygons: walk the records in order and fan-triangulate
+    finalIndices.reserve(element.count * 3);
+    size_t windowStart = offset;
+    for (size_t face = 0; face < element.count; face++) {
+        if (offset + before + countSize > file.size()) {
+            plyError(filepath, "face data is truncated");
+        }
+        
+        const uint8_t* record = bytes + offset + before;
+        size_t count = static_cast<size_t>(readScalar(record, list->countType));
+        size_t size = before + countSize + count * indexSize + after;
+        if (offset + size > file.size()) {
+            plyError(filepath, "face data is truncated");
+        }
+        
+        uint32_t first = readIndex(record + countSize, list->type);
+        for (size_t corner = 2; corner < count; corner++) {
+            uint32_t b = readIndex(record + countSize + (corner - 1) * indexSize, list->type);
+            uint32_t c = readIndex(record + countSize + corner * indexSize, list->type);
+            if (first >= vertexLimit || b >= vertexLimit || c >= vertexLimit) {
+                plyError(filepath, "face index out of range");
+            }
+            
+            finalIndices.push_back(first);
+            finalIndices.push_back(b);
+            finalIndices.push_back(c);
+        }
+        
+        offset += size;
+        if (offset - windowStart >= PLY_STREAM_WINDOW) {
+            file.release(windowStart, offset - windowStart);
+            windowStart = offset;
+        }
+    }
+    
+    return offset;
+}
+
+}
+
+void Model::loadPly(const std::string& filepath) {
+    auto start = std::chrono::steady_clock::now();
+    
+    MappedFile file(filepath);
+    file.adviseSequential();
+    const uint8_t* bytes = file.data();
+    
+    // The header is ASCII and ends with an "end_header" line
+    const char* headerEndTag = "end_header";
+    const uint8_t* headerEnd = static_cast<const uint8_t*>(memmem(bytes, std::min<size_t>(file.size(), 1 << 20), headerEndTag, strlen(headerEndTag)));
+    if (file.size() < 4 || std::memcmp(bytes, "ply", 3) != 0 || !headerEnd) {
+        plyError(filepath, "not a PLY file");
+    }
+    
+    size_t dataOffset = static_cast<size_t>(headerEnd - bytes) + strlen(headerEndTag);
+    while (dataOffset < file.size() && bytes[dataOffset] != '\n') {
+        dataOffset++;
+    }
+    dataOffset++;
+    
+    std::vector<PlyElement> elements;
+    std::istringstream header(std::string(reinterpret_cast<const char*>(bytes), headerEnd - bytes));
+    std::string line;
+    while (std::getline(header, line)) {
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        
+        if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            if (format != "binary_little_endian") {
+                plyError(filepath, "only binary_little_endian PLY is supported, got " + format);
+            }
+        } else if (keyword == "element") {
+            PlyElement element;
+            tokens >> element.name >> element.count;
+            elements.push_back(element);
+        } else if (keyword == "property" && !elements.empty()) {
+            PlyProperty property;
+            std::string type;
+            tokens >> type;
+            
+            if (type == "list") {
+                std::string countType, itemType;
+                tokens >> countType >> itemType;
+                property.isList = true;
+                property.countType = parseType(countType);
+                property.type = parseType(itemType);
+            } else {
+                property.type = parseType(type);
+            }
+            tokens >> property.name;
+            
+            if (property.type == PlyType::Invalid || (property.isList && property.countType == PlyType::Invalid)) {
+                plyError(filepath, "bad property line: " + line);
+            }
+            elements.back().properties.push_back(property);
+        }
+    }
+    
+    for (PlyElement& element : elements) {
+        bool fixed = true;
+        for (PlyProperty& property : element.properties) {
+            property.offset = element.recordSize;
+            element.recordSize += typeSize(property.type);
+            fixed &= !property.isList;
+        }
+        if (!fixed) {
+            element.recordSize = 0;
+        }
+    }
+    
+    finalVertices = std::vector<ModelVertexData>{};
+    finalIndices = std::vector<uint32_t>{};
+    bool hasNormals = false;
+    bool hasTexcoords = false;
+    
+    size_t offset = dataOffset;
+    for (const PlyElement& element : elements) {
+        if (element.name == "vertex") {
+            if (element.recordSize == 0) {
+                plyError(filepath, "list properties on vertices are not supported");
+            }
+            if (offset + element.count * element.recordSize > file.size()) {
+                plyError(filepath, "vertex data is truncated");
+            }
+            
+            const PlyProperty* x = findProperty(element, {"x"});
+            const PlyProperty* y = findProperty(element, {"y"});
+            const PlyProperty* z = findProperty(element, {"z"});
+            const PlyProperty* nx = findProperty(element, {"nx"});
+            const PlyProperty* ny = findProperty(element, {"ny"});
+            const PlyProperty* nz = findProperty(element, {"nz"});
+            const PlyProperty* u = findProperty(element, {"u", "s", "texture_u", "texture_s"});
+            const PlyProperty* v = findProperty(element, {"v", "t", "texture_v", "texture_t"});
+            if (!x || !y || !z) {
+                plyError(filepath, "vertices have no position");
+            }
+            hasNormals = nx && ny && nz;
+            hasTexcoords = u && v;
+            
+            finalVertices.resize(element.count);
+            
+            // Records are fixed size, so every window splits into independent chunks converted straight into
+            //  finalVertices
+            const size_t windowVertices = std::max<size_t>(PLY_STREAM_WINDOW / element.recordSize, 1);
+            for (size_t windowStart = 0; windowStart < element.count; windowStart += windowVertices) {
+                size_t windowCount = std::min(windowVertices, element.count - windowStart);
+                const uint8_t* windowData = bytes + offset + windowStart * element.recordSize;
+                
+                parallelFor(windowCount, PLY_MIN_CHUNK, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++) {
+                        const uint8_t* record = windowData + i * element.recordSize;
+                        ModelVertexData& vertex = finalVertices[windowStart + i];
+                        
+                        vertex.pos = simd::float3{
+                            static_cast<float>(readScalar(record + x->offset, x->type)),
+                            static_cast<float>(readScalar(record + y->offset, y->type)),
+                            static_cast<float>(readScalar(record + z->offset, z->type))
+                        };
+                        vertex.normal = hasNormals ? simd::float3{
+                            static_cast<float>(readScalar(record + nx->offset, nx->type)),
+                            static_cast<float>(readScalar(record + ny->offset, ny->type)),
+                            static_cast<float>(readScalar(record + nz->offset, nz->type))
+                        } : simd::float3(0);
+                        vertex.uv = hasTexcoords ? simd::float2{
+                            static_cast<float>(readScalar(record + u->offset, u->type)),
+                            static_cast<float>(readScalar(record + v->offset, v->type))
+                        } : simd::float2(0);
+                        vertex.tangent = simd::float3(0);
+                        vertex.sign = 1;
+                    }
+                });
+                
+                file.release(windowData - bytes, windowCount * element.recordSize);
+            }
+            
+            offset += element.count * element.recordSize;
+        } else if (element.name == "face") {
+            offset = loadFaces(filepath, file, element, offset, static_cast<uint32_t>(finalVertices.size()), finalIndices);
+        } else if (element.recordSize > 0) {
+            offset += element.count * element.recordSize;
+        } else {
+            for (size_t i = 0; i < element.count && offset < file.size(); i++) {
+                offset += recordSize(element, bytes + offset);
+            }
+        }
+        
+        if (offset > file.size()) {
+            plyError(filepath, "element " + element.name + " is truncated");
+        }
+    }
+    
+    materialSlotCount = 1;
+    submeshes = std::vector<SubmeshData>{};
+    if (!finalIndices.empty()) {
+        submeshes.push_back(SubmeshData{
+            .indexOffset = 0,
+            .indexCount = static_cast<uint32_t>(finalIndices.size()),
+            .materialSlot = 0
+        });
+    }
+    
+    triangleCount = finalIndices.size() / 3;
+    vertexCount = finalVertices.size();
+    
+    if (!hasNormals) {
+        computeFlatAveragedNormals(0, 0);
+    }
+    
+    // Scans rarely carry UVs, and without them there is no tangent space to generate, only a frame around the normal
+    if (hasTexcoords) {
+        computeTBNs();
+    } else {
+        parallelFor(finalVertices.size(), PLY_MIN_CHUNK, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                finalVertices[i].tangent = perpendicular(finalVertices[i].normal);
+            }
+        });
+    }
+    
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "PLY load (" << elapsed.count() * 1000 << " ms): " << vertexCount << " vertices, " << triangleCount
+              << " triangles, " << file.size() / (1024.0 * 1024.0) << " MB\n";
+}
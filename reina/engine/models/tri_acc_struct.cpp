@@ -1,25 +1,58 @@
 #include "tri_acc_struct.hpp"
 
 #include <iostream>
+#include <vector>
 
-TriangleAccelerationStructure::TriangleAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const Model& model) {
+#include "matmath.hpp"
+
+TriangleAccelerationStructure::TriangleAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const Model& model, size_t lod) {
+    
+    // One geometry per submesh (per cluster for clustered models), all sharing the model's vertex and index buffers. The
+    //  geometry index then matches the submesh index, which the shader uses to find the index range and material slot.
+    std::vector<NS::Object*> geomObjects;
     
-    MTL::AccelerationStructureTriangleGeometryDescriptor* geomDescriptor =
-        MTL::AccelerationStructureTriangleGeometryDescriptor::alloc()->init();
+#ifdef QUANTIZE_POSITIONS
+    // Positions are unorm16 within the model bounds, so have the build map them back into model space
+    simd::float4x4 dequantize = matrix_identity_float4x4;
+    dequantize.columns[0].x = model.getBoundsExtent().x;
+    dequantize.columns[1].y = model.getBoundsExtent().y;
+    dequantize.columns[2].z = model.getBoundsExtent().z;
+    dequantize.columns[3].xyz = model.getBoundsMin();
     
-    geomDescriptor->setVertexBuffer(model.getVertexBuffer());
-    geomDescriptor->setVertexStride(sizeof(ModelVertexData));
-    geomDescriptor->setVertexBufferOffset(offsetof(ModelVertexData, pos));
-    geomDescriptor->setIndexBuffer(model.getIndexBuffer());
-    geomDescriptor->setTriangleCount(model.getTriangleCount());
+    MTL::PackedFloat4x3 dequantizePacked = simdToMTL(dequantize);
+    MTL::Buffer* transformBuffer = device->newBuffer(&dequantizePacked, sizeof(MTL::PackedFloat4x3), MTL::ResourceStorageModeShared);
+#endif
+    
+    for (const SubmeshData& submesh : model.getSubmeshes(lod)) {
+        MTL::AccelerationStructureTriangleGeometryDescriptor* geomDescriptor =
+            MTL::AccelerationStructureTriangleGeometryDescriptor::alloc()->init();
+        
+        geomDescriptor->setVertexBuffer(model.getPositionBuffer());
+        geomDescriptor->setVertexStride(sizeof(VertexPosition));
+#ifdef QUANTIZE_POSITIONS
+        geomDescriptor->setVertexFormat(MTL::AttributeFormatUShort3Normalized);
+        geomDescriptor->setTransformationMatrixBuffer(transformBuffer);
+#else
+        geomDescriptor->setVertexFormat(MTL::AttributeFormatFloat3);
+#endif
+        geomDescriptor->setIndexBuffer(model.getIndexBuffer(lod));
+        geomDescriptor->setIndexType(model.getIndexType());
+        geomDescriptor->setIndexBufferOffset(submesh.indexOffset * model.getIndexStride());
+        geomDescriptor->setTriangleCount(submesh.indexCount / 3);
+        
+        geomObjects.push_back(geomDescriptor);
+    }
     
     MTL::PrimitiveAccelerationStructureDescriptor* accStructDescriptor = MTL::PrimitiveAccelerationStructureDescriptor::alloc()->init();
     
-    NS::Object* geomObjects[] = { geomDescriptor };
-    NS::Array* geomArray = NS::Array::array(geomObjects, 1);
+    NS::Array* geomArray = NS::Array::array(geomObjects.data(), geomObjects.size());
     
     accStructDescriptor->setGeometryDescriptors(geomArray);
     
     build(device, cmdQueue, accStructDescriptor);
     compact(device, cmdQueue);
+    
+#ifdef QUANTIZE_POSITIONS
+    transformBuffer->release();
+#endif
 }
@@ -10,7 +10,7 @@
 
 class TriangleAccelerationStructure : public AccelerationStructure {
 public:
-    TriangleAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const Model& model);
+    TriangleAccelerationStructure(MTL::Device* device, MTL::CommandQueue* cmdQueue, const Model& model, size_t lod = 0);
 };
 
 #endif /* tri_acc_struct_hpp */
@@ -1,165 +1,862 @@
 #include "scene.hpp"
 
 #include <set>
+#include <chrono>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+#include <cstring>
+#include <numeric>
 
 #include "buffers.hpp"
+#include "hash.hpp"
+#include "parallel.hpp"
+#include "memory_report.hpp"
 
-void Scene::addObject(const std::shared_ptr<Model>& model, const std::shared_ptr<Material>& material, simd::float4x4 transform) {
+uint32_t Scene::addObject(const std::shared_ptr<Model>& model, const std::shared_ptr<Material>& material, simd::float4x4 transform) {
+    return addObject(model, std::vector<std::shared_ptr<Material>>{material}, transform);
+}
+
+uint32_t Scene::addObject(const std::shared_ptr<Model>& model, const std::vector<std::shared_ptr<Material>>& slotMaterials, simd::float4x4 transform) {
+    if (slotMaterials.empty()) {
+        std::cerr << "Scene::addObject: an object needs at least one material\n";
+        exit(1);
+    }
+    if (model->getTriangleCount() == 0) {
+        std::cerr << "Scene::addObject: the model has no faces, so it has no acceleration structure to build\n";
+        exit(1);
+    }
+    
+    const uint32_t instanceId = static_cast<uint32_t>(instanceDataVec.size());
     instanceTransforms.push_back(transform);
     
     InstanceData instanceData;
     instanceData.transform = transform;
+    instanceData.materialOffset = static_cast<uint32_t>(instanceMaterialIndices.size());
+    
+    for (size_t slot = 0; slot < model->getMaterialSlotCount(); slot++) {
+        instanceMaterialIndices.push_back(findOrAddMaterial(slotMaterials[std::min(slot, slotMaterials.size() - 1)]));
+    }
+    
+    // Index, vertex and submesh offsets depend on every model in the scene and the selected LOD, so they are filled in by
+    //  build()
+    modelIndices.push_back(findOrAddModel(model));
+    instanceDataVec.push_back(instanceData);
+    instanceTableDirty = true;
+    
+    return instanceId;
+}
+
+uint32_t Scene::addModel(const std::shared_ptr<Model>& model) {
+    if (model->getTriangleCount() == 0) {
+        std::cerr << "Scene::addModel: the model has no faces, so it has no acceleration structure to build\n";
+        exit(1);
+    }
+    return findOrAddModel(model);
+}
+
+uint32_t Scene::addMaterial(const std::shared_ptr<Material>& material) {
+    return findOrAddMaterial(material);
+}
+
+uint32_t Scene::addInstances(std::span<const uint32_t> modelIds, std::span<const uint32_t> materialIds, std::span<const simd::float4x4> transforms) {
+    if (materialIds.size() != modelIds.size()) {
+        std::cerr << "Scene::addInstances: " << modelIds.size() << " model ids but " << materialIds.size() << " material ids\n";
+        exit(1);
+    }
+    
+    // Each instance's slots all read its one material
+    std::vector<uint32_t> materialOffsets(modelIds.size() + 1);
+    std::iota(materialOffsets.begin(), materialOffsets.end(), 0);
+    return addInstances(modelIds, materialOffsets, materialIds, transforms);
+}
+
+uint32_t Scene::addInstances(std::span<const uint32_t> modelIds, std::span<const uint32_t> materialOffsets, std::span<const uint32_t> materialIds, std::span<const simd::float4x4> transforms) {
+    const size_t count = modelIds.size();
+    if (transforms.size() != count || materialOffsets.size() != count + 1 || materialOffsets[0] != 0 || materialOffsets[count] != materialIds.size()) {
+        std::cerr << "Scene::addInstances: " << count << " model ids, " << transforms.size() << " transforms, " << materialOffsets.size()
+                  << " material offsets and " << materialIds.size() << " material ids don't match\n";
+        exit(1);
+    }
+    for (uint32_t materialId : materialIds) {
+        if (materialId >= materials.size()) {
+            std::cerr << "Scene::addInstances: material id " << materialId << " was not added to the scene\n";
+            exit(1);
+        }
+    }
     
-    bool foundMaterial = false;
-    for (uint32_t i = 0; i < materials.size(); i++) {
-        if (materials[i] == material) {
-            foundMaterial = true;
-            instanceData.materialIdx = i;
-            break;
+    const size_t firstInstance = instanceDataVec.size();
+    
+    // One prefix sum over the material slot counts gives every instance its range in the instance material table
+    std::vector<uint32_t> tableOffsets(count + 1);
+    tableOffsets[0] = static_cast<uint32_t>(instanceMaterialIndices.size());
+    for (size_t i = 0; i < count; i++) {
+        if (modelIds[i] >= models.size()) {
+            std::cerr << "Scene::addInstances: model id " << modelIds[i] << " of instance " << i << " was not added to the scene\n";
+            exit(1);
+        }
+        if (materialOffsets[i + 1] <= materialOffsets[i]) {
+            std::cerr << "Scene::addInstances: instance " << i << " has no materials\n";
+            exit(1);
         }
+        tableOffsets[i + 1] = tableOffsets[i] + static_cast<uint32_t>(models[modelIds[i]]->getMaterialSlotCount());
     }
     
-    if (!foundMaterial) {
-        instanceData.materialIdx = static_cast<uint32_t>(materials.size());
-        materials.push_back(material);
+    instanceTransforms.resize(firstInstance + count);
+    instanceDataVec.resize(firstInstance + count);
+    modelIndices.resize(firstInstance + count);
+    instanceMaterialIndices.resize(tableOffsets[count]);
+    
+    parallelFor(count, 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            instanceTransforms[firstInstance + i] = transforms[i];
+            modelIndices[firstInstance + i] = modelIds[i];
+            
+            InstanceData& instanceData = instanceDataVec[firstInstance + i];
+            instanceData.transform = transforms[i];
+            instanceData.materialOffset = tableOffsets[i];
+            
+            const uint32_t given = materialOffsets[i + 1] - materialOffsets[i];
+            for (uint32_t slot = 0; slot < tableOffsets[i + 1] - tableOffsets[i]; slot++) {
+                instanceMaterialIndices[tableOffsets[i] + slot] = materialIds[materialOffsets[i] + std::min(slot, given - 1)];
+            }
+        }
+    });
+    
+    instanceTableDirty = true;
+    return static_cast<uint32_t>(firstInstance);
+}
+
+uint32_t Scene::findOrAddModel(const std::shared_ptr<Model>& model) {
+    // A duplicate isn't kept by the scene, so once it is gone its address can belong to another model. The weak pointer
+    //  tells whether the remembered object is still the one at that address.
+    auto known = modelIndexByPtr.find(model.get());
+    if (known != modelIndexByPtr.end() && known->second.first.lock() == model) {
+        return known->second.second;
     }
     
-    bool foundModel = false;
-    uint32_t totalIndices = 0;
-    for (uint32_t i = 0; i < models.size(); i++) {
-        if (models[i] == model) {
-            foundModel = true;
-            modelIndices.push_back(i);
-            break;
+    // A different Model object can still hold the same geometry, e.g. the same file loaded twice. The full comparison only
+    //  runs once per such object since the pointer is remembered afterwards.
+    std::vector<uint32_t>& candidates = modelIndicesByHash[model->getContentHash()];
+    for (uint32_t candidate : candidates) {
+        if (models[candidate]->hasSameGeometry(*model)) {
+            duplicateModelCount++;
+            modelIndexByPtr[model.get()] = {model, candidate};
+            return candidate;
         }
-        
-        totalIndices += models[i]->getTriangleCount() * 3;
     }
     
-    instanceData.indexOffset = totalIndices;
-    if (!foundModel) {
-        modelIndices.push_back(static_cast<uint32_t>(models.size()));
-        models.push_back(model);
+    uint32_t index = static_cast<uint32_t>(models.size());
+    models.push_back(model);
+    candidates.push_back(index);
+    modelIndexByPtr[model.get()] = {model, index};
+    return index;
+}
+
+uint64_t Scene::hashMaterial(const Material& m) {
+    uint64_t hash = hashCombine(0, static_cast<uint64_t>(m.materialID));
+    hash = hashCombine(hash, static_cast<uint64_t>(static_cast<uint32_t>(m.textureID)));
+    hash = hashCombine(hash, static_cast<uint64_t>(static_cast<uint32_t>(m.normalMapID)));
+    hash = hashCombine(hash, static_cast<uint64_t>(static_cast<uint32_t>(m.roughnessMapID)));
+    hash = hashCombine(hash, static_cast<uint64_t>(static_cast<uint32_t>(m.metalnessMapID)));
+    hash = hashCombine(hash, static_cast<uint64_t>(static_cast<uint32_t>(m.occlusionMapID)));
+    hash = hashCombine(hash, static_cast<uint64_t>(m.roughnessChannel | m.metalnessChannel << 8 | m.occlusionChannel << 16));
+    hash = hashCombine(hash, m.color.x); hash = hashCombine(hash, m.color.y); hash = hashCombine(hash, m.color.z);
+    hash = hashCombine(hash, m.emission.x); hash = hashCombine(hash, m.emission.y); hash = hashCombine(hash, m.emission.z);
+    hash = hashCombine(hash, m.roughness);
+    for (simd::float4 rect : {m.textureRect, m.normalMapRect, m.roughnessMapRect, m.metalnessMapRect, m.occlusionMapRect}) {
+        hash = hashCombine(hash, rect.x); hash = hashCombine(hash, rect.y); hash = hashCombine(hash, rect.z); hash = hashCombine(hash, rect.w);
     }
+    return hash;
+}
+
+uint32_t Scene::findOrAddMaterial(const std::shared_ptr<Material>& material) {
+    const Material& m = *material;
     
-    instanceDataVec.push_back(instanceData);
+    std::vector<uint32_t>& candidates = materialIndicesByHash[hashMaterial(m)];
+    for (uint32_t candidate : candidates) {
+        const Material& c = *materials[candidate];
+        if (c.materialID == m.materialID && c.textureID == m.textureID && c.normalMapID == m.normalMapID
+            && c.roughnessMapID == m.roughnessMapID && c.metalnessMapID == m.metalnessMapID && c.occlusionMapID == m.occlusionMapID
+            && c.roughnessChannel == m.roughnessChannel && c.metalnessChannel == m.metalnessChannel && c.occlusionChannel == m.occlusionChannel
+            && simd::all(c.color == m.color) && simd::all(c.emission == m.emission)
+            && c.roughness == m.roughness
+            && simd::all(c.textureRect == m.textureRect) && simd::all(c.normalMapRect == m.normalMapRect)
+            && simd::all(c.roughnessMapRect == m.roughnessMapRect) && simd::all(c.metalnessMapRect == m.metalnessMapRect)
+            && simd::all(c.occlusionMapRect == m.occlusionMapRect)) {
+            if (materials[candidate] != material) {
+                duplicateMaterialCount++;
+            }
+            return candidate;
+        }
+    }
+    
+    uint32_t index = static_cast<uint32_t>(materials.size());
+    materials.push_back(material);
+    candidates.push_back(index);
+    return index;
 }
 
 void Scene::addTexture(const std::shared_ptr<Texture>& texture) {
     textures.push_back(texture);
     
     if (textures.size() > NUM_TEXTURES) {
-        std::cerr << "Number of textures > max texture size!\n";
+        std::cerr << "Number of textures > NUM_TEXTURES (" << NUM_TEXTURES << ")! Mark small textures \"atlas\" in the scene file to pack them into shared atlases\n";
         exit(1);
     }
 }
 
+void Scene::updateMaterial(uint32_t materialId, const Material& material) {
+    assert(materialId < materials.size());
+    
+    // The id keeps its place in the instance material tables even if the new value equals another material, so only the
+    //  dedup index moves to the new hash
+    std::vector<uint32_t>& oldCandidates = materialIndicesByHash[hashMaterial(*materials[materialId])];
+    oldCandidates.erase(std::remove(oldCandidates.begin(), oldCandidates.end(), materialId), oldCandidates.end());
+    
+    *materials[materialId] = material;
+    materialIndicesByHash[hashMaterial(material)].push_back(materialId);
+    dirtyMaterials.push_back(materialId);
+}
+
+void Scene::setInstanceTransform(uint32_t instanceId, simd::float4x4 transform) {
+    assert(instanceId < instanceDataVec.size());
+    
+    instanceTransforms[instanceId] = transform;
+    instanceDataVec[instanceId].transform = transform;
+    dirtyInstances.push_back(instanceId);
+}
+
+void Scene::setTexture(uint32_t slot, const std::shared_ptr<Texture>& texture) {
+    assert(slot < textures.size());
+    
+    // Textures are bound per dispatch rather than stored in the arena, so a swap needs no upload
+    textures[slot] = texture;
+    dirtyTextures.push_back(slot);
+}
+
 const std::vector<std::shared_ptr<Texture>>& Scene::getTextures() {
     return textures;
 }
 
+void Scene::setTileCache(const std::shared_ptr<TextureTileCache>& cache) {
+    tileCache = cache;
+}
+
+TextureTileCache* Scene::getTileCache() const {
+    return tileCache.get();
+}
+
 void Scene::build(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
-    buildModelDataBuffers(device, cmdQueue);
-    buildChildAccStructs(device, cmdQueue);
-    buildInstanceAccStruct(device, cmdQueue);
+    auto buildStart = std::chrono::steady_clock::now();
+    lastBuildReport = SceneBuildReport{};
+    
+    auto sortUnique = [](std::vector<uint32_t>& ids) {
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    };
+    sortUnique(dirtyMaterials);
+    sortUnique(dirtyInstances);
+    sortUnique(dirtyTextures);
+    
+    const bool modelsAdded = builtModelCount < models.size();
+    if (modelsAdded) {
+        layoutModelData();
+        
+        auto start = std::chrono::steady_clock::now();
+        lastBuildReport.modelsBuilt = models.size() - builtModelCount;
+        buildChildAccStructs(device, cmdQueue);
+        auto end = std::chrono::steady_clock::now();
+        
+        std::chrono::duration<double> elapsed = end - start;
+        lastBuildReport.blasMs = elapsed.count() * 1000;
+    }
+    
+    // What the new models didn't consume was built for duplicates of models already in the scene, or for models that
+    //  were never added
+    releasePrebuiltAccStructs();
+    
+    // A moved instance can select a different LOD, and so a different number of entries, so the whole table is rebuilt
+    //  on the CPU. Only the entries of dirty instances are uploaded unless the layout changes.
+    bool allInstances = instanceTableDirty || modelsAdded;
+    const bool instancesChanged = allInstances || !dirtyInstances.empty();
+    if (instancesChanged) {
+        std::vector<size_t> previousFirstEntry = objectFirstEntry;
+        buildInstanceTable();
+        lastBuildReport.instanceTableRebuilt = true;
+        
+        // Entries of untouched objects move if a dirty object changed its number of LODs in use
+        allInstances = allInstances || objectFirstEntry != previousFirstEntry;
+    }
+    
+    size_t previousOffsets[SCENE_SECTION_COUNT];
+    std::copy(std::begin(sectionOffsets), std::end(sectionOffsets), previousOffsets);
+    
+    auto start = std::chrono::steady_clock::now();
+    if (layoutArena()) {
+        packArena(device, cmdQueue, previousOffsets);
+        lastBuildReport.arenaRepacked = true;
+    } else if (!dirtyMaterials.empty() || instancesChanged) {
+        patchArena(device, cmdQueue, allInstances);
+    }
+    auto end = std::chrono::steady_clock::now();
+    
+    std::chrono::duration<double> elapsed = end - start;
+    (lastBuildReport.arenaRepacked ? lastBuildReport.arenaMs : lastBuildReport.uploadMs) = elapsed.count() * 1000;
+    
+    if (instancesChanged) {
+        start = std::chrono::steady_clock::now();
+        buildInstanceAccStruct(device, cmdQueue);
+        end = std::chrono::steady_clock::now();
+        
+        elapsed = end - start;
+        lastBuildReport.instanceAccStructRebuilt = true;
+        lastBuildReport.instanceAccStructMs = elapsed.count() * 1000;
+    }
+    
+    lastBuildReport.texturesChanged = dirtyTextures.size();
+    
+    instanceTableDirty = false;
+    dirtyMaterials.clear();
+    dirtyInstances.clear();
+    dirtyTextures.clear();
+    
+    elapsed = std::chrono::steady_clock::now() - buildStart;
+    lastBuildReport.totalMs = elapsed.count() * 1000;
+    
+    if (modelsAdded) {
+        printVertexStreamReport(lastBuildReport.blasMs);
+    }
+    printBuildReport();
 }
 
-void Scene::buildChildAccStructs(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
-    childAccStructs = std::vector<TriangleAccelerationStructure>{};
+const SceneBuildReport& Scene::getLastBuildReport() const {
+    return lastBuildReport;
+}
+
+void Scene::finalize(bool releaseCpuGeometry) {
+    assert(builtModelCount == models.size() && arenaModelCount == models.size());
     
+    size_t gpuBytes = 0;
+    size_t cpuBytes = 0;
     for (const auto& model : models) {
-        childAccStructs.push_back(TriangleAccelerationStructure(device, cmdQueue, *model));
+        gpuBytes += model->getGpuGeometryBytes();
+        model->releaseGpuBuffers();
+        
+        if (releaseCpuGeometry) {
+            cpuBytes += model->getCpuGeometryBytes();
+            model->releaseCpuGeometry();
+        }
     }
+    
+    constexpr double MB = 1024.0 * 1024.0;
+    std::cout << "Scene finalize: released " << gpuBytes / MB << " MB of model GPU buffers and " << cpuBytes / MB << " MB of CPU geometry\n";
 }
 
-void Scene::buildInstanceAccStruct(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
-    size_t instanceCount = modelIndices.size();
+void Scene::addMemoryUsage(MemoryReport& report) const {
+    size_t modelCpuBytes = 0;
+    size_t modelGpuBytes = 0;
+    for (const auto& model : models) {
+        modelCpuBytes += model->getCpuGeometryBytes();
+        modelGpuBytes += model->getGpuGeometryBytes();
+    }
+    
+    // The instance and material tables share the arena with the geometry, so the whole arena counts as geometry
+    size_t tableCpuBytes = instanceDataVec.capacity() * sizeof(InstanceData) + gpuInstances.capacity() * sizeof(InstanceData)
+        + instanceMaterialIndices.capacity() * sizeof(uint32_t) + instanceTransforms.capacity() * sizeof(simd::float4x4)
+        + instanceEntryTransforms.capacity() * sizeof(simd::float4x4);
+    report.add(MemorySubsystem::Geometry, modelCpuBytes + tableCpuBytes, modelGpuBytes + (arena ? arena->allocatedSize() : 0));
     
-    std::vector<MTL::AccelerationStructure*> accStructs(instanceCount);
-    std::vector<simd::float4x4> transforms(instanceCount);
-    for (int i = 0; i < instanceCount; i++) {
-        int accStructIdx = modelIndices[i];
-        accStructs[i] = childAccStructs[accStructIdx].getAccelerationStructure();
-        transforms[i] = instanceTransforms[i];
+    size_t accStructBytes = instanceAccStruct ? instanceAccStruct->getAccelerationStructure()->allocatedSize() : 0;
+    for (const TriangleAccelerationStructure& accStruct : childAccStructs) {
+        accStructBytes += accStruct.getAccelerationStructure()->allocatedSize();
+    }
+    {
+        std::lock_guard<std::mutex> lock(prebuiltMutex);
+        for (const auto& [model, prebuilt] : prebuiltAccStructs) {
+            for (const TriangleAccelerationStructure& accStruct : prebuilt.second) {
+                accStructBytes += accStruct.getAccelerationStructure()->allocatedSize();
+            }
+        }
     }
+    report.add(MemorySubsystem::AccelerationStructures, 0, accStructBytes);
     
-    instanceAccStruct = std::make_unique<InstanceAccelerationStructure>(device, cmdQueue, accStructs, transforms);
+    // Sparse textures hold no memory of their own, only the tile cache's heap
+    size_t textureBytes = 0;
+    for (const auto& texture : textures) {
+        if (!texture->texture->isSparse()) {
+            textureBytes += texture->texture->allocatedSize();
+        }
+    }
+    report.add(MemorySubsystem::Textures, 0, textureBytes);
+    if (tileCache) {
+        tileCache->addMemoryUsage(report);
+    }
 }
 
-void Scene::buildModelDataBuffers(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
-    // First pass to see vertex and index buffer size
-    std::vector<size_t> modelIdxToIdxLoc(models.size());
+void Scene::printBuildReport() const {
+    const SceneBuildReport& r = lastBuildReport;
+    
+    std::cout << "Scene build (" << r.totalMs << " ms):\n";
+    if (r.modelsBuilt > 0) {
+        std::cout << "  BLAS: " << r.modelsBuilt << " models, " << r.modelsPrebuilt << " prebuilt (" << r.blasMs << " ms)\n";
+    }
+    if (r.arenaRepacked) {
+        std::cout << "  arena repacked (" << r.arenaMs << " ms)\n";
+    } else if (r.materialsUploaded > 0 || r.instancesUploaded > 0) {
+        std::cout << "  patched " << r.materialsUploaded << " materials, " << r.instancesUploaded << " instance entries (" << r.uploadMs << " ms)\n";
+    }
+    if (r.instanceAccStructRebuilt) {
+        std::cout << "  IAS: " << instanceEntryLods.size() << " entries (" << r.instanceAccStructMs << " ms)\n";
+    }
+    if (r.texturesChanged > 0) {
+        std::cout << "  textures swapped: " << r.texturesChanged << "\n";
+    }
+    if (r.modelsBuilt == 0 && !r.arenaRepacked && r.materialsUploaded == 0 && !r.instanceAccStructRebuilt && r.texturesChanged == 0) {
+        std::cout << "  nothing changed\n";
+    }
+}
+
+void Scene::printVertexStreamReport(double blasBuildMs) const {
     size_t totalVertices = 0;
+    for (const auto& model : models) {
+        totalVertices += model->getVertexCount();
+    }
+    
     size_t totalIndices = 0;
+    size_t totalIndexBytes = 0;
+    for (const auto& model : models) {
+        totalIndices += model->getTriangleCount() * 3;
+        totalIndexBytes += model->getTriangleCount() * 3 * model->getIndexStride();
+    }
+    
+    // Bytes a position fetch touches per vertex, with the interleaved layout as the baseline it replaced
+    constexpr double MB = 1024.0 * 1024.0;
+    std::cout << "Vertex streams: " << totalVertices << " vertices\n"
+              << "  positions: " << sizeof(VertexPosition) << " B/vertex, " << totalVertices * sizeof(VertexPosition) / MB << " MB\n"
+              << "  shading:   " << sizeof(VertexShadingData) << " B/vertex, " << totalVertices * sizeof(VertexShadingData) / MB << " MB\n"
+              << "  interleaved baseline: " << sizeof(ModelVertexData) << " B/vertex, " << totalVertices * sizeof(ModelVertexData) / MB << " MB\n"
+              << "  position fetch footprint: " << 100.0 * sizeof(VertexPosition) / sizeof(ModelVertexData) << "% of interleaved\n"
+              << "  indices: " << totalIndexBytes / MB << " MB (" << totalIndices * sizeof(uint32_t) / MB << " MB as 32-bit)\n"
+              << "  BLAS build: " << blasBuildMs << " ms\n"
+              << "Deduplicated " << duplicateModelCount << " models and " << duplicateMaterialCount << " materials\n";
+}
+
+void Scene::setLodCamera(simd::float3 cameraPos, float fovy, uint32_t imageHeight) {
+    lodCameraPos = cameraPos;
+    lodPixelAngle = fovy / static_cast<float>(imageHeight);
+    lodCameraSet = true;
+    instanceTableDirty = true;
+}
+
+uint32_t Scene::selectLod(const Model& model, const simd::float4x4& transform) const {
+    if (!lodCameraSet || model.getLodCount() == 1) {
+        return 0;
+    }
+    
+    // Projected area of the instance's bounding sphere in pixels
+    simd::float3 localCenter = model.getBoundsMin() + model.getBoundsExtent() * 0.5f;
+    simd::float4 center = transform * simd::float4{localCenter.x, localCenter.y, localCenter.z, 1};
+    float scale = std::max({simd::length(transform.columns[0].xyz), simd::length(transform.columns[1].xyz), simd::length(transform.columns[2].xyz)});
+    float radius = simd::length(model.getBoundsExtent()) * 0.5f * scale;
+    float distance = std::max(simd::length(center.xyz - lodCameraPos) - radius, EPS);
+    
+    float projectedRadius = radius / (distance * lodPixelAngle);
+    float projectedArea = static_cast<float>(M_PI) * projectedRadius * projectedRadius;
+    
+    // Coarsest LOD that still has enough triangles for the pixels it covers
+    uint32_t lod = 0;
+    while (lod + 1 < model.getLodCount() && model.getTriangleCount(lod + 1) >= projectedArea * LOD_TRIANGLES_PER_PIXEL) {
+        lod++;
+    }
+    
+    return lod;
+}
+
+void Scene::buildChildAccStructs(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
+    // Every LOD of every model gets its own BLAS, at modelLodBase[model] + lod. Models are only appended, so the BLASes
+    //  built earlier keep their place and only new models are built.
+    assert(childAccStructs.size() == (builtModelCount < models.size() ? modelLodBase[builtModelCount] : childAccStructs.size()));
+    
+    for (size_t i = builtModelCount; i < models.size(); i++) {
+        {
+            std::lock_guard<std::mutex> lock(prebuiltMutex);
+            auto prebuilt = prebuiltAccStructs.find(models[i].get());
+            if (prebuilt != prebuiltAccStructs.end() && prebuilt->second.first.lock() == models[i]) {
+                childAccStructs.insert(childAccStructs.end(), prebuilt->second.second.begin(), prebuilt->second.second.end());
+                prebuiltAccStructs.erase(prebuilt);
+                lastBuildReport.modelsPrebuilt++;
+                continue;
+            }
+        }
+        
+        for (size_t lod = 0; lod < models[i]->getLodCount(); lod++) {
+            childAccStructs.push_back(TriangleAccelerationStructure(device, cmdQueue, *models[i], lod));
+        }
+    }
+    
+    builtModelCount = models.size();
+}
+
+void Scene::prebuildAccStructs(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::shared_ptr<Model>& model) {
+    std::vector<TriangleAccelerationStructure> accStructs;
+    for (size_t lod = 0; lod < model->getLodCount(); lod++) {
+        accStructs.push_back(TriangleAccelerationStructure(device, cmdQueue, *model, lod));
+    }
+    
+    std::lock_guard<std::mutex> lock(prebuiltMutex);
+    auto& [owner, previous] = prebuiltAccStructs[model.get()];
+    for (const TriangleAccelerationStructure& accStruct : previous) {
+        accStruct.getAccelerationStructure()->release();
+    }
+    owner = model;
+    previous = std::move(accStructs);
+}
+
+void Scene::releasePrebuiltAccStructs() {
+    std::lock_guard<std::mutex> lock(prebuiltMutex);
+    for (const auto& [model, prebuilt] : prebuiltAccStructs) {
+        for (const TriangleAccelerationStructure& accStruct : prebuilt.second) {
+            accStruct.getAccelerationStructure()->release();
+        }
+    }
+    prebuiltAccStructs.clear();
+}
+
+void Scene::buildInstanceTable() {
+    const size_t objectCount = modelIndices.size();
+    
+    // Each object becomes one IAS instance per LOD it uses. Camera rays only see the primary LOD and rays after a diffuse
+    //  bounce only see the secondary LOD, which the kernel selects through the intersection mask.
+    std::vector<uint32_t> primaryLods(objectCount);
+    std::vector<uint32_t> secondaryLods(objectCount);
+    std::vector<size_t>& firstEntry = objectFirstEntry;
+    firstEntry = std::vector<size_t>(objectCount + 1);
+    
+    parallelFor(objectCount, 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Model& model = *models[modelIndices[i]];
+            primaryLods[i] = selectLod(model, instanceTransforms[i]);
+            secondaryLods[i] = std::min<uint32_t>(primaryLods[i] + LOD_SECONDARY_BIAS, static_cast<uint32_t>(model.getLodCount() - 1));
+        }
+    });
+    
+    // Prefix sum over the entries per object, then every object writes its own range
+    firstEntry[0] = 0;
+    for (size_t i = 0; i < objectCount; i++) {
+        firstEntry[i + 1] = firstEntry[i] + (primaryLods[i] == secondaryLods[i] ? 1 : 2);
+    }
+    
+    const size_t entryCount = firstEntry[objectCount];
+    instanceEntryLods = std::vector<size_t>(entryCount);
+    instanceEntryTransforms = std::vector<simd::float4x4>(entryCount);
+    instanceEntryMasks = std::vector<uint32_t>(entryCount);
+    gpuInstances = std::vector<InstanceData>(entryCount);
+    
+    parallelFor(objectCount, 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const uint32_t modelIdx = modelIndices[i];
+            const Model& model = *models[modelIdx];
+            const simd::float4x4& transform = instanceTransforms[i];
+            const float scale = std::max({simd::length(transform.columns[0].xyz), simd::length(transform.columns[1].xyz), simd::length(transform.columns[2].xyz)});
+            
+            size_t entry = firstEntry[i];
+            for (uint32_t lod : {primaryLods[i], secondaryLods[i]}) {
+                if (entry == firstEntry[i + 1]) {
+                    break;
+                }
+                
+                uint32_t mask = (lod == primaryLods[i] ? LOD_MASK_PRIMARY : 0) | (lod == secondaryLods[i] ? LOD_MASK_SECONDARY : 0);
+                const size_t lodIdx = modelLodBase[modelIdx] + lod;
+                
+                InstanceData instanceData = instanceDataVec[i];
+                instanceData.indexByteOffset = lodIndexByteOffsets[lodIdx];
+                instanceData.vertexOffset = modelVertexOffsets[modelIdx];
+                instanceData.submeshOffset = lodSubmeshOffsets[lodIdx];
+                instanceData.flags = model.getIndexType() == MTL::IndexTypeUInt16 ? INSTANCE_FLAG_16BIT_INDICES : 0;
+                instanceData.boundsMin = model.getBoundsMin();
+                instanceData.boundsExtent = model.getBoundsExtent();
+                
+                // Both LODs stray from LOD 0 by at most their distance, so a secondary ray leaving a hit on another
+                //  LOD can't self-intersect the secondary one past their sum
+                instanceData.secondaryOffset = lod == secondaryLods[i] ? 0.0f : (model.getLodDistance(lod) + model.getLodDistance(secondaryLods[i])) * scale;
+                
+                gpuInstances[entry] = instanceData;
+                instanceEntryLods[entry] = lodIdx;
+                instanceEntryTransforms[entry] = transform;
+                instanceEntryMasks[entry] = mask;
+                entry++;
+            }
+        }
+    });
+}
+
+void Scene::buildInstanceAccStruct(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
+    std::vector<MTL::AccelerationStructure*> accStructs(instanceEntryLods.size());
+    for (size_t entry = 0; entry < instanceEntryLods.size(); entry++) {
+        accStructs[entry] = childAccStructs[instanceEntryLods[entry]].getAccelerationStructure();
+    }
+    
+    if (instanceAccStruct) {
+        instanceAccStruct->getAccelerationStructure()->release();
+    }
+    instanceAccStruct = std::make_unique<InstanceAccelerationStructure>(device, cmdQueue, accStructs, instanceEntryTransforms, instanceEntryMasks);
+}
+
+void Scene::layoutModelData() {
+    // Lay out every model's vertices, and the indices and submeshes of each of its LODs. Indices stay local to their
+    //  model (and 16-bit where the model allows it), so each index range starts 4-byte aligned and instances add
+    //  vertexOffset.
+    modelVertexOffsets = std::vector<uint32_t>(models.size());
+    modelLodBase = std::vector<size_t>(models.size());
+    lodIndexByteOffsets = std::vector<uint64_t>{};
+    lodSubmeshOffsets = std::vector<uint32_t>{};
+    size_t totalVertices = 0;
+    size_t totalIndexBytes = 0;
+    size_t totalSubmeshes = 0;
     
     for (int i = 0; i < models.size(); i++) {
         const auto& model = models[i];
         
-        modelIdxToIdxLoc[i] = totalIndices;
+        modelVertexOffsets[i] = static_cast<uint32_t>(totalVertices);
+        modelLodBase[i] = lodIndexByteOffsets.size();
         totalVertices += model->getVertexCount();
-        totalIndices += model->getTriangleCount() * 3;
+        
+        for (size_t lod = 0; lod < model->getLodCount(); lod++) {
+            lodIndexByteOffsets.push_back(totalIndexBytes);
+            lodSubmeshOffsets.push_back(static_cast<uint32_t>(totalSubmeshes));
+            
+            totalIndexBytes += (model->getTriangleCount(lod) * 3 * model->getIndexStride() + 3) & ~size_t(3);
+            totalSubmeshes += model->getSubmeshes(lod).size();
+        }
     }
     
-    // Second pass to build buffers and move data in
-    vertexBuffer = device->newBuffer(totalVertices * sizeof(ModelVertexData), MTL::ResourceStorageModePrivate);
-    vertexBuffer->setLabel(NS::String::string("Scene vertex bufer", NS::UTF8StringEncoding));
- 
+    // Index byte offsets are 64-bit, but the kernel still addresses vertices with 32-bit indices
+    if (totalVertices > UINT32_MAX) {
+        std::cerr << "Scene: " << totalVertices << " vertices across all models, but at most " << UINT32_MAX << " can be indexed\n";
+        exit(1);
+    }
+    
+    sceneVertexCount = totalVertices;
+    sceneIndexBytes = totalIndexBytes;
+    sceneSubmeshCount = totalSubmeshes;
+}
+
+bool Scene::layoutArena() {
+    // Every offset is known before anything is written. Geometry sections come first and are filled by GPU copies from
+    //  the models' buffers; the CPU-built tables come last so they can be staged as one contiguous range.
+    size_t sizes[SCENE_SECTION_COUNT];
+    sizes[static_cast<size_t>(SceneSection::Positions)] = sceneVertexCount * sizeof(VertexPosition);
+    sizes[static_cast<size_t>(SceneSection::Shading)] = sceneVertexCount * sizeof(VertexShadingData);
+    sizes[static_cast<size_t>(SceneSection::Indices)] = sceneIndexBytes;
+    sizes[static_cast<size_t>(SceneSection::InstanceData)] = gpuInstances.size() * sizeof(InstanceData);
+    sizes[static_cast<size_t>(SceneSection::Materials)] = materials.size() * sizeof(Material);
+    sizes[static_cast<size_t>(SceneSection::Submeshes)] = sceneSubmeshCount * sizeof(SubmeshData);
+    sizes[static_cast<size_t>(SceneSection::InstanceMaterials)] = instanceMaterialIndices.size() * sizeof(uint32_t);
+    
+    // New models can keep every section size only if they add no vertices, indices or submeshes, and their data still
+    //  has to be copied in, so any new model repacks
+    bool changed = !arena || builtModelCount != arenaModelCount;
+    for (size_t section = 0; section < SCENE_SECTION_COUNT; section++) {
+        changed = changed || sizes[section] != sectionSizes[section];
+    }
+    
+    if (!changed) {
+        return false;
+    }
+    
+    size_t arenaSize = 0;
+    for (size_t section = 0; section < SCENE_SECTION_COUNT; section++) {
+        sectionSizes[section] = sizes[section];
+        sectionOffsets[section] = arenaSize;
+        arenaSize += (std::max<size_t>(sectionSizes[section], 4) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+    }
+    
+    arenaSizeBytes = arenaSize;
+    arenaModelCount = builtModelCount;
+    return true;
+}
+
+void Scene::packArena(MTL::Device* device, MTL::CommandQueue* cmdQueue, const size_t (&previousOffsets)[SCENE_SECTION_COUNT]) {
+    auto start = std::chrono::steady_clock::now();
+    
+    const size_t arenaSize = arenaSizeBytes;
+    const size_t tablesOffset = sectionOffsets[static_cast<size_t>(SceneSection::InstanceData)];
+    const size_t tablesSize = arenaSize - tablesOffset;
+    
+    // The previous arena stays until the copies are done, since finalized models only have their geometry there
+    MTL::Buffer* previousArena = arena;
+    arena = device->newBuffer(arenaSize, MTL::ResourceStorageModePrivate);
+    arena->setLabel(NS::String::string("Scene arena", NS::UTF8StringEncoding));
+    
+    // The tables are written in parallel straight into the staging memory, with no intermediate vectors
+    MTL::Buffer* staging = device->newBuffer(tablesSize, MTL::ResourceStorageModeShared);
+    trackStagingAlloc(tablesSize);
+    uint8_t* tables = static_cast<uint8_t*>(staging->contents());
+    auto tableSection = [&](SceneSection section) {
+        return tables + sectionOffsets[static_cast<size_t>(section)] - tablesOffset;
+    };
+    
+    InstanceData* instanceDst = reinterpret_cast<InstanceData*>(tableSection(SceneSection::InstanceData));
+    parallelFor(gpuInstances.size(), 16384, [&](size_t begin, size_t end) {
+        std::memcpy(instanceDst + begin, gpuInstances.data() + begin, (end - begin) * sizeof(InstanceData));
+    });
+    
+    uint32_t* instanceMaterialDst = reinterpret_cast<uint32_t*>(tableSection(SceneSection::InstanceMaterials));
+    parallelFor(instanceMaterialIndices.size(), 65536, [&](size_t begin, size_t end) {
+        std::memcpy(instanceMaterialDst + begin, instanceMaterialIndices.data() + begin, (end - begin) * sizeof(uint32_t));
+    });
+    
+    // Submesh tables in the same model and LOD order as the index ranges
+    SubmeshData* submeshDst = reinterpret_cast<SubmeshData*>(tableSection(SceneSection::Submeshes));
+    parallelFor(models.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            for (size_t lod = 0; lod < models[i]->getLodCount(); lod++) {
+                const std::vector<SubmeshData>& lodSubmeshes = models[i]->getSubmeshes(lod);
+                std::memcpy(submeshDst + lodSubmeshOffsets[modelLodBase[i] + lod], lodSubmeshes.data(), lodSubmeshes.size() * sizeof(SubmeshData));
+            }
+        }
+    });
+    
+    Material* materialDst = reinterpret_cast<Material*>(tableSection(SceneSection::Materials));
+    for (size_t i = 0; i < materials.size(); i++) {
+        materialDst[i] = *materials[i];
+    }
+    
+    // One command buffer moves the model geometry and the staged tables into the arena. Models are only appended, so a
+    //  model's offsets within the geometry sections never change and a finalized model's data is copied from the same
+    //  place in the previous arena.
     MTL::CommandBuffer* cmdBuffer = cmdQueue->commandBuffer();
     MTL::BlitCommandEncoder* encoder = cmdBuffer->blitCommandEncoder();
     
-    size_t currentVertex = 0;
-    size_t currentIndex = 0;
-    std::vector<uint32_t> idxData(totalIndices);
-    for (int i = 0; i < models.size(); i++) {
+    auto copyGeometry = [&](MTL::Buffer* source, SceneSection section, size_t offset, size_t size) {
+        if (source) {
+            encoder->copyFromBuffer(source, 0, arena, getSectionOffset(section) + offset, size);
+        } else {
+            assert(previousArena);
+            encoder->copyFromBuffer(previousArena, previousOffsets[static_cast<size_t>(section)] + offset, arena, getSectionOffset(section) + offset, size);
+        }
+    };
+    
+    for (size_t i = 0; i < models.size(); i++) {
         const auto& model = models[i];
         
-        encoder->copyFromBuffer(model->getVertexBuffer(),
-                                0,
-                                vertexBuffer,
-                                currentVertex * sizeof(ModelVertexData),
-                                model->getVertexCount() * sizeof(ModelVertexData));
+        copyGeometry(model->getPositionBuffer(), SceneSection::Positions, modelVertexOffsets[i] * sizeof(VertexPosition), model->getVertexCount() * sizeof(VertexPosition));
+        copyGeometry(model->getShadingBuffer(), SceneSection::Shading, modelVertexOffsets[i] * sizeof(VertexShadingData), model->getVertexCount() * sizeof(VertexShadingData));
         
-        const std::vector<uint32_t> modelIndices = model->getIndices();
-        for (int j = 0; j < modelIndices.size(); j++) {
-            idxData[j + currentIndex] = modelIndices[j] + static_cast<uint32_t>(currentVertex);
+        for (size_t lod = 0; lod < model->getLodCount(); lod++) {
+            copyGeometry(model->getIndexBuffer(lod), SceneSection::Indices, lodIndexByteOffsets[modelLodBase[i] + lod],
+                         (model->getTriangleCount(lod) * 3 * model->getIndexStride() + 3) & ~size_t(3));
         }
-        
-        currentVertex += model->getVertexCount();
-        currentIndex += model->getTriangleCount() * 3;
     }
     
+    encoder->copyFromBuffer(staging, 0, arena, tablesOffset, tablesSize);
+    
     encoder->endEncoding();
     cmdBuffer->commit();
     cmdBuffer->waitUntilCompleted();
     
-    // Create index buffer
-    indexBuffer = makePrivateBuffer(device, cmdQueue, idxData.data(), static_cast<uint32_t>(idxData.size() * sizeof(uint32_t)));
-    indexBuffer->setLabel(NS::String::string("Scene index buffer", NS::UTF8StringEncoding));
+    staging->release();
+    trackStagingRelease(tablesSize);
+    if (previousArena) {
+        previousArena->release();
+    }
     
-    // Create material buffer
-    std::vector<Material> materialNoPtrs(materials.size());
-    for (size_t i = 0; i < materials.size(); i++) {
-        materialNoPtrs[i] = *materials[i];
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Scene arena (" << elapsed.count() * 1000 << " ms): " << arenaSize / (1024.0 * 1024.0) << " MB, "
+              << tablesSize / (1024.0 * 1024.0) << " MB staged\n";
+}
+
+void Scene::patchArena(MTL::Device* device, MTL::CommandQueue* cmdQueue, bool allInstances) {
+    // The layout is unchanged, so dirty records are rewritten at their existing offsets. Adjacent records are merged into
+    //  one copy, and everything goes through one staging buffer and one blit pass.
+    struct Run {
+        SceneSection section;
+        size_t first;
+        size_t count;
+        size_t stagingOffset;
+    };
+    
+    std::vector<Run> runs;
+    size_t stagingSize = 0;
+    auto addRuns = [&](SceneSection section, const std::vector<uint32_t>& sortedIds, size_t recordSize) {
+        for (size_t i = 0; i < sortedIds.size();) {
+            size_t j = i + 1;
+            while (j < sortedIds.size() && sortedIds[j] == sortedIds[j - 1] + 1) {
+                j++;
+            }
+            
+            runs.push_back({section, sortedIds[i], j - i, stagingSize});
+            stagingSize += (j - i) * recordSize;
+            i = j;
+        }
+    };
+    
+    addRuns(SceneSection::Materials, dirtyMaterials, sizeof(Material));
+    lastBuildReport.materialsUploaded = dirtyMaterials.size();
+    
+    // Instance records are uploaded as IAS entry ranges, which are contiguous per object
+    std::vector<uint32_t> dirtyEntries;
+    if (allInstances) {
+        dirtyEntries.resize(gpuInstances.size());
+        std::iota(dirtyEntries.begin(), dirtyEntries.end(), 0);
+    } else {
+        for (uint32_t instanceId : dirtyInstances) {
+            for (size_t entry = objectFirstEntry[instanceId]; entry < objectFirstEntry[instanceId + 1]; entry++) {
+                dirtyEntries.push_back(static_cast<uint32_t>(entry));
+            }
+        }
+    }
+    addRuns(SceneSection::InstanceData, dirtyEntries, sizeof(InstanceData));
+    lastBuildReport.instancesUploaded = dirtyEntries.size();
+    
+    if (runs.empty()) {
+        return;
     }
     
-    materialBuffer = makePrivateBuffer(device, cmdQueue, materialNoPtrs.data(), static_cast<uint32_t>(materialNoPtrs.size() * sizeof(Material)));
+    MTL::Buffer* staging = device->newBuffer(stagingSize, MTL::ResourceStorageModeShared);
+    trackStagingAlloc(stagingSize);
+    uint8_t* stagingData = static_cast<uint8_t*>(staging->contents());
     
-    // Create instance data buffer
-    instanceDataBuffer = makePrivateBuffer(device, cmdQueue, instanceDataVec.data(), static_cast<uint32_t>(instanceDataVec.size() * sizeof(InstanceData)));
-    instanceDataBuffer->setLabel(NS::String::string("Scene instance index map", NS::UTF8StringEncoding));
+    MTL::CommandBuffer* cmdBuffer = cmdQueue->commandBuffer();
+    MTL::BlitCommandEncoder* encoder = cmdBuffer->blitCommandEncoder();
+    
+    for (const Run& run : runs) {
+        size_t recordSize;
+        if (run.section == SceneSection::Materials) {
+            recordSize = sizeof(Material);
+            Material* dst = reinterpret_cast<Material*>(stagingData + run.stagingOffset);
+            for (size_t i = 0; i < run.count; i++) {
+                dst[i] = *materials[run.first + i];
+            }
+        } else {
+            recordSize = sizeof(InstanceData);
+            std::memcpy(stagingData + run.stagingOffset, gpuInstances.data() + run.first, run.count * sizeof(InstanceData));
+        }
+        
+        encoder->copyFromBuffer(staging, run.stagingOffset, arena, getSectionOffset(run.section) + run.first * recordSize, run.count * recordSize);
+    }
+    
+    encoder->endEncoding();
+    cmdBuffer->commit();
+    cmdBuffer->waitUntilCompleted();
+    
+    staging->release();
+    trackStagingRelease(stagingSize);
 }
 
-MTL::Buffer* Scene::getVertexBuffer() const {
-    return vertexBuffer;
+MTL::Buffer* Scene::getArena() const {
+    return arena;
 }
 
-MTL::Buffer* Scene::getIndexBuffer() const {
-    return indexBuffer;
+size_t Scene::getSectionOffset(SceneSection section) const {
+    return sectionOffsets[static_cast<size_t>(section)];
 }
 
-MTL::Buffer* Scene::getInstanceDataBuffer() const {
-    return instanceDataBuffer;
+size_t Scene::getSectionSize(SceneSection section) const {
+    return sectionSizes[static_cast<size_t>(section)];
 }
 
 const std::vector<TriangleAccelerationStructure>& Scene::getChildAccStructs() const {
@@ -169,7 +866,3 @@ const std::vector<TriangleAccelerationStructure>& Scene::getChildAccStructs() co
 const InstanceAccelerationStructure& Scene::getInstanceAccStruct() const {
     return *instanceAccStruct;
 }
-
-MTL::Buffer* Scene::getMaterialBuffer() const {
-    return materialBuffer;
-}
@@ -2,6 +2,9 @@
 #define scene_hpp
 
 #include <vector>
+#include <unordered_map>
+#include <span>
+#include <mutex>
 #include <simd/simd.h>
 #include <Metal/Metal.hpp>
 
@@ -10,44 +13,185 @@
 #include "tri_acc_struct.hpp"
 #include "instance_acc_struct.hpp"
 #include "texture.hpp"
+#include "texture_tile_cache.hpp"
+#include "memory_report.hpp"
 
+/// Sections of the scene arena, in arena order. The geometry sections are filled from the models' GPU buffers and the
+/// rest are tables built on the CPU.
+enum class SceneSection {
+    Positions,
+    Shading,
+    Indices,
+    InstanceData,
+    Materials,
+    Submeshes,
+    InstanceMaterials
+};
+
+constexpr size_t SCENE_SECTION_COUNT = 7;
+
+/// What the last Scene::build did. Steps that were skipped have a count of 0 and no time.
+struct SceneBuildReport {
+    size_t modelsBuilt = 0;           // Models whose BLASes were built or taken from prebuildAccStructs
+    size_t modelsPrebuilt = 0;
+    double blasMs = 0;
+    bool instanceTableRebuilt = false;
+    bool arenaRepacked = false;       // The arena layout changed, so every section was rewritten
+    double arenaMs = 0;
+    size_t materialsUploaded = 0;     // Records patched in place when the layout did not change
+    size_t instancesUploaded = 0;
+    double uploadMs = 0;
+    bool instanceAccStructRebuilt = false;
+    double instanceAccStructMs = 0;
+    size_t texturesChanged = 0;
+    double totalMs = 0;
+};
 
 class Scene {
 public:
     Scene() {}
     
-    void addObject(const std::shared_ptr<Model>& model, const std::shared_ptr<Material>& material, simd::float4x4 transform);
+    /// Returns the instance id, for setInstanceTransform
+    uint32_t addObject(const std::shared_ptr<Model>& model, const std::shared_ptr<Material>& material, simd::float4x4 transform);
+    
+    /// Adds an object with one material per material slot of the model. Slots without an entry use the last material given.
+    uint32_t addObject(const std::shared_ptr<Model>& model, const std::vector<std::shared_ptr<Material>>& slotMaterials, simd::float4x4 transform);
+    
+    /// Registers a model or material without instancing it and returns its scene id for addInstances. Equal content
+    /// returns the id already assigned.
+    uint32_t addModel(const std::shared_ptr<Model>& model);
+    uint32_t addMaterial(const std::shared_ptr<Material>& material);
+    
+    /// Adds one instance per entry of the spans, which must be the same length. Each instance uses its material id for
+    /// every material slot of its model. Storage is reserved once and the instance data is filled in parallel. Returns the
+    /// instance id of the first one. Exits if the lengths differ or an id is unknown.
+    uint32_t addInstances(std::span<const uint32_t> modelIds, std::span<const uint32_t> materialIds, std::span<const simd::float4x4> transforms);
+    
+    /// Like the above, but instance i gives one material id per slot in materialIds[materialOffsets[i]] up to
+    /// materialIds[materialOffsets[i + 1]], which must hold at least one. Slots without an entry use its last material,
+    /// as in addObject.
+    uint32_t addInstances(std::span<const uint32_t> modelIds, std::span<const uint32_t> materialOffsets, std::span<const uint32_t> materialIds, std::span<const simd::float4x4> transforms);
     
     void addTexture(const std::shared_ptr<Texture>& texture);
+    
+    /// Edits that only mark what they touch, so the next build re-uploads or rebuilds just that
+    void updateMaterial(uint32_t materialId, const Material& material);
+    void setInstanceTransform(uint32_t instanceId, simd::float4x4 transform);
+    void setTexture(uint32_t slot, const std::shared_ptr<Texture>& texture);
+    
     const std::vector<std::shared_ptr<Texture>>& getTextures();
     
+    /// The cache streaming the scene's sparse textures, which the renderer binds and updates after every frame
+    void setTileCache(const std::shared_ptr<TextureTileCache>& cache);
+    TextureTileCache* getTileCache() const;
+    
+    /// Enables per-instance LOD selection by projected size for the given camera. Without it every instance uses LOD 0
+    /// for camera rays.
+    void setLodCamera(simd::float3 cameraPos, float fovy, uint32_t imageHeight);
+    
+    /// Builds a model's BLASes ahead of build, e.g. on a loader thread as soon as the model has loaded. The next build uses
+    /// them if the model was added to the scene by then, and releases them otherwise, e.g. when the model was a duplicate
+    /// of one already in the scene. Safe to call from several threads at once.
+    void prebuildAccStructs(MTL::Device* device, MTL::CommandQueue* cmdQueue, const std::shared_ptr<Model>& model);
+    
+    /// Builds the GPU data on the first call. Later calls only build BLASes for new models, patch changed materials and
+    /// instances in place, and rebuild the IAS when instances changed. The arena is only repacked when its layout changes.
     void build(MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    const SceneBuildReport& getLastBuildReport() const;
     
-    MTL::Buffer* getVertexBuffer() const;
-    MTL::Buffer* getIndexBuffer() const;
-    MTL::Buffer* getInstanceDataBuffer() const;
-    MTL::Buffer* getMaterialBuffer() const;
+    /// Drops the copies build() has consumed: every model's own GPU buffers, which now live in the arena and BLASes, and
+    /// optionally its CPU vertices and indices. Later builds take finalized models' geometry from the previous arena,
+    /// and models added afterwards are no longer deduplicated against finalized ones.
+    void finalize(bool releaseCpuGeometry = true);
+    
+    /// Adds the scene's geometry, acceleration structures and textures to report
+    void addMemoryUsage(MemoryReport& report) const;
+    
+    /// All scene data lives in one private buffer, bound once per section at that section's offset
+    MTL::Buffer* getArena() const;
+    size_t getSectionOffset(SceneSection section) const;
+    size_t getSectionSize(SceneSection section) const;
     const std::vector<TriangleAccelerationStructure>& getChildAccStructs() const;
     const InstanceAccelerationStructure& getInstanceAccStruct() const;
-    
+
 private:
-    void buildModelDataBuffers(MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    void layoutModelData();
     void buildChildAccStructs(MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    void releasePrebuiltAccStructs();
+    void buildInstanceTable();
+    bool layoutArena();
+    void packArena(MTL::Device* device, MTL::CommandQueue* cmdQueue, const size_t (&previousOffsets)[SCENE_SECTION_COUNT]);
+    void patchArena(MTL::Device* device, MTL::CommandQueue* cmdQueue, bool allInstances);
     void buildInstanceAccStruct(MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    void printVertexStreamReport(double blasBuildMs) const;
+    void printBuildReport() const;
+    uint32_t findOrAddModel(const std::shared_ptr<Model>& model);
+    uint32_t findOrAddMaterial(const std::shared_ptr<Material>& material);
+    uint32_t selectLod(const Model& model, const simd::float4x4& transform) const;
+    static uint64_t hashMaterial(const Material& material);
+    
+    static constexpr float LOD_TRIANGLES_PER_PIXEL = 0.5f;  // Keep the coarsest LOD with at least this triangle density
+    static constexpr uint32_t LOD_SECONDARY_BIAS = 1;       // LODs coarser than the primary LOD for rays after a diffuse bounce
+    static constexpr size_t ARENA_ALIGNMENT = 256;          // Buffer binding offsets must stay aligned
     
     std::vector<std::shared_ptr<Material>> materials;
     std::vector<std::shared_ptr<Model>> models;
-    std::vector<int> modelIndices;
+    std::vector<uint32_t> modelIndices;
     std::vector<TriangleAccelerationStructure> childAccStructs;
+    
+    // BLASes from prebuildAccStructs, by model. The weak pointer tells whether the model at the address is still the one
+    //  they were built from.
+    std::unordered_map<const Model*, std::pair<std::weak_ptr<const Model>, std::vector<TriangleAccelerationStructure>>> prebuiltAccStructs;
+    mutable std::mutex prebuiltMutex;
+    
     std::unique_ptr<InstanceAccelerationStructure> instanceAccStruct;
     std::vector<InstanceData> instanceDataVec;
+    std::vector<uint32_t> instanceMaterialIndices;
     std::vector<simd::float4x4> instanceTransforms;
     std::vector<std::shared_ptr<Texture>> textures;
+    std::shared_ptr<TextureTileCache> tileCache;
+    
+    // Models are deduplicated by geometry content hash and materials by value hash. Entries are lists of scene indices
+    //  since different content can share a hash.
+    std::unordered_map<const Model*, std::pair<std::weak_ptr<const Model>, uint32_t>> modelIndexByPtr;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> modelIndicesByHash;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> materialIndicesByHash;
+    size_t duplicateModelCount = 0;
+    size_t duplicateMaterialCount = 0;
+    
+    std::vector<uint32_t> modelVertexOffsets;
+    std::vector<size_t> modelLodBase;  // First entry of each model in the per-LOD arrays and childAccStructs
+    std::vector<uint64_t> lodIndexByteOffsets;
+    std::vector<uint32_t> lodSubmeshOffsets;
+    size_t sceneVertexCount = 0;
+    size_t sceneIndexBytes = 0;
+    size_t sceneSubmeshCount = 0;
+    
+    // IAS entries, one per (object, LOD in use)
+    std::vector<InstanceData> gpuInstances;
+    std::vector<size_t> instanceEntryLods;  // Index into childAccStructs
+    std::vector<simd::float4x4> instanceEntryTransforms;
+    std::vector<uint32_t> instanceEntryMasks;
+    std::vector<size_t> objectFirstEntry;   // Entries of object i are [objectFirstEntry[i], objectFirstEntry[i + 1])
+    
+    // Dirty state since the last build. Models never change after upload and are only appended, so the models with BLASes
+    //  are always a prefix of models.
+    size_t builtModelCount = 0;
+    bool instanceTableDirty = true;  // Instances added or the LOD camera moved, so every entry may change
+    std::vector<uint32_t> dirtyMaterials;
+    std::vector<uint32_t> dirtyInstances;
+    std::vector<uint32_t> dirtyTextures;
+    SceneBuildReport lastBuildReport;
+    
+    bool lodCameraSet = false;
+    simd::float3 lodCameraPos = simd::float3(0);
+    float lodPixelAngle = 0;
     
-    MTL::Buffer* vertexBuffer;
-    MTL::Buffer* indexBuffer;
-    MTL::Buffer* instanceDataBuffer;
-    MTL::Buffer* materialBuffer;
+    MTL::Buffer* arena = nullptr;
+    size_t sectionOffsets[SCENE_SECTION_COUNT] = {};
+    size_t sectionSizes[SCENE_SECTION_COUNT] = {};
+    size_t arenaSizeBytes = 0;
+    size_t arenaModelCount = 0;  // Models whose geometry is in the arena
 };
 
 #endif /* scene_hpp */
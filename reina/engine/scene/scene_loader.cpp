@@ -0,0 +1,534 @@
+#include "scene_loader.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include <unordered_map>
+#include <cmath>
+#include <cassert>
+
+#include <stb/stb_image.h>
+
+#include "json.hpp"
+#include "mapped_file.hpp"
+#include "model.hpp"
+#include "texture.hpp"
+#include "texture_file.hpp"
+#include "orm_packing.hpp"
+#include "texture_atlas.hpp"
+#include "texture_tile_cache.hpp"
+
+namespace {
+
+[[noreturn]] void fail(const std::string& filepath, const std::string& message) {
+    std::cerr << "Scene file: " << filepath << ": " << message << "\n";
+    exit(1);
+}
+
+/// A number is splatted to all three components
+simd::float3 readFloat3(const std::string& filepath, const JsonValue& object, std::string_view key, simd::float3 fallback) {
+    const JsonValue* value = object.find(key);
+    if (!value) {
+        return fallback;
+    }
+    if (value->isNumber()) {
+        return simd::float3(static_cast<float>(value->number));
+    }
+    
+    if (!value->isArray() || value->array.size() != 3
+        || !std::all_of(value->array.begin(), value->array.end(), [](const JsonValue& v) { return v.isNumber(); })) {
+        fail(filepath, "\"" + std::string(key) + "\" must be a number or an array of 3 numbers");
+    }
+    
+    return simd::float3{static_cast<float>(value->array[0].number), static_cast<float>(value->array[1].number), static_cast<float>(value->array[2].number)};
+}
+
+/// Either "matrix" (16 numbers, column-major) or translation * rotation * scale, with "rotation" as XYZ Euler angles in
+/// degrees applied X first
+simd::float4x4 readTransform(const std::string& filepath, const JsonValue& instance) {
+    if (const JsonValue* matrix = instance.find("matrix")) {
+        if (!matrix->isArray() || matrix->array.size() != 16) {
+            fail(filepath, "\"matrix\" must be an array of 16 numbers");
+        }
+        
+        simd::float4x4 result;
+        for (int i = 0; i < 16; i++) {
+            result.columns[i / 4][i % 4] = static_cast<float>(matrix->array[i].number);
+        }
+        return result;
+    }
+    
+    simd::float3 translation = readFloat3(filepath, instance, "translation", simd::float3(0));
+    simd::float3 rotation = readFloat3(filepath, instance, "rotation", simd::float3(0)) * static_cast<float>(M_PI / 180.0);
+    simd::float3 scale = readFloat3(filepath, instance, "scale", simd::float3(1));
+    
+    float cx = std::cos(rotation.x), sx = std::sin(rotation.x);
+    float cy = std::cos(rotation.y), sy = std::sin(rotation.y);
+    float cz = std::cos(rotation.z), sz = std::sin(rotation.z);
+    simd::float4x4 rotX{simd::float4{1, 0, 0, 0}, simd::float4{0, cx, sx, 0}, simd::float4{0, -sx, cx, 0}, simd::float4{0, 0, 0, 1}};
+    simd::float4x4 rotY{simd::float4{cy, 0, -sy, 0}, simd::float4{0, 1, 0, 0}, simd::float4{sy, 0, cy, 0}, simd::float4{0, 0, 0, 1}};
+    simd::float4x4 rotZ{simd::float4{cz, sz, 0, 0}, simd::float4{-sz, cz, 0, 0}, simd::float4{0, 0, 1, 0}, simd::float4{0, 0, 0, 1}};
+    simd::float4x4 scaling{simd::float4{scale.x, 0, 0, 0}, simd::float4{0, scale.y, 0, 0}, simd::float4{0, 0, scale.z, 0}, simd::float4{0, 0, 0, 1}};
+    
+    simd::float4x4 result = rotZ * rotY * rotX * scaling;
+    result.columns[3] = simd::float4{translation.x, translation.y, translation.z, 1};
+    return result;
+}
+
+ModelLoadOptions readModelOptions(const std::string& filepath, const JsonValue& model) {
+    ModelLoadOptions options;
+    options.weldVertices = model.getBool("weldVertices", options.weldVertices);
+    options.weldEpsilon = static_cast<float>(model.getNumber("weldEpsilon", options.weldEpsilon));
+    options.optimizeLocality = model.getBool("optimizeLocality", options.optimizeLocality);
+    options.buildClusters = model.getBool("buildClusters", options.buildClusters);
+    options.clusterMaxVertices = static_cast<uint32_t>(model.getNumber("clusterMaxVertices", options.clusterMaxVertices));
+    options.clusterMaxTriangles = static_cast<uint32_t>(model.getNumber("clusterMaxTriangles", options.clusterMaxTriangles));
+    
+    if (const JsonValue* lodRatios = model.find("lodRatios")) {
+        if (!lodRatios->isArray()) {
+            fail(filepath, "\"lodRatios\" must be an array of numbers");
+        }
+        for (const JsonValue& ratio : lodRatios->array) {
+            options.lodRatios.push_back(static_cast<float>(ratio.number));
+        }
+    }
+    
+    return options;
+}
+
+/// "format" is "srgb" or "linear", and "compression" optionally picks a block-compressed format: "bc1" or "bc7" for color,
+/// "bc4" for single-channel maps, "bc5" for normal maps. Uncompressed linear maps can set "channels" to 1 or 2 to be
+/// stored as R8 or RG8. A .rtex container keeps the format it was converted to.
+MTL::PixelFormat readTextureFormat(const std::string& filepath, const JsonValue& texture) {
+    std::string compression = texture.getString("compression", "none");
+    int channels = static_cast<int>(texture.getNumber("channels", 0));
+    std::optional<MTL::PixelFormat> format = textureFormatFromNames(texture.getString("format", "linear"), compression, channels);
+    if (!format) {
+        fail(filepath, "texture compression \"" + compression + "\" is unknown or doesn't fit the texture's color space or channels");
+    }
+    
+    return *format;
+}
+
+/// An "orm" object with "occlusion", "roughness" and "metalness" paths packs those maps into one texture at load time
+std::optional<OrmSources> readOrmSources(const std::string& filepath, const JsonValue& texture) {
+    const JsonValue* orm = texture.find("orm");
+    if (!orm) {
+        return std::nullopt;
+    }
+    if (!orm->isObject()) {
+        fail(filepath, "texture \"orm\" must be an object");
+    }
+    
+    OrmSources sources{orm->getString("occlusion"), orm->getString("roughness"), orm->getString("metalness")};
+    if (sources.occlusion.empty() && sources.roughness.empty() && sources.metalness.empty()) {
+        fail(filepath, "texture \"orm\" names no occlusion, roughness or metalness map");
+    }
+    return sources;
+}
+
+const JsonValue& requireObject(const std::string& filepath, const JsonValue& parent, std::string_view key, std::string_view what) {
+    const JsonValue* value = parent.find(key);
+    if (!value || !value->isObject()) {
+        fail(filepath, std::string(what) + " \"" + std::string(key) + "\" is missing or not an object");
+    }
+    return *value;
+}
+
+}
+
+SceneFile::SceneFile(const std::string& filepath) : filepath(filepath) {
+    auto start = std::chrono::steady_clock::now();
+    
+    if (!std::filesystem::exists(filepath)) {
+        fail(filepath, "file not found");
+    }
+    
+    JsonValue root;
+    {
+        MappedFile file(filepath);
+        std::string error;
+        if (!parseJson(std::string_view(reinterpret_cast<const char*>(file.data()), file.size()), root, error)) {
+            fail(filepath, error);
+        }
+    }
+    
+    static const JsonValue emptyObject = [] { JsonValue value; value.type = JsonValue::Type::Object; return value; }();
+    const JsonValue& modelDefs = requireObject(filepath, root, "models", "section");
+    const JsonValue& materialDefs = requireObject(filepath, root, "materials", "section");
+    const JsonValue& textureDefs = root.find("textures") ? requireObject(filepath, root, "textures", "section") : emptyObject;
+    const JsonValue* instanceDefs = root.find("instances");
+    if (!instanceDefs || !instanceDefs->isArray()) {
+        fail(filepath, "\"instances\" is missing or not an array");
+    }
+    
+    definedModels = modelDefs.object.size();
+    definedTextures = textureDefs.object.size();
+    definedMaterials = materialDefs.object.size();
+    
+    // Walk the instances to find what is reachable. Models, materials and textures get slots in first-use order, so
+    //  anything defined but never used is neither loaded nor added to the scene.
+    std::unordered_map<std::string, size_t> modelSlots, materialSlots, textureSlots, textureFiles;
+    std::vector<const JsonValue*> usedModels, usedTextures;
+    
+    auto useTexture = [&](const JsonValue& material, std::string_view key) -> int32_t {
+        std::string name = material.getString(key);
+        if (name.empty()) {
+            return -1;
+        }
+        
+        auto [it, inserted] = textureSlots.try_emplace(name, usedTextures.size());
+        if (inserted) {
+            const JsonValue* def = textureDefs.find(name);
+            if (!def || !def->isObject()) {
+                fail(filepath, "unknown texture \"" + name + "\"");
+            }
+            
+            // Names for the same files in the same format share one slot, so the files are read and decoded once
+            auto canonical = [](const std::string& path) {
+                std::error_code error;
+                std::filesystem::path resolved = std::filesystem::weakly_canonical(path, error);
+                return error ? path : resolved.string();
+            };
+            std::string fileKey = canonical(def->getString("path"));
+            if (const JsonValue* orm = def->find("orm"); orm && orm->isObject()) {
+                fileKey = "orm|" + canonical(orm->getString("occlusion")) + "|" + canonical(orm->getString("roughness")) + "|" + canonical(orm->getString("metalness"));
+            }
+            fileKey += "|" + def->getString("format", "linear") + "|" + def->getString("compression", "none") + "|" + std::to_string(def->getNumber("channels", 0))
+                    + (def->getBool("atlas", false) ? "|atlas" : "");
+            auto [file, newFile] = textureFiles.try_emplace(fileKey, usedTextures.size());
+            it->second = file->second;
+            if (newFile) {
+                usedTextures.push_back(def);
+            }
+        }
+        return static_cast<int32_t>(it->second);
+    };
+    
+    auto useMaterial = [&](const std::string& name) -> size_t {
+        auto [it, inserted] = materialSlots.try_emplace(name, materials.size());
+        if (!inserted) {
+            return it->second;
+        }
+        
+        const JsonValue* def = materialDefs.find(name);
+        if (!def || !def->isObject()) {
+            fail(filepath, "unknown material \"" + name + "\"");
+        }
+        
+        std::string type = def->getString("type", "diffuse");
+        if (type != "diffuse" && type != "metal") {
+            fail(filepath, "material \"" + name + "\" has unknown type \"" + type + "\"");
+        }
+        
+        Material material{};
+        material.materialID = type == "diffuse" ? 0 : 1;
+        material.textureID = useTexture(*def, "texture");
+        material.normalMapID = useTexture(*def, "normalMap");
+        material.roughnessMapID = useTexture(*def, "roughnessMap");
+        material.metalnessMapID = useTexture(*def, "metalnessMap");
+        material.occlusionMapID = useTexture(*def, "occlusionMap");
+        
+        // A packed ORM texture stands in for all three maps, each value read from its own channel
+        if (int32_t orm = useTexture(*def, "ormMap"); orm >= 0) {
+            if (material.roughnessMapID >= 0 || material.metalnessMapID >= 0 || material.occlusionMapID >= 0) {
+                fail(filepath, "material \"" + name + "\" has both an \"ormMap\" and separate roughness, metalness or occlusion maps");
+            }
+            material.roughnessMapID = material.metalnessMapID = material.occlusionMapID = orm;
+            material.roughnessChannel = ORM_ROUGHNESS_CHANNEL;
+            material.metalnessChannel = ORM_METALNESS_CHANNEL;
+            material.occlusionChannel = ORM_OCCLUSION_CHANNEL;
+        }
+        material.color = readFloat3(filepath, *def, "color", simd::float3(1));
+        material.emission = readFloat3(filepath, *def, "emission", simd::float3(0));
+        material.roughness = static_cast<float>(def->getNumber("roughness", 0));
+        material.textureRect = material.normalMapRect = material.roughnessMapRect = material.metalnessMapRect = material.occlusionMapRect = simd::float4{1, 1, 0, 0};
+        materials.push_back(std::make_shared<Material>(material));
+        
+        return it->second;
+    };
+    
+    instances.reserve(instanceDefs->array.size());
+    for (const JsonValue& instance : instanceDefs->array) {
+        std::string modelName = instance.getString("model");
+        auto [it, inserted] = modelSlots.try_emplace(modelName, usedModels.size());
+        if (inserted) {
+            const JsonValue* def = modelDefs.find(modelName);
+            if (!def || !def->isObject()) {
+                fail(filepath, "unknown model \"" + modelName + "\"");
+            }
+            usedModels.push_back(def);
+        }
+        
+        InstanceDef instanceDef{it->second, {}, readTransform(filepath, instance)};
+        if (const JsonValue* slotMaterials = instance.find("materials"); slotMaterials && slotMaterials->isArray()) {
+            for (const JsonValue& material : slotMaterials->array) {
+                instanceDef.materials.push_back(useMaterial(material.string));
+            }
+        } else {
+            instanceDef.materials.push_back(useMaterial(instance.getString("material")));
+        }
+        if (instanceDef.materials.empty()) {
+            fail(filepath, "instance of \"" + modelName + "\" has no material");
+        }
+        
+        instances.push_back(std::move(instanceDef));
+    }
+    
+    if (const JsonValue* cameraDef = root.find("camera"); cameraDef && cameraDef->isObject()) {
+        camera.position = readFloat3(filepath, *cameraDef, "position", camera.position);
+        camera.target = readFloat3(filepath, *cameraDef, "target", camera.target);
+        camera.up = readFloat3(filepath, *cameraDef, "up", camera.up);
+        camera.fovy = static_cast<float>(cameraDef->getNumber("fovy", camera.fovy));
+    }
+    
+    // Check every file now, so a missing asset fails before anything has loaded
+    for (size_t i = 0; i < usedModels.size(); i++) {
+        assets.push_back({true, i, usedModels[i]->getString("path"), 0});
+        modelOptions.push_back(readModelOptions(filepath, *usedModels[i]));
+    }
+    if (const JsonValue* budget = root.find("textureBudgetMB")) {
+        if (!budget->isNumber() || budget->number <= 0) {
+            fail(filepath, "\"textureBudgetMB\" must be a positive number");
+        }
+        tileCache = std::make_shared<TextureTileCache>(static_cast<size_t>(budget->number * 1024 * 1024));
+    }
+    if (const JsonValue* pageSize = root.find("atlasPageSize")) {
+        if (!pageSize->isNumber() || pageSize->number < 1 || pageSize->number > 16384) {
+            fail(filepath, "\"atlasPageSize\" must be a number from 1 to 16384");
+        }
+        atlasPageSize = static_cast<int>(pageSize->number);
+    }
+    for (size_t i = 0; i < usedTextures.size(); i++) {
+        std::optional<OrmSources> orm = readOrmSources(filepath, *usedTextures[i]);
+        MTL::PixelFormat format = readTextureFormat(filepath, *usedTextures[i]);
+        if (orm && (decodeChannelsOf(format) != 4 || format == MTL::PixelFormatBC4_RUnorm || format == MTL::PixelFormatBC5_RGUnorm)) {
+            fail(filepath, "a packed \"orm\" texture needs a format with at least three channels");
+        }
+        
+        std::string path = usedTextures[i]->getString("path");
+        if (orm) {
+            path = !orm->roughness.empty() ? orm->roughness : !orm->occlusion.empty() ? orm->occlusion : orm->metalness;
+        }
+        bool atlased = usedTextures[i]->getBool("atlas", false);
+        if (atlased && path.ends_with(".rtex")) {
+            fail(filepath, "texture \"" + path + "\" is a .rtex container, which can't be packed into an atlas");
+        }
+        assets.push_back({false, i, path, 0});
+        textureFormats.push_back(format);
+        textureOrm.push_back(std::move(orm));
+        textureAtlased.push_back(atlased);
+    }
+    for (Asset& asset : assets) {
+        std::vector<std::string> paths = {asset.path};
+        if (!asset.isModel && textureOrm[asset.index]) {
+            const OrmSources& orm = *textureOrm[asset.index];
+            paths.clear();
+            for (const std::string* source : {&orm.occlusion, &orm.roughness, &orm.metalness}) {
+                if (!source->empty()) {
+                    paths.push_back(*source);
+                }
+            }
+        }
+        
+        for (const std::string& path : paths) {
+            std::error_code error;
+            asset.bytes += std::filesystem::file_size(path, error);
+            if (error) {
+                fail(filepath, "cannot open " + std::string(asset.isModel ? "model" : "texture") + " \"" + path + "\"");
+            }
+        }
+    }
+    std::stable_sort(assets.begin(), assets.end(), [](const Asset& a, const Asset& b) { return a.bytes > b.bytes; });
+    
+    // Reads for every file are queued now, largest first, and overlap with device and window setup. GLB and PLY models
+    //  and .rtex textures are memory-mapped by their loaders and packed ORM textures decode their own maps, so they are
+    //  left out.
+    std::vector<std::string> readPaths;
+    for (const Asset& asset : assets) {
+        bool mapped = asset.isModel ? asset.path.ends_with(".glb") || asset.path.ends_with(".ply") : asset.path.ends_with(".rtex") || textureOrm[asset.index];
+        readIndices.push_back(mapped ? SIZE_MAX : readPaths.size());
+        if (!mapped) {
+            readPaths.push_back(asset.path);
+        }
+    }
+    reader = std::make_unique<BatchFileReader>(readPaths);
+    
+    models.resize(usedModels.size());
+    textures.resize(usedTextures.size());
+    atlasSources.resize(usedTextures.size());
+    
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Scene file " << filepath << " (" << elapsed.count() * 1000 << " ms): " << usedModels.size() << "/" << definedModels << " models, "
+              << usedTextures.size() << "/" << definedTextures << " textures, " << materials.size() << "/" << definedMaterials << " materials, "
+              << instances.size() << " instances\n";
+}
+
+const std::vector<SceneFile::Asset>& SceneFile::getAssets() const {
+    return assets;
+}
+
+void SceneFile::loadAsset(size_t asset, MTL::Device* device, MTL::CommandQueue* cmdQueue) {
+    // Each asset writes only its own slot, and Metal devices and command queues are safe to use from several threads
+    const Asset& a = assets[asset];
+    std::span<const uint8_t> contents;
+    if (readIndices[asset] != SIZE_MAX) {
+        contents = reader->wait(readIndices[asset]);
+    }
+    
+    if (a.isModel) {
+        models[a.index] = std::make_shared<Model>(device, cmdQueue, a.path, contents, modelOptions[a.index]);
+    } else if (textureAtlased[a.index]) {
+        // Atlas entries stay on the CPU until packAtlases can place them all
+        AtlasSource& source = atlasSources[a.index];
+        if (textureOrm[a.index]) {
+            source.pixels = packOrm(*textureOrm[a.index], source.width, source.height);
+        } else {
+            const int channels = decodeChannelsOf(textureFormats[a.index]);
+            int fileChannels;
+            stbi_set_flip_vertically_on_load_thread(true);
+            unsigned char* image = stbi_load_from_memory(contents.data(), static_cast<int>(contents.size()), &source.width, &source.height, &fileChannels, channels);
+            if (!image) {
+                fail(filepath, "cannot decode texture \"" + a.path + "\": " + stbi_failure_reason());
+            }
+            source.pixels.assign(image, image + static_cast<size_t>(source.width) * source.height * channels);
+            stbi_image_free(image);
+        }
+    } else if (textureOrm[a.index]) {
+        int width, height;
+        std::vector<uint8_t> packed = packOrm(*textureOrm[a.index], width, height);
+        textures[a.index] = std::make_shared<Texture>(packed.data(), width, height, device, cmdQueue, MTL::TextureUsageShaderRead, textureFormats[a.index]);
+    } else if (a.path.ends_with(".rtex") && tileCache) {
+        textures[a.index] = tileCache->add(a.path, device, cmdQueue);
+    } else if (a.path.ends_with(".rtex")) {
+        textures[a.index] = std::make_shared<Texture>(a.path, device, cmdQueue, MTL::TextureUsageShaderRead);
+    } else {
+        textures[a.index] = textureManager.load(a.path, contents, device, cmdQueue, textureFormats[a.index]);
+    }
+    
+    if (readIndices[asset] != SIZE_MAX) {
+        reader->release(readIndices[asset]);
+    }
+}
+
+void SceneFile::packAtlases(MTL::Device* device, MTL::CommandQueue* cmdQueue) {
+    if (std::find(textureAtlased.begin(), textureAtlased.end(), true) == textureAtlased.end()) {
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    
+    // Textures of their own keep their order and the atlas pages follow them, each format packed into pages of its own
+    std::vector<std::shared_ptr<Texture>> slotTextures;
+    std::vector<int32_t> slots(textures.size());
+    std::vector<simd::float4> rects(textures.size(), simd::float4{1, 1, 0, 0});
+    std::vector<MTL::PixelFormat> formats;
+    for (size_t i = 0; i < textures.size(); i++) {
+        if (!textureAtlased[i]) {
+            slots[i] = static_cast<int32_t>(slotTextures.size());
+            slotTextures.push_back(textures[i]);
+        } else if (std::find(formats.begin(), formats.end(), textureFormats[i]) == formats.end()) {
+            formats.push_back(textureFormats[i]);
+        }
+    }
+    
+    size_t entryCount = 0, pageCount = 0, pageTexels = 0, imageTexels = 0;
+    for (MTL::PixelFormat format : formats) {
+        std::vector<size_t> entries;
+        std::vector<AtlasImage> images;
+        for (size_t i = 0; i < textures.size(); i++) {
+            if (textureAtlased[i] && textureFormats[i] == format) {
+                assert(!atlasSources[i].pixels.empty());
+                entries.push_back(i);
+                images.push_back({atlasSources[i].pixels.data(), atlasSources[i].width, atlasSources[i].height});
+            }
+        }
+        
+        TextureAtlas atlas = packAtlas(images, decodeChannelsOf(format), atlasPageSize);
+        const size_t firstSlot = slotTextures.size();
+        for (const AtlasPage& page : atlas.pages) {
+            slotTextures.push_back(std::make_shared<Texture>(page.pixels.data(), page.width, page.height, device, cmdQueue, MTL::TextureUsageShaderRead, format));
+            pageTexels += static_cast<size_t>(page.width) * page.height;
+        }
+        for (size_t j = 0; j < entries.size(); j++) {
+            slots[entries[j]] = static_cast<int32_t>(firstSlot + atlas.placements[j].page);
+            rects[entries[j]] = atlas.placements[j].uvRect;
+            atlasSources[entries[j]] = {};
+        }
+        
+        entryCount += entries.size();
+        pageCount += atlas.pages.size();
+        imageTexels += atlas.imageTexels;
+    }
+    
+    // Materials were written against the file's texture slots, so each map now points at its own texture or its page
+    for (const std::shared_ptr<Material>& material : materials) {
+        auto remap = [&](int32_t& id, simd::float4& rect) {
+            if (id >= 0) {
+                rect = rects[id];
+                id = slots[id];
+            }
+        };
+        remap(material->textureID, material->textureRect);
+        remap(material->normalMapID, material->normalMapRect);
+        remap(material->roughnessMapID, material->roughnessMapRect);
+        remap(material->metalnessMapID, material->metalnessMapRect);
+        remap(material->occlusionMapID, material->occlusionMapRect);
+    }
+    textures = std::move(slotTextures);
+    
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Texture atlases (" << elapsed.count() * 1000 << " ms): " << entryCount << " textures in " << pageCount << " pages, "
+              << 100.0 * imageTexels / std::max<size_t>(pageTexels, 1) << "% of their texels used, " << textures.size() << "/" << NUM_TEXTURES << " texture slots\n";
+}
+
+const std::shared_ptr<Model>& SceneFile::getModel(size_t model) const {
+    return models[model];
+}
+
+const TextureManager& SceneFile::getTextureManager() const {
+    return textureManager;
+}
+
+void SceneFile::populate(Scene& scene, SceneCamera& outCamera) const {
+    for (const auto& texture : textures) {
+        assert(texture);
+        scene.addTexture(texture);
+    }
+    if (tileCache) {
+        scene.setTileCache(tileCache);
+    }
+    
+    // Models and materials get their scene ids the first time an instance uses them, then every instance is added at once
+    std::vector<uint32_t> modelIds(models.size(), UINT32_MAX);
+    std::vector<uint32_t> materialIds(materials.size(), UINT32_MAX);
+    std::vector<uint32_t> instanceModels;
+    std::vector<uint32_t> instanceMaterialOffsets{0};
+    std::vector<uint32_t> instanceMaterials;
+    std::vector<simd::float4x4> instanceTransforms;
+    instanceModels.reserve(instances.size());
+    instanceMaterialOffsets.reserve(instances.size() + 1);
+    instanceTransforms.reserve(instances.size());
+    
+    for (const InstanceDef& instance : instances) {
+        assert(models[instance.model]);
+        if (modelIds[instance.model] == UINT32_MAX) {
+            modelIds[instance.model] = scene.addModel(models[instance.model]);
+        }
+        for (size_t material : instance.materials) {
+            if (materialIds[material] == UINT32_MAX) {
+                materialIds[material] = scene.addMaterial(materials[material]);
+            }
+            instanceMaterials.push_back(materialIds[material]);
+        }
+        
+        instanceModels.push_back(modelIds[instance.model]);
+        instanceMaterialOffsets.push_back(static_cast<uint32_t>(instanceMaterials.size()));
+        instanceTransforms.push_back(instance.transform);
+    }
+    scene.addInstances(instanceModels, instanceMaterialOffsets, instanceMaterials, instanceTransforms);
+    
+    outCamera = camera;
+}
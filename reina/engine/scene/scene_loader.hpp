@@ -0,0 +1,99 @@
+#ifndef scene_loader_hpp
+#define scene_loader_hpp
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <cstdint>
+#include <simd/simd.h>
+#include <Metal/Metal.hpp>
+
+#include "scene.hpp"
+#include "batch_reader.hpp"
+#include "texture_manager.hpp"
+#include "orm_packing.hpp"
+
+/// Camera described by a scene file
+struct SceneCamera {
+    simd::float3 position = simd::float3{0, 0, -5};
+    simd::float3 target = simd::float3{0, 0, 0};
+    simd::float3 up = simd::float3{0, 1, 0};
+    float fovy = 1.57f / 3.0f;
+};
+
+/// A JSON scene file with "models", "textures" and "materials" objects keyed by name, an "instances" array and an
+/// optional "camera". A top-level "textureBudgetMB" streams .rtex textures, which must then be tiled, through a
+/// TextureTileCache of that many megabytes, so only the tiles the renderer samples are resident. Textures with "atlas":
+/// true are packed with the others of their format into shared pages of up to "atlasPageSize" (4096) texels square, so
+/// a scene can use many more small textures than there are texture slots. Construction parses the file and resolves
+/// what the instances reach, so models and textures nothing uses cost nothing, and starts reading the referenced files
+/// as one batch. Texture names for the same file and format share one texture, as do byte-identical image files. The
+/// assets are then decoded by index, from any thread, packAtlases() packs the atlas textures and populate() fills the
+/// scene. Exits on a malformed file or a missing asset.
+class SceneFile {
+public:
+    struct Asset {
+        bool isModel;
+        size_t index;  // Into the file's used models or textures
+        std::string path;
+        uintmax_t bytes;
+    };
+    
+    explicit SceneFile(const std::string& filepath);
+    
+    /// Referenced models and textures, largest file first so the longest load can start first
+    [[nodiscard]] const std::vector<Asset>& getAssets() const;
+    
+    /// Waits for one asset's file to be read, then decodes and uploads it. Different assets can load concurrently.
+    void loadAsset(size_t asset, MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    
+    /// Packs the textures marked "atlas" into their pages and points the materials using them at their place there. Runs
+    /// once every texture has loaded and before populate().
+    void packAtlases(MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    
+    /// A loaded model, by Asset::index
+    [[nodiscard]] const std::shared_ptr<Model>& getModel(size_t model) const;
+    
+    /// Adds the textures, materials and instances to scene and reads the camera. Every asset must be loaded.
+    void populate(Scene& scene, SceneCamera& camera) const;
+    
+    [[nodiscard]] const TextureManager& getTextureManager() const;
+
+private:
+    /// An atlas texture's image, decoded to its format's channels and held until it is packed
+    struct AtlasSource {
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+    };
+    
+    struct InstanceDef {
+        size_t model;
+        std::vector<size_t> materials;
+        simd::float4x4 transform;
+    };
+    
+    std::string filepath;
+    std::vector<Asset> assets;
+    std::unique_ptr<BatchFileReader> reader;
+    std::vector<size_t> readIndices;  // Per asset, its file in reader or SIZE_MAX for formats that are memory-mapped
+    std::vector<ModelLoadOptions> modelOptions;
+    std::shared_ptr<TextureTileCache> tileCache;  // Set by "textureBudgetMB"
+    TextureManager textureManager;
+    std::vector<MTL::PixelFormat> textureFormats;
+    std::vector<std::optional<OrmSources>> textureOrm;  // Per texture, the maps it packs, if it is a packed ORM texture
+    std::vector<bool> textureAtlased;
+    std::vector<AtlasSource> atlasSources;
+    int atlasPageSize = 4096;
+    std::vector<std::shared_ptr<Model>> models;
+    std::vector<std::shared_ptr<Texture>> textures;
+    std::vector<std::shared_ptr<Material>> materials;
+    std::vector<InstanceDef> instances;
+    SceneCamera camera;
+    size_t definedModels = 0;
+    size_t definedTextures = 0;
+    size_t definedMaterials = 0;
+};
+
+#endif /* scene_loader_hpp */
@@ -0,0 +1,558 @@
+#include "block_compression.hpp"
+
+#include <simd/simd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "parallel.hpp"
+
+namespace {
+
+/// Interpolation weights out of 64 for BC7's 4-bit indices
+constexpr int BC7_WEIGHTS_4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+/// Number of channels, from red onwards, that each format stores
+int storedChannels(BlockFormat format) {
+    switch (format) {
+        case BlockFormat::BC1: return 3;
+        case BlockFormat::BC4: return 1;
+        case BlockFormat::BC5: return 2;
+        case BlockFormat::BC7: return 4;
+    }
+    return 4;
+}
+
+void loadBlock(const uint8_t* rgba, int width, int height, int blockX, int blockY, simd::float4 pixels[16]) {
+    for (int y = 0; y < 4; y++) {
+        int py = std::min(blockY * 4 + y, height - 1);
+        for (int x = 0; x < 4; x++) {
+            int px = std::min(blockX * 4 + x, width - 1);
+            const uint8_t* p = rgba + (static_cast<size_t>(py) * width + px) * 4;
+            pixels[y * 4 + x] = simd::float4{static_cast<float>(p[0]), static_cast<float>(p[1]), static_cast<float>(p[2]), static_cast<float>(p[3])};
+        }
+    }
+}
+
+void storeBlock(uint8_t* rgba, int width, int height, int blockX, int blockY, const uint8_t texels[16][4]) {
+    for (int y = 0; y < 4 && blockY * 4 + y < height; y++) {
+        for (int x = 0; x < 4 && blockX * 4 + x < width; x++) {
+            std::memcpy(rgba + (static_cast<size_t>(blockY * 4 + y) * width + blockX * 4 + x) * 4, texels[y * 4 + x], 4);
+        }
+    }
+}
+
+float squaredError(simd::float4 a, simd::float4 b, simd::float4 channelMask) {
+    simd::float4 d = (a - b) * channelMask;
+    return simd::dot(d, d);
+}
+
+/// Direction of greatest variance of the block around its mean, by power iteration on the covariance
+simd::float4 principalAxis(const simd::float4 pixels[16], simd::float4 mean, simd::float4 channelMask) {
+    float cov[4][4] = {};
+    simd::float4 lo = pixels[0];
+    simd::float4 hi = pixels[0];
+    for (int i = 0; i < 16; i++) {
+        simd::float4 d = (pixels[i] - mean) * channelMask;
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                cov[r][c] += d[r] * d[c];
+            }
+        }
+        lo = simd::min(lo, pixels[i]);
+        hi = simd::max(hi, pixels[i]);
+    }
+    
+    simd::float4 axis = (hi - lo) * channelMask;
+    if (simd::dot(axis, axis) < 1e-6f) {
+        return channelMask;
+    }
+    
+    for (int iteration = 0; iteration < 8; iteration++) {
+        simd::float4 next = simd::float4(0);
+        for (int r = 0; r < 4; r++) {
+            next[r] = cov[r][0] * axis[0] + cov[r][1] * axis[1] + cov[r][2] * axis[2] + cov[r][3] * axis[3];
+        }
+        float length = std::sqrt(simd::dot(next, next));
+        if (length < 1e-6f) {
+            break;
+        }
+        axis = next / length;
+    }
+    
+    return axis;
+}
+
+/// Endpoints on the principal axis at the extremes of the block's projections onto it
+void axisEndpoints(const simd::float4 pixels[16], simd::float4 channelMask, simd::float4& e0, simd::float4& e1) {
+    simd::float4 mean = simd::float4(0);
+    for (int i = 0; i < 16; i++) {
+        mean += pixels[i];
+    }
+    mean = mean / 16.0f * channelMask;
+    
+    simd::float4 axis = principalAxis(pixels, mean, channelMask);
+    float tMin = std::numeric_limits<float>::max();
+    float tMax = std::numeric_limits<float>::lowest();
+    for (int i = 0; i < 16; i++) {
+        float t = simd::dot((pixels[i] - mean) * channelMask, axis);
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    
+    e0 = simd::clamp(mean + axis * tMax, simd::float4(0), simd::float4(255));
+    e1 = simd::clamp(mean + axis * tMin, simd::float4(0), simd::float4(255));
+}
+
+/// Least squares endpoints for fixed per-pixel weights of e1 (e0 gets 1 - weight). Returns false if the weights can't
+/// separate two endpoints, e.g. when every pixel uses the same index.
+bool refineEndpoints(const simd::float4 pixels[16], const float weights[16], simd::float4& e0, simd::float4& e1) {
+    float aa = 0, ab = 0, bb = 0;
+    simd::float4 ax = simd::float4(0);
+    simd::float4 bx = simd::float4(0);
+    for (int i = 0; i < 16; i++) {
+        float a = 1.0f - weights[i];
+        float b = weights[i];
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        ax += a * pixels[i];
+        bx += b * pixels[i];
+    }
+    
+    float det = aa * bb - ab * ab;
+    if (std::abs(det) < 1e-6f) {
+        return false;
+    }
+    
+    e0 = simd::clamp((ax * bb - bx * ab) / det, simd::float4(0), simd::float4(255));
+    e1 = simd::clamp((bx * aa - ax * ab) / det, simd::float4(0), simd::float4(255));
+    return true;
+}
+
+/// Little-endian bit packing, as BC7 lays out its fields
+struct BitWriter {
+    uint8_t* out;
+    int position = 0;
+    
+    void write(uint32_t value, int bits) {
+        for (int i = 0; i < bits; i++, position++) {
+            out[position / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (position % 8));
+        }
+    }
+};
+
+struct BitReader {
+    const uint8_t* in;
+    int position = 0;
+    
+    uint32_t read(int bits) {
+        uint32_t value = 0;
+        for (int i = 0; i < bits; i++, position++) {
+            value |= static_cast<uint32_t>((in[position / 8] >> (position % 8)) & 1) << i;
+        }
+        return value;
+    }
+};
+
+// BC1
+
+uint16_t packRgb565(simd::float4 c) {
+    uint32_t r = static_cast<uint32_t>(std::lround(c.x * 31.0f / 255.0f));
+    uint32_t g = static_cast<uint32_t>(std::lround(c.y * 63.0f / 255.0f));
+    uint32_t b = static_cast<uint32_t>(std::lround(c.z * 31.0f / 255.0f));
+    return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+simd::float4 unpackRgb565(uint16_t c) {
+    // Bit replication, as the hardware expands 5 and 6 bits to 8
+    uint32_t r = (c >> 11) & 31;
+    uint32_t g = (c >> 5) & 63;
+    uint32_t b = c & 31;
+    return simd::float4{static_cast<float>((r << 3) | (r >> 2)), static_cast<float>((g << 2) | (g >> 4)), static_cast<float>((b << 3) | (b >> 2)), 255.0f};
+}
+
+void bc1Palette(uint16_t c0, uint16_t c1, simd::float4 palette[4]) {
+    palette[0] = unpackRgb565(c0);
+    palette[1] = unpackRgb565(c1);
+    if (c0 > c1) {
+        palette[2] = simd::float4{std::floor((2 * palette[0].x + palette[1].x) / 3), std::floor((2 * palette[0].y + palette[1].y) / 3), std::floor((2 * palette[0].z + palette[1].z) / 3), 255.0f};
+        palette[3] = simd::float4{std::floor((palette[0].x + 2 * palette[1].x) / 3), std::floor((palette[0].y + 2 * palette[1].y) / 3), std::floor((palette[0].z + 2 * palette[1].z) / 3), 255.0f};
+    } else {
+        palette[2] = simd::float4{std::floor((palette[0].x + palette[1].x) / 2), std::floor((palette[0].y + palette[1].y) / 2), std::floor((palette[0].z + palette[1].z) / 2), 255.0f};
+        palette[3] = simd::float4{0, 0, 0, 0};
+    }
+}
+
+/// Picks every pixel's nearest palette entry and returns the total error
+float bc1Indices(const simd::float4 pixels[16], uint16_t c0, uint16_t c1, uint8_t indices[16]) {
+    const simd::float4 rgb = {1, 1, 1, 0};
+    simd::float4 palette[4];
+    bc1Palette(c0, c1, palette);
+    
+    float total = 0;
+    for (int i = 0; i < 16; i++) {
+        float best = std::numeric_limits<float>::max();
+        for (uint8_t p = 0; p < 4; p++) {
+            float error = squaredError(pixels[i], palette[p], rgb);
+            if (error < best) {
+                best = error;
+                indices[i] = p;
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+void encodeBc1Block(const simd::float4 pixels[16], uint8_t* out) {
+    const simd::float4 rgb = {1, 1, 1, 0};
+    simd::float4 e0, e1;
+    axisEndpoints(pixels, rgb, e0, e1);
+    
+    // Only the four-color mode is used, which needs c0 > c1, so endpoints are ordered before the indices are chosen
+    auto order = [](uint16_t& c0, uint16_t& c1) {
+        if (c0 < c1) {
+            std::swap(c0, c1);
+        }
+    };
+    
+    uint16_t c0 = packRgb565(e0);
+    uint16_t c1 = packRgb565(e1);
+    order(c0, c1);
+    
+    uint8_t indices[16];
+    float error = bc1Indices(pixels, c0, c1, indices);
+    
+    // Refine the endpoints for the chosen indices and keep them if they do better
+    constexpr float BC1_WEIGHTS[4] = {0, 1, 1.0f / 3, 2.0f / 3};
+    float weights[16];
+    for (int i = 0; i < 16; i++) {
+        weights[i] = BC1_WEIGHTS[indices[i]];
+    }
+    if (c0 != c1 && refineEndpoints(pixels, weights, e0, e1)) {
+        uint16_t r0 = packRgb565(e0);
+        uint16_t r1 = packRgb565(e1);
+        order(r0, r1);
+        
+        uint8_t refined[16];
+        if (r0 != r1 && bc1Indices(pixels, r0, r1, refined) < error) {
+            c0 = r0;
+            c1 = r1;
+            std::memcpy(indices, refined, 16);
+        }
+    }
+    
+    // Equal endpoints would select the three-color mode, but every pixel then uses index 0 anyway
+    if (c0 == c1) {
+        std::memset(indices, 0, 16);
+    }
+    
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++) {
+        bits |= static_cast<uint32_t>(indices[i]) << (2 * i);
+    }
+    std::memcpy(out, &c0, 2);
+    std::memcpy(out + 2, &c1, 2);
+    std::memcpy(out + 4, &bits, 4);
+}
+
+void decodeBc1Block(const uint8_t* in, uint8_t texels[16][4]) {
+    uint16_t c0, c1;
+    uint32_t bits;
+    std::memcpy(&c0, in, 2);
+    std::memcpy(&c1, in + 2, 2);
+    std::memcpy(&bits, in + 4, 4);
+    
+    simd::float4 palette[4];
+    bc1Palette(c0, c1, palette);
+    for (int i = 0; i < 16; i++) {
+        simd::float4 c = palette[(bits >> (2 * i)) & 3];
+        texels[i][0] = static_cast<uint8_t>(c.x);
+        texels[i][1] = static_cast<uint8_t>(c.y);
+        texels[i][2] = static_cast<uint8_t>(c.z);
+        texels[i][3] = static_cast<uint8_t>(c.w);
+    }
+}
+
+// BC4
+
+void bc4Palette(uint8_t a0, uint8_t a1, int palette[8]) {
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int k = 2; k < 8; k++) {
+            palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+        }
+    } else {
+        for (int k = 2; k < 6; k++) {
+            palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+void encodeBc4Block(const simd::float4 pixels[16], int channel, uint8_t* out) {
+    float lo = 255, hi = 0;
+    for (int i = 0; i < 16; i++) {
+        lo = std::min(lo, pixels[i][channel]);
+        hi = std::max(hi, pixels[i][channel]);
+    }
+    
+    // The eight-value mode (a0 > a1) spreads its six interpolated values over the block's whole range
+    uint8_t a0 = static_cast<uint8_t>(hi);
+    uint8_t a1 = static_cast<uint8_t>(lo);
+    int palette[8];
+    bc4Palette(a0, a1, palette);
+    
+    uint64_t bits = 0;
+    if (a0 != a1) {
+        for (int i = 0; i < 16; i++) {
+            int value = static_cast<int>(pixels[i][channel]);
+            int best = 0;
+            for (int k = 1; k < 8; k++) {
+                if (std::abs(palette[k] - value) < std::abs(palette[best] - value)) {
+                    best = k;
+                }
+            }
+            bits |= static_cast<uint64_t>(best) << (3 * i);
+        }
+    }
+    
+    out[0] = a0;
+    out[1] = a1;
+    for (int i = 0; i < 6; i++) {
+        out[2 + i] = static_cast<uint8_t>(bits >> (8 * i));
+    }
+}
+
+void decodeBc4Block(const uint8_t* in, int channel, uint8_t texels[16][4]) {
+    int palette[8];
+    bc4Palette(in[0], in[1], palette);
+    
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++) {
+        bits |= static_cast<uint64_t>(in[2 + i]) << (8 * i);
+    }
+    for (int i = 0; i < 16; i++) {
+        texels[i][channel] = static_cast<uint8_t>(palette[(bits >> (3 * i)) & 7]);
+    }
+}
+
+// BC7 mode 6
+
+/// Quantizes an endpoint to 7 bits per channel plus a shared p-bit, choosing the p-bit that lands closest
+void quantizeBc7Endpoint(simd::float4 e, uint8_t quantized[4], uint8_t& pBit) {
+    float bestError = std::numeric_limits<float>::max();
+    for (uint8_t p = 0; p < 2; p++) {
+        uint8_t q[4];
+        float error = 0;
+        for (int c = 0; c < 4; c++) {
+            int value = static_cast<int>(std::lround((e[c] - p) / 2.0f));
+            q[c] = static_cast<uint8_t>(std::clamp(value, 0, 127));
+            float d = static_cast<float>((q[c] << 1) | p) - e[c];
+            error += d * d;
+        }
+        if (error < bestError) {
+            bestError = error;
+            pBit = p;
+            std::memcpy(quantized, q, 4);
+        }
+    }
+}
+
+void bc7Palette(const uint8_t q0[4], uint8_t p0, const uint8_t q1[4], uint8_t p1, simd::float4 palette[16]) {
+    for (int k = 0; k < 16; k++) {
+        for (int c = 0; c < 4; c++) {
+            int a = (q0[c] << 1) | p0;
+            int b = (q1[c] << 1) | p1;
+            palette[k][c] = static_cast<float>(((64 - BC7_WEIGHTS_4[k]) * a + BC7_WEIGHTS_4[k] * b + 32) >> 6);
+        }
+    }
+}
+
+float bc7Indices(const simd::float4 pixels[16], const simd::float4 palette[16], uint8_t indices[16]) {
+    const simd::float4 rgba = simd::float4(1);
+    float total = 0;
+    for (int i = 0; i < 16; i++) {
+        float best = std::numeric_limits<float>::max();
+        for (uint8_t k = 0; k < 16; k++) {
+            float error = squaredError(pixels[i], palette[k], rgba);
+            if (error < best) {
+                best = error;
+                indices[i] = k;
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+void encodeBc7Block(const simd::float4 pixels[16], uint8_t* out) {
+    simd::float4 e0, e1;
+    axisEndpoints(pixels, simd::float4(1), e0, e1);
+    
+    uint8_t q0[4], q1[4], p0 = 0, p1 = 0;
+    quantizeBc7Endpoint(e0, q0, p0);
+    quantizeBc7Endpoint(e1, q1, p1);
+    
+    simd::float4 palette[16];
+    uint8_t indices[16];
+    bc7Palette(q0, p0, q1, p1, palette);
+    float error = bc7Indices(pixels, palette, indices);
+    
+    float weights[16];
+    for (int i = 0; i < 16; i++) {
+        weights[i] = BC7_WEIGHTS_4[indices[i]] / 64.0f;
+    }
+    if (refineEndpoints(pixels, weights, e0, e1)) {
+        uint8_t r0[4], r1[4], rp0 = 0, rp1 = 0;
+        quantizeBc7Endpoint(e0, r0, rp0);
+        quantizeBc7Endpoint(e1, r1, rp1);
+        
+        simd::float4 refinedPalette[16];
+        uint8_t refined[16];
+        bc7Palette(r0, rp0, r1, rp1, refinedPalette);
+        if (bc7Indices(pixels, refinedPalette, refined) < error) {
+            std::memcpy(q0, r0, 4);
+            std::memcpy(q1, r1, 4);
+            p0 = rp0;
+            p1 = rp1;
+            std::memcpy(indices, refined, 16);
+        }
+    }
+    
+    // The first pixel's index is stored with its top bit implied 0, so swap the endpoints if it is set
+    if (indices[0] & 8) {
+        std::swap_ranges(q0, q0 + 4, q1);
+        std::swap(p0, p1);
+        for (uint8_t& index : indices) {
+            index = 15 - index;
+        }
+    }
+    
+    std::memset(out, 0, 16);
+    BitWriter writer{out};
+    writer.write(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        writer.write(q0[c], 7);
+        writer.write(q1[c], 7);
+    }
+    writer.write(p0, 1);
+    writer.write(p1, 1);
+    writer.write(indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        writer.write(indices[i], 4);
+    }
+}
+
+void decodeBc7Block(const uint8_t* in, uint8_t texels[16][4]) {
+    if ((in[0] & 0x7F) != 0x40) {
+        for (int i = 0; i < 16; i++) {
+            texels[i][0] = 255; texels[i][1] = 0; texels[i][2] = 255; texels[i][3] = 255;
+        }
+        return;
+    }
+    
+    BitReader reader{in, 7};
+    uint8_t q0[4], q1[4];
+    for (int c = 0; c < 4; c++) {
+        q0[c] = static_cast<uint8_t>(reader.read(7));
+        q1[c] = static_cast<uint8_t>(reader.read(7));
+    }
+    uint8_t p0 = static_cast<uint8_t>(reader.read(1));
+    uint8_t p1 = static_cast<uint8_t>(reader.read(1));
+    
+    simd::float4 palette[16];
+    bc7Palette(q0, p0, q1, p1, palette);
+    for (int i = 0; i < 16; i++) {
+        simd::float4 c = palette[reader.read(i == 0 ? 3 : 4)];
+        for (int channel = 0; channel < 4; channel++) {
+            texels[i][channel] = static_cast<uint8_t>(c[channel]);
+        }
+    }
+}
+
+}
+
+size_t blockBytes(BlockFormat format) {
+    return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+size_t blockCompressedSize(BlockFormat format, int width, int height) {
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+std::vector<uint8_t> encodeBlocks(BlockFormat format, const uint8_t* rgba, int width, int height) {
+    const int blocksWide = (width + 3) / 4;
+    const int blocksHigh = (height + 3) / 4;
+    const size_t stride = blockBytes(format);
+    std::vector<uint8_t> blocks(blockCompressedSize(format, width, height));
+    
+    parallelFor(blocksHigh, 4, [&](size_t begin, size_t end) {
+        simd::float4 pixels[16];
+        for (size_t by = begin; by < end; by++) {
+            for (int bx = 0; bx < blocksWide; bx++) {
+                loadBlock(rgba, width, height, bx, static_cast<int>(by), pixels);
+                uint8_t* out = blocks.data() + (by * blocksWide + bx) * stride;
+                
+                switch (format) {
+                    case BlockFormat::BC1: encodeBc1Block(pixels, out); break;
+                    case BlockFormat::BC4: encodeBc4Block(pixels, 0, out); break;
+                    case BlockFormat::BC5: encodeBc4Block(pixels, 0, out); encodeBc4Block(pixels, 1, out + 8); break;
+                    case BlockFormat::BC7: encodeBc7Block(pixels, out); break;
+                }
+            }
+        }
+    });
+    
+    return blocks;
+}
+
+std::vector<uint8_t> decodeBlocks(BlockFormat format, const uint8_t* blocks, int width, int height) {
+    const int blocksWide = (width + 3) / 4;
+    const int blocksHigh = (height + 3) / 4;
+    const size_t stride = blockBytes(format);
+    std::vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4);
+    
+    parallelFor(blocksHigh, 4, [&](size_t begin, size_t end) {
+        uint8_t texels[16][4];
+        for (size_t by = begin; by < end; by++) {
+            for (int bx = 0; bx < blocksWide; bx++) {
+                const uint8_t* in = blocks + (by * blocksWide + bx) * stride;
+                for (int i = 0; i < 16; i++) {
+                    texels[i][0] = 0; texels[i][1] = 0; texels[i][2] = 0; texels[i][3] = 255;
+                }
+                
+                switch (format) {
+                    case BlockFormat::BC1: decodeBc1Block(in, texels); break;
+                    case BlockFormat::BC4: decodeBc4Block(in, 0, texels); break;
+                    case BlockFormat::BC5: decodeBc4Block(in, 0, texels); decodeBc4Block(in + 8, 1, texels); break;
+                    case BlockFormat::BC7: decodeBc7Block(in, texels); break;
+                }
+                storeBlock(rgba.data(), width, height, bx, static_cast<int>(by), texels);
+            }
+        }
+    });
+    
+    return rgba;
+}
+
+double blockPsnr(BlockFormat format, const uint8_t* original, const uint8_t* decoded, int width, int height) {
+    const int channels = storedChannels(format);
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+    
+    double sum = 0;
+    for (size_t i = 0; i < pixelCount; i++) {
+        for (int c = 0; c < channels; c++) {
+            double d = static_cast<double>(original[i * 4 + c]) - decoded[i * 4 + c];
+            sum += d * d;
+        }
+    }
+    
+    double mse = sum / static_cast<double>(pixelCount * channels);
+    return mse == 0 ? std::numeric_limits<double>::infinity() : 10.0 * std::log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,34 @@
+#ifndef block_compression_hpp
+#define block_compression_hpp
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/// Block-compressed formats the encoder writes. Each stores the image as 4x4 pixel blocks of a fixed size.
+enum class BlockFormat {
+    BC1,  // RGB, 8 bytes per block
+    BC4,  // R, 8 bytes per block
+    BC5,  // RG, 16 bytes per block
+    BC7   // RGBA, 16 bytes per block
+};
+
+[[nodiscard]] size_t blockBytes(BlockFormat format);
+
+/// Size of a whole image in the format. Partial blocks at the right and bottom edges count as full blocks.
+[[nodiscard]] size_t blockCompressedSize(BlockFormat format, int width, int height);
+
+/// Encodes an RGBA8 image. BC1 is always opaque, BC4 and BC5 keep the red and red-green channels, and BC7 only uses mode 6
+/// (one subset, 7.7.7.7 endpoints with a p-bit each, 4-bit indices), which suits smooth material textures. Endpoints come
+/// from the block's principal axis and are refined once by least squares. Partial edge blocks repeat the edge pixels,
+/// and block rows are encoded in parallel.
+[[nodiscard]] std::vector<uint8_t> encodeBlocks(BlockFormat format, const uint8_t* rgba, int width, int height);
+
+/// Decodes to RGBA8 the way the GPU samples it: channels the format doesn't store read as 0, or 255 for alpha. Of BC7
+/// only mode 6 is decoded, and blocks in other modes come out magenta.
+[[nodiscard]] std::vector<uint8_t> decodeBlocks(BlockFormat format, const uint8_t* blocks, int width, int height);
+
+/// Peak signal-to-noise ratio in dB between two RGBA8 images, over the channels the format stores
+[[nodiscard]] double blockPsnr(BlockFormat format, const uint8_t* original, const uint8_t* decoded, int width, int height);
+
+#endif /* block_compression_hpp */
@@ -0,0 +1,124 @@
+#include "mipmaps.hpp"
+
+#include <simd/simd.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cassert>
+
+#include "parallel.hpp"
+
+namespace {
+
+float srgbToLinear(float c) {
+    return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+struct SrgbTables {
+    std::array<float, 256> toLinear;
+    std::array<float, 255> thresholds;  // Linear value halfway between consecutive 8-bit codes
+};
+
+const SrgbTables& srgbTables() {
+    static const SrgbTables tables = [] {
+        SrgbTables t;
+        for (int i = 0; i < 256; i++) {
+            t.toLinear[i] = srgbToLinear(i / 255.0f);
+        }
+        for (int i = 0; i < 255; i++) {
+            t.thresholds[i] = 0.5f * (t.toLinear[i] + t.toLinear[i + 1]);
+        }
+        return t;
+    }();
+    return tables;
+}
+
+/// The 8-bit sRGB code whose linear value is nearest, found in the decode table so encoding exactly inverts decoding
+uint8_t linearToSrgb8(float linear, const SrgbTables& tables) {
+    return static_cast<uint8_t>(std::upper_bound(tables.thresholds.begin(), tables.thresholds.end(), linear) - tables.thresholds.begin());
+}
+
+simd::float4 loadPixel(const uint8_t* p, int channels, bool srgb, const SrgbTables& tables) {
+    if (srgb) {
+        return simd::float4{tables.toLinear[p[0]], tables.toLinear[p[1]], tables.toLinear[p[2]], p[3] / 255.0f};
+    }
+    
+    // Channels the image doesn't have stay 0 and are never stored
+    simd::float4 c = simd::float4(0);
+    for (int i = 0; i < channels; i++) {
+        c[i] = p[i] / 255.0f;
+    }
+    return c;
+}
+
+void storePixel(uint8_t* p, simd::float4 c, int channels, bool srgb, const SrgbTables& tables) {
+    if (srgb) {
+        p[0] = linearToSrgb8(c.x, tables);
+        p[1] = linearToSrgb8(c.y, tables);
+        p[2] = linearToSrgb8(c.z, tables);
+        p[3] = static_cast<uint8_t>(c.w * 255.0f + 0.5f);
+        return;
+    }
+    
+    for (int i = 0; i < channels; i++) {
+        p[i] = static_cast<uint8_t>(c[i] * 255.0f + 0.5f);
+    }
+}
+
+}
+
+int mipLevelCount(int width, int height) {
+    int levels = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        levels++;
+    }
+    return levels;
+}
+
+std::vector<MipLevel> generateMipChain(const uint8_t* pixels, int width, int height, int channels, bool srgb) {
+    assert(channels == 1 || channels == 2 || channels == 4);
+    assert(!srgb || channels == 4);
+    const SrgbTables& tables = srgbTables();
+    
+    std::vector<MipLevel> chain;
+    chain.reserve(mipLevelCount(width, height) - 1);
+    
+    const uint8_t* src = pixels;
+    int srcWidth = width;
+    int srcHeight = height;
+    
+    while (srcWidth > 1 || srcHeight > 1) {
+        MipLevel level;
+        level.width = std::max(srcWidth / 2, 1);
+        level.height = std::max(srcHeight / 2, 1);
+        level.pixels.resize(static_cast<size_t>(level.width) * level.height * channels);
+        
+        // A dimension already at 1 repeats its texel instead of stepping past the edge
+        const int stepX = srcWidth > 1 ? channels : 0;
+        const size_t stepY = srcHeight > 1 ? static_cast<size_t>(srcWidth) * channels : 0;
+        uint8_t* dst = level.pixels.data();
+        const int dstWidth = level.width;
+        
+        parallelFor(level.height, 64, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                const uint8_t* row = src + (stepY > 0 ? 2 * y : y) * static_cast<size_t>(srcWidth) * channels;
+                for (int x = 0; x < dstWidth; x++) {
+                    const uint8_t* p = row + (stepX > 0 ? 2 * x : x) * channels;
+                    simd::float4 sum = loadPixel(p, channels, srgb, tables) + loadPixel(p + stepX, channels, srgb, tables)
+                                     + loadPixel(p + stepY, channels, srgb, tables) + loadPixel(p + stepY + stepX, channels, srgb, tables);
+                    storePixel(dst + (y * dstWidth + x) * channels, sum * 0.25f, channels, srgb, tables);
+                }
+            }
+        });
+        
+        chain.push_back(std::move(level));
+        src = chain.back().pixels.data();
+        srcWidth = chain.back().width;
+        srcHeight = chain.back().height;
+    }
+    
+    return chain;
+}
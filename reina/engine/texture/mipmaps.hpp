@@ -0,0 +1,22 @@
+#ifndef mipmaps_hpp
+#define mipmaps_hpp
+
+#include <vector>
+#include <cstdint>
+
+/// One level of a mip chain of 8-bit pixels
+struct MipLevel {
+    int width;
+    int height;
+    std::vector<uint8_t> pixels;
+};
+
+/// Builds every level below an image of 1, 2 or 4 8-bit channels, down to 1x1, each from the one above with a 2x2 box
+/// filter. sRGB images, which must have 4 channels, have their color channels averaged in linear space and re-encoded,
+/// so the chain doesn't darken; alpha and linear images are averaged as stored. Rows of a level are filtered in parallel.
+std::vector<MipLevel> generateMipChain(const uint8_t* pixels, int width, int height, int channels, bool srgb);
+
+/// Number of levels in a full chain for an image of this size, including the image itself
+int mipLevelCount(int width, int height);
+
+#endif /* mipmaps_hpp */
@@ -0,0 +1,72 @@
+#include "orm_packing.hpp"
+
+#include <stb/stb_image.h>
+
+#include <iostream>
+#include <array>
+
+#include "parallel.hpp"
+
+std::vector<uint8_t> packOrm(const OrmSources& sources, int& width, int& height) {
+    const std::array<const std::string*, 3> paths = {&sources.occlusion, &sources.roughness, &sources.metalness};
+    const std::array<uint8_t, 3> defaults = {255, 255, 0};
+    
+    struct Map {
+        unsigned char* pixels = nullptr;
+        int width = 0;
+        int height = 0;
+    };
+    std::array<Map, 3> maps;
+    
+    stbi_set_flip_vertically_on_load_thread(true);
+    parallelFor(paths.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (paths[i]->empty()) {
+                continue;
+            }
+            
+            int channels;
+            maps[i].pixels = stbi_load(paths[i]->c_str(), &maps[i].width, &maps[i].height, &channels, 1);
+            if (!maps[i].pixels) {
+                std::cerr << "ORM packing: could not decode " << *paths[i] << ": " << stbi_failure_reason() << "\n";
+                exit(1);
+            }
+        }
+    });
+    
+    width = 0;
+    height = 0;
+    for (size_t i = 0; i < maps.size(); i++) {
+        if (!maps[i].pixels) {
+            continue;
+        }
+        if (width != 0 && (maps[i].width != width || maps[i].height != height)) {
+            std::cerr << "ORM packing: " << *paths[i] << " is " << maps[i].width << "x" << maps[i].height << ", but the other maps are "
+                      << width << "x" << height << "\n";
+            exit(1);
+        }
+        width = maps[i].width;
+        height = maps[i].height;
+    }
+    if (width == 0) {
+        std::cerr << "ORM packing: no occlusion, roughness or metalness map given\n";
+        exit(1);
+    }
+    
+    const size_t pixelCount = static_cast<size_t>(width) * height;
+    std::vector<uint8_t> packed(pixelCount * 4);
+    parallelFor(pixelCount, 1 << 16, [&](size_t begin, size_t end) {
+        for (size_t p = begin; p < end; p++) {
+            for (size_t i = 0; i < maps.size(); i++) {
+                packed[p * 4 + i] = maps[i].pixels ? maps[i].pixels[p] : defaults[i];
+            }
+            packed[p * 4 + 3] = 255;
+        }
+    });
+    
+    for (const Map& map : maps) {
+        stbi_image_free(map.pixels);
+    }
+    
+    return packed;
+}
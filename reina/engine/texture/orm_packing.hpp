@@ -0,0 +1,26 @@
+#ifndef orm_packing_hpp
+#define orm_packing_hpp
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/// Channels of a packed occlusion-roughness-metalness texture, in the glTF layout
+constexpr uint32_t ORM_OCCLUSION_CHANNEL = 0;
+constexpr uint32_t ORM_ROUGHNESS_CHANNEL = 1;
+constexpr uint32_t ORM_METALNESS_CHANNEL = 2;
+
+/// Source maps of a packed ORM texture. A map left empty keeps its channel at a constant: unoccluded (1), fully rough
+/// (1) or not metallic (0).
+struct OrmSources {
+    std::string occlusion;
+    std::string roughness;
+    std::string metalness;
+};
+
+/// Decodes each map to a single channel and packs them into one RGBA8 image with opaque alpha, flipped like every
+/// other texture. The maps are decoded in parallel. Exits if a map can't be decoded, the maps' sizes differ or every
+/// map is empty.
+[[nodiscard]] std::vector<uint8_t> packOrm(const OrmSources& sources, int& width, int& height);
+
+#endif /* orm_packing_hpp */
@@ -1,19 +1,144 @@
 #include "texture.hpp"
+#include "texture_file.hpp"
+#include "mapped_file.hpp"
+
+#include <unistd.h>
+
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+
+namespace {
+
+/// Calls copy(region, offset, bytesPerRow, size) for every contiguous piece of a level in a container: the whole level,
+/// or each of its tiles clipped to the level
+template <typename Copy>
+void forEachStoredRegion(const TextureFileHeader& header, uint32_t level, Copy copy) {
+    const TextureFileLevel& l = header.levels[level];
+    if (header.tileSize == 0) {
+        copy(MTL::Region(0, 0, 0, l.width, l.height, 1), l.offset, l.bytesPerRow, l.size);
+        return;
+    }
+    
+    TextureTileLayout layout = tileLayoutOf(header, level);
+    for (uint32_t tileY = 0; tileY < layout.tilesY; tileY++) {
+        for (uint32_t tileX = 0; tileX < layout.tilesX; tileX++) {
+            uint32_t x = tileX * header.tileSize;
+            uint32_t y = tileY * header.tileSize;
+            MTL::Region region(x, y, 0, std::min(header.tileSize, l.width - x), std::min(header.tileSize, l.height - y), 1);
+            copy(region, l.offset + (static_cast<uint64_t>(tileY) * layout.tilesX + tileX) * layout.tileBytes, layout.tileBytesPerRow, layout.tileBytes);
+        }
+    }
+}
+
+}
 
 Texture::Texture(const char* filepath, MTL::Device* device, MTL::TextureUsage usage, MTL::PixelFormat format) {
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char* image = stbi_load(filepath, &width, &height, &channels, STBI_rgb_alpha);
+    // Decoded to only the channels the format keeps, so e.g. an R8 roughness map takes one byte per texel throughout
+    stbi_set_flip_vertically_on_load_thread(true);
+    unsigned char* image = stbi_load(filepath, &width, &height, &channels, decodeChannelsOf(format));
     assert(image != NULL);
+    channels = decodeChannelsOf(format);
+    upload(image, true, device, nullptr, usage, format);
+    stbi_image_free(image);
+}
 
-    init(device, format, usage);
+Texture::Texture(std::span<const uint8_t> encoded, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage, MTL::PixelFormat format) {
+    stbi_set_flip_vertically_on_load_thread(true);
+    unsigned char* image = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &channels, decodeChannelsOf(format));
+    assert(image != NULL);
+    channels = decodeChannelsOf(format);
+    upload(image, true, device, cmdQueue, usage, format);
+    stbi_image_free(image);
+}
 
-    MTL::Region region = MTL::Region(0, 0, 0, width, height, 1);
-    NS::UInteger bytesPerRow = 4 * width;
+Texture::Texture(const uint8_t* pixels, int width, int height, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage, MTL::PixelFormat format)
+        : width(width), height(height), channels(decodeChannelsOf(format)) {
+    upload(pixels, false, device, cmdQueue, usage, format);
+}
+
+Texture::Texture(const std::string& containerPath, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage) {
+    auto start = std::chrono::steady_clock::now();
+    
+    MappedFile file(containerPath);
+    std::optional<TextureFileHeader> header = readTextureFileHeader(file.data(), file.size(), file.size());
+    if (!header) {
+        std::cerr << "Texture container " << containerPath << " is truncated or not a .rtex file of version " << TEXTURE_FILE_VERSION << " or older\n";
+        exit(1);
+    }
     
-    texture->replaceRegion(region, 0, image, bytesPerRow);
+    width = static_cast<int>(header->width);
+    height = static_cast<int>(header->height);
+    channels = decodeChannelsOf(static_cast<MTL::PixelFormat>(header->pixelFormat));
+    init(device, static_cast<MTL::PixelFormat>(header->pixelFormat), usage, header->levelCount);
+    
+    // The mapping is page-aligned and the file padded to whole pages, so it can back a buffer without a copy and the GPU
+    //  reads every level straight from the file's pages. If Metal won't wrap it, the levels are copied in from the CPU.
+    MTL::Buffer* source = device->newBuffer(file.data(), file.size(), MTL::ResourceStorageModeShared, nullptr);
+    if (source) {
+        MTL::CommandBuffer* cmdBuffer = cmdQueue->commandBuffer();
+        MTL::BlitCommandEncoder* blit = cmdBuffer->blitCommandEncoder();
+        for (uint32_t level = 0; level < header->levelCount; level++) {
+            forEachStoredRegion(*header, level, [&](MTL::Region region, uint64_t offset, size_t bytesPerRow, size_t size) {
+                blit->copyFromBuffer(source, offset, bytesPerRow, size, region.size, texture, 0, level, region.origin);
+            });
+        }
+        blit->endEncoding();
+        cmdBuffer->commit();
+        cmdBuffer->waitUntilCompleted();
+        source->release();
+    } else {
+        for (uint32_t level = 0; level < header->levelCount; level++) {
+            forEachStoredRegion(*header, level, [&](MTL::Region region, uint64_t offset, size_t bytesPerRow, size_t) {
+                texture->replaceRegion(region, level, file.data() + offset, bytesPerRow);
+            });
+        }
+    }
+    
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Texture container " << containerPath << " (" << elapsed.count() * 1000 << " ms): " << width << "x" << height << ", "
+              << header->levelCount << " levels, " << file.size() / (1024.0 * 1024.0) << " MB" << (source ? "" : " (copied)") << "\n";
+}
 
-    stbi_image_free(image);
+Texture::Texture(MTL::Texture* texture, int width, int height, int channels)
+        : texture(texture), width(width), height(height), channels(channels) {}
+
+void Texture::upload(const uint8_t* image, bool pagePadded, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage, MTL::PixelFormat format) {
+    // Images get a full mip chain so distant and secondary hits can sample a level matching their footprint
+    auto start = std::chrono::steady_clock::now();
+    std::vector<TextureLevel> levels = transcodeTexture(image, width, height, format);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Mip chain (" << elapsed.count() * 1000 << " ms): " << width << "x" << height << ", " << levels.size() << " levels\n";
+    
+    init(device, format, usage, levels.size());
+    
+    // stb_image decodes into page-aligned allocations padded to whole pages (see stbi_image.cpp), so an uncompressed
+    //  level 0 it allocated is wrapped as a buffer without a copy and the GPU copies it into the texture. Metal may touch
+    //  the whole last page of a wrapped buffer, so images from anywhere else, like a std::vector, are never wrapped.
+    //  Everything else, and every level of an image Metal won't wrap, is copied in from the CPU.
+    const size_t pageSize = static_cast<size_t>(getpagesize());
+    const size_t imageBytes = static_cast<size_t>(width) * height * channels;
+    MTL::Buffer* source = nullptr;
+    if (pagePadded && cmdQueue && levels[0].bytes == image && imageBytes >= pageSize && reinterpret_cast<uintptr_t>(image) % pageSize == 0) {
+        source = device->newBuffer(image, (imageBytes + pageSize - 1) / pageSize * pageSize, MTL::ResourceStorageModeShared, nullptr);
+    }
+    
+    for (size_t level = source ? 1 : 0; level < levels.size(); level++) {
+        const TextureLevel& l = levels[level];
+        texture->replaceRegion(MTL::Region(0, 0, 0, l.width, l.height, 1), level, l.bytes, l.bytesPerRow);
+    }
+    
+    if (source) {
+        MTL::CommandBuffer* cmdBuffer = cmdQueue->commandBuffer();
+        MTL::BlitCommandEncoder* blit = cmdBuffer->blitCommandEncoder();
+        blit->copyFromBuffer(source, 0, levels[0].bytesPerRow, imageBytes, MTL::Size(width, height, 1), texture, 0, 0, MTL::Origin(0, 0, 0));
+        blit->endEncoding();
+        cmdBuffer->commit();
+        cmdBuffer->waitUntilCompleted();
+        source->release();
+    }
 }
 
 Texture::Texture(MTL::Device* device, int width, int height, int channels, MTL::PixelFormat pixelFormat, MTL::TextureUsage usage)
@@ -21,12 +146,13 @@ Texture::Texture(MTL::Device* device, int width, int height, int channels, MTL::
     init(device, pixelFormat, usage);
 }
 
-void Texture::init(MTL::Device* device, MTL::PixelFormat pixelFormat, MTL::TextureUsage usage) {
+void Texture::init(MTL::Device* device, MTL::PixelFormat pixelFormat, MTL::TextureUsage usage, NS::UInteger mipLevels) {
     MTL::TextureDescriptor* textureDescriptor = MTL::TextureDescriptor::alloc()->init();
     textureDescriptor->setPixelFormat(pixelFormat);
     textureDescriptor->setWidth(width);
     textureDescriptor->setHeight(height);
     textureDescriptor->setUsage(usage);
+    textureDescriptor->setMipmapLevelCount(mipLevels);
     
     texture = device->newTexture(textureDescriptor);
     textureDescriptor->release();
@@ -3,10 +3,26 @@
 #include <stb/stb_image.h>
 
 #include <string>
+#include <span>
+#include <cstdint>
 
 class Texture {
 public:
     Texture(const char* filepath, MTL::Device* device, MTL::TextureUsage usage, MTL::PixelFormat format = MTL::PixelFormatRGBA8Unorm_sRGB);
+    
+    /// Decodes an image file already read into memory, e.g. by BatchFileReader. With a command queue, an uncompressed
+    /// level 0 is copied into the texture by the GPU straight from the decoder's output.
+    Texture(std::span<const uint8_t> encoded, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage, MTL::PixelFormat format = MTL::PixelFormatRGBA8Unorm_sRGB);
+    
+    /// Uploads an image already decoded to the format's channels (see decodeChannelsOf), such as a packed ORM texture
+    Texture(const uint8_t* pixels, int width, int height, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage, MTL::PixelFormat format);
+    
+    /// Maps a .rtex container written by convertTexture and uploads its levels as stored, without decoding. Exits if the
+    /// file is not a valid container.
+    Texture(const std::string& containerPath, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage);
+    
+    /// Takes ownership of a texture created elsewhere, such as a sparse texture of a TextureTileCache
+    Texture(MTL::Texture* texture, int width, int height, int channels);
     Texture(MTL::Device* device, int width, int height, int channels, MTL::PixelFormat pixelFormat, MTL::TextureUsage usage);
     ~Texture();
     
@@ -15,7 +31,10 @@ public:
     
     MTL::Texture* texture;
     int width, height, channels;
-    
+
 private:
-    void init(MTL::Device* device, MTL::PixelFormat pixelFormat, MTL::TextureUsage usage);
+    void init(MTL::Device* device, MTL::PixelFormat pixelFormat, MTL::TextureUsage usage, NS::UInteger mipLevels = 1);
+    /// pagePadded is only set for images stb_image allocated, which are page-aligned and padded to whole pages, so their
+    /// level 0 may be wrapped as a buffer without a copy. Any other image is copied.
+    void upload(const uint8_t* image, bool pagePadded, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::TextureUsage usage, MTL::PixelFormat format);
 };
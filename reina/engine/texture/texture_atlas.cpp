@@ -0,0 +1,137 @@
+#include "texture_atlas.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+#include "parallel.hpp"
+
+namespace {
+
+int roundUp(int value, int multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+/// A row of a page holding cells no taller than the row, filled left to right
+struct Shelf {
+    int y;
+    int height;
+    int x;
+};
+
+struct PagePacker {
+    std::vector<Shelf> shelves;
+    int usedWidth = 0;
+    int usedHeight = 0;
+};
+
+struct Cell {
+    uint32_t page;
+    int x;
+    int y;
+};
+
+}
+
+TextureAtlas packAtlas(std::span<const AtlasImage> images, int channels, int pageSize) {
+    // A cell is the image and its gutter on every side, rounded up so the next cell starts aligned too
+    auto cellWidth = [](const AtlasImage& image) { return roundUp(image.width + 2 * ATLAS_GUTTER, ATLAS_GUTTER); };
+    auto cellHeight = [](const AtlasImage& image) { return roundUp(image.height + 2 * ATLAS_GUTTER, ATLAS_GUTTER); };
+    
+    for (const AtlasImage& image : images) {
+        if (cellWidth(image) > pageSize || cellHeight(image) > pageSize) {
+            std::cerr << "Texture atlas: a " << image.width << "x" << image.height << " image doesn't fit a " << pageSize << "x"
+                      << pageSize << " page with its " << ATLAS_GUTTER << " texel gutter\n";
+            exit(1);
+        }
+    }
+    
+    // Tallest first, so each shelf is only as tall as its first cell needs and the cells after it fill it closely
+    std::vector<size_t> order(images.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return cellHeight(images[a]) != cellHeight(images[b]) ? cellHeight(images[a]) > cellHeight(images[b]) : cellWidth(images[a]) > cellWidth(images[b]);
+    });
+    
+    std::vector<PagePacker> packers;
+    std::vector<Cell> cells(images.size());
+    for (size_t i : order) {
+        const int w = cellWidth(images[i]);
+        const int h = cellHeight(images[i]);
+        
+        // First shelf with room on any page, then a new shelf under the last one, then a new page
+        bool placed = false;
+        for (uint32_t page = 0; page < packers.size() && !placed; page++) {
+            PagePacker& packer = packers[page];
+            for (Shelf& shelf : packer.shelves) {
+                if (h <= shelf.height && shelf.x + w <= pageSize) {
+                    cells[i] = {page, shelf.x, shelf.y};
+                    shelf.x += w;
+                    placed = true;
+                    break;
+                }
+            }
+            if (!placed && packer.usedHeight + h <= pageSize) {
+                packer.shelves.push_back({packer.usedHeight, h, w});
+                cells[i] = {page, 0, packer.usedHeight};
+                packer.usedHeight += h;
+                placed = true;
+            }
+            if (placed) {
+                packer.usedWidth = std::max(packer.usedWidth, cells[i].x + w);
+            }
+        }
+        if (!placed) {
+            packers.push_back({{{0, h, w}}, w, h});
+            cells[i] = {static_cast<uint32_t>(packers.size() - 1), 0, 0};
+        }
+    }
+    
+    TextureAtlas atlas;
+    atlas.imageTexels = 0;
+    for (const PagePacker& packer : packers) {
+        atlas.pages.push_back({packer.usedWidth, packer.usedHeight, std::vector<uint8_t>(static_cast<size_t>(packer.usedWidth) * packer.usedHeight * channels)});
+    }
+    
+    atlas.placements.resize(images.size());
+    for (size_t i = 0; i < images.size(); i++) {
+        const AtlasPage& page = atlas.pages[cells[i].page];
+        const int x = cells[i].x + ATLAS_GUTTER;
+        const int y = cells[i].y + ATLAS_GUTTER;
+        atlas.placements[i] = {cells[i].page, simd::float4{
+            static_cast<float>(images[i].width) / page.width, static_cast<float>(images[i].height) / page.height,
+            static_cast<float>(x) / page.width, static_cast<float>(y) / page.height
+        }};
+        atlas.imageTexels += static_cast<size_t>(images[i].width) * images[i].height;
+    }
+    
+    // Every texel of a cell outside the image repeats the nearest edge texel. Cells don't overlap, so images are copied
+    //  into shared pages concurrently.
+    parallelFor(images.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const AtlasImage& image = images[i];
+            AtlasPage& page = atlas.pages[cells[i].page];
+            const size_t pixelBytes = channels;
+            const size_t imageRowBytes = static_cast<size_t>(image.width) * pixelBytes;
+            const int w = cellWidth(image);
+            const int h = cellHeight(image);
+            
+            for (int cy = 0; cy < h; cy++) {
+                const int sy = std::clamp(cy - ATLAS_GUTTER, 0, image.height - 1);
+                const uint8_t* src = image.pixels + static_cast<size_t>(sy) * imageRowBytes;
+                uint8_t* dst = page.pixels.data() + ((static_cast<size_t>(cells[i].y) + cy) * page.width + cells[i].x) * pixelBytes;
+                
+                for (int cx = 0; cx < ATLAS_GUTTER; cx++) {
+                    std::memcpy(dst + cx * pixelBytes, src, pixelBytes);
+                }
+                std::memcpy(dst + ATLAS_GUTTER * pixelBytes, src, imageRowBytes);
+                for (int cx = ATLAS_GUTTER + image.width; cx < w; cx++) {
+                    std::memcpy(dst + cx * pixelBytes, src + imageRowBytes - pixelBytes, pixelBytes);
+                }
+            }
+        }
+    });
+    
+    return atlas;
+}
@@ -0,0 +1,47 @@
+#ifndef texture_atlas_hpp
+#define texture_atlas_hpp
+
+#include <simd/simd.h>
+
+#include <span>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "shared.hpp"
+
+/// Gutter around each entry, in texels of level 0: enough to leave one texel at the last of its ATLAS_MIP_LEVELS levels
+constexpr int ATLAS_GUTTER = 1 << (ATLAS_MIP_LEVELS - 1);
+
+/// One image to pack, decoded to the atlas's channels
+struct AtlasImage {
+    const uint8_t* pixels;
+    int width;
+    int height;
+};
+
+/// Where an image was packed: its page, and the UV scale (xy) and offset (zw) that map the image's own UVs onto the page
+struct AtlasPlacement {
+    uint32_t page;
+    simd::float4 uvRect;
+};
+
+struct AtlasPage {
+    int width;
+    int height;
+    std::vector<uint8_t> pixels;
+};
+
+struct TextureAtlas {
+    std::vector<AtlasPage> pages;
+    std::vector<AtlasPlacement> placements;  // Per image, in the order given
+    size_t imageTexels;                      // Covered by the images themselves, without their gutters
+};
+
+/// Packs images into as few pages of at most pageSize x pageSize as a shelf packer fits them, tallest first. Each image
+/// is surrounded by a gutter of its edge texels repeated and starts at a multiple of ATLAS_GUTTER, so an entry's first
+/// ATLAS_MIP_LEVELS levels are box filtered from its own texels only and linear filtering at its edges stays inside it.
+/// Pages are cropped to what they use. Images are copied in parallel. Exits if an image doesn't fit a page.
+[[nodiscard]] TextureAtlas packAtlas(std::span<const AtlasImage> images, int channels, int pageSize);
+
+#endif /* texture_atlas_hpp */
@@ -0,0 +1,292 @@
+#include "texture_file.hpp"
+
+#include <stb/stb_image.h>
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <cassert>
+
+#include "mipmaps.hpp"
+
+namespace {
+
+/// Uncompressed formats store single pixels, BC formats 4x4 blocks
+uint32_t unitSizeOf(MTL::PixelFormat format) {
+    return blockFormatOf(format) ? 4 : 1;
+}
+
+/// Rearranges a level stored row by row into tiles, padding partial tiles with zeros
+std::vector<uint8_t> tileLevel(const TextureLevel& level, const TextureTileLayout& layout, uint32_t tileSize, uint32_t unitSize) {
+    const size_t levelRows = (level.height + unitSize - 1) / unitSize;
+    const size_t tileRows = tileSize / unitSize;
+    std::vector<uint8_t> tiled(layout.tilesX * layout.tilesY * layout.tileBytes, 0);
+    
+    for (uint32_t tileY = 0; tileY < layout.tilesY; tileY++) {
+        for (uint32_t tileX = 0; tileX < layout.tilesX; tileX++) {
+            uint8_t* tile = tiled.data() + (static_cast<size_t>(tileY) * layout.tilesX + tileX) * layout.tileBytes;
+            size_t columnOffset = tileX * layout.tileBytesPerRow;
+            size_t rowBytes = std::min(layout.tileBytesPerRow, level.bytesPerRow - columnOffset);
+            
+            for (size_t row = 0; row < tileRows && tileY * tileRows + row < levelRows; row++) {
+                std::memcpy(tile + row * layout.tileBytesPerRow, level.bytes + (tileY * tileRows + row) * level.bytesPerRow + columnOffset, rowBytes);
+            }
+        }
+    }
+    
+    return tiled;
+}
+
+}
+
+std::optional<BlockFormat> blockFormatOf(MTL::PixelFormat format) {
+    switch (format) {
+        case MTL::PixelFormatBC1_RGBA:
+        case MTL::PixelFormatBC1_RGBA_sRGB:
+            return BlockFormat::BC1;
+        case MTL::PixelFormatBC4_RUnorm:
+            return BlockFormat::BC4;
+        case MTL::PixelFormatBC5_RGUnorm:
+            return BlockFormat::BC5;
+        case MTL::PixelFormatBC7_RGBAUnorm:
+        case MTL::PixelFormatBC7_RGBAUnorm_sRGB:
+            return BlockFormat::BC7;
+        default:
+            return std::nullopt;
+    }
+}
+
+bool isSrgbFormat(MTL::PixelFormat format) {
+    return format == MTL::PixelFormatRGBA8Unorm_sRGB || format == MTL::PixelFormatBC1_RGBA_sRGB || format == MTL::PixelFormatBC7_RGBAUnorm_sRGB;
+}
+
+std::optional<TextureFileHeader> readTextureFileHeader(const uint8_t* bytes, size_t size, uint64_t fileSize) {
+    // Version 1 containers have no tileSize or reserved field, so their levels start that much earlier, and are never
+    //  tiled
+    constexpr size_t v1LevelsOffset = offsetof(TextureFileHeader, tileSize);
+    TextureFileHeader header;
+    if (size < v1LevelsOffset + sizeof(header.levels)) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, bytes, v1LevelsOffset);
+    if (header.version == 1) {
+        header.tileSize = 0;
+        header.reserved = 0;
+        std::memcpy(header.levels, bytes + v1LevelsOffset, sizeof(header.levels));
+    } else if (size >= sizeof(header)) {
+        std::memcpy(&header, bytes, sizeof(header));
+    } else {
+        return std::nullopt;
+    }
+    
+    if (std::memcmp(header.magic, "RTEX", 4) != 0 || header.version < 1 || header.version > TEXTURE_FILE_VERSION || header.levelCount == 0
+        || header.levelCount > TEXTURE_FILE_MAX_LEVELS || header.tileSize % 4 != 0) {
+        return std::nullopt;
+    }
+    for (uint32_t level = 0; level < header.levelCount; level++) {
+        const TextureFileLevel& l = header.levels[level];
+        if (l.offset + l.size > fileSize) {
+            return std::nullopt;
+        }
+        if (header.tileSize != 0) {
+            TextureTileLayout layout = tileLayoutOf(header, level);
+            if (l.size != layout.tilesX * layout.tilesY * layout.tileBytes) {
+                return std::nullopt;
+            }
+        }
+    }
+    
+    return header;
+}
+
+TextureTileLayout tileLayoutOf(const TextureFileHeader& header, uint32_t level) {
+    assert(header.tileSize != 0);
+    const TextureFileLevel& l = header.levels[level];
+    MTL::PixelFormat format = static_cast<MTL::PixelFormat>(header.pixelFormat);
+    std::optional<BlockFormat> blockFormat = blockFormatOf(format);
+    uint32_t unitSize = unitSizeOf(format);
+    
+    TextureTileLayout layout;
+    layout.tilesX = (l.width + header.tileSize - 1) / header.tileSize;
+    layout.tilesY = (l.height + header.tileSize - 1) / header.tileSize;
+    layout.tileBytesPerRow = header.tileSize / unitSize * (blockFormat ? blockBytes(*blockFormat) : decodeChannelsOf(format));
+    layout.tileBytes = layout.tileBytesPerRow * (header.tileSize / unitSize);
+    
+    return layout;
+}
+
+int decodeChannelsOf(MTL::PixelFormat format) {
+    switch (format) {
+        case MTL::PixelFormatR8Unorm:
+            return 1;
+        case MTL::PixelFormatRG8Unorm:
+            return 2;
+        default:
+            return 4;
+    }
+}
+
+std::optional<MTL::PixelFormat> textureFormatFromNames(const std::string& colorSpace, const std::string& compression, int channels) {
+    if (colorSpace != "srgb" && colorSpace != "linear") {
+        return std::nullopt;
+    }
+    bool srgb = colorSpace == "srgb";
+    
+    // Each format stores a fixed number of channels, so an explicit count has to agree with it
+    auto stores = [&](int formatChannels) { return channels == 0 || channels == formatChannels; };
+    
+    if (compression == "none" && (channels == 1 || channels == 2) && !srgb) {
+        return channels == 1 ? MTL::PixelFormatR8Unorm : MTL::PixelFormatRG8Unorm;
+    } else if (compression == "none" && stores(4)) {
+        return srgb ? MTL::PixelFormatRGBA8Unorm_sRGB : MTL::PixelFormatRGBA8Unorm;
+    } else if (compression == "bc1" && stores(4)) {
+        return srgb ? MTL::PixelFormatBC1_RGBA_sRGB : MTL::PixelFormatBC1_RGBA;
+    } else if (compression == "bc7" && stores(4)) {
+        return srgb ? MTL::PixelFormatBC7_RGBAUnorm_sRGB : MTL::PixelFormatBC7_RGBAUnorm;
+    } else if (compression == "bc4" && stores(1) && !srgb) {
+        return MTL::PixelFormatBC4_RUnorm;
+    } else if (compression == "bc5" && stores(2) && !srgb) {
+        return MTL::PixelFormatBC5_RGUnorm;
+    }
+    
+    return std::nullopt;
+}
+
+std::vector<TextureLevel> transcodeTexture(const uint8_t* pixels, int width, int height, MTL::PixelFormat format) {
+    const int channels = decodeChannelsOf(format);
+    std::vector<MipLevel> mips = generateMipChain(pixels, width, height, channels, isSrgbFormat(format));
+    std::optional<BlockFormat> blockFormat = blockFormatOf(format);
+    
+    std::vector<TextureLevel> levels(mips.size() + 1);
+    if (!blockFormat) {
+        levels[0] = TextureLevel{width, height, static_cast<size_t>(width) * channels, static_cast<size_t>(width) * height * channels, pixels, {}};
+        for (size_t level = 1; level < levels.size(); level++) {
+            MipLevel& mip = mips[level - 1];
+            levels[level] = TextureLevel{mip.width, mip.height, static_cast<size_t>(mip.width) * channels, mip.pixels.size(), nullptr, std::move(mip.pixels)};
+            levels[level].bytes = levels[level].storage.data();
+        }
+        return levels;
+    }
+    
+    // Every level is compressed on its own; level 0 is decoded again to report the quality
+    auto start = std::chrono::steady_clock::now();
+    size_t uncompressedBytes = 0;
+    size_t compressedBytes = 0;
+    double psnr = 0;
+    
+    for (size_t level = 0; level < levels.size(); level++) {
+        const uint8_t* levelPixels = level == 0 ? pixels : mips[level - 1].pixels.data();
+        int levelWidth = level == 0 ? width : mips[level - 1].width;
+        int levelHeight = level == 0 ? height : mips[level - 1].height;
+        
+        TextureLevel& out = levels[level];
+        out.width = levelWidth;
+        out.height = levelHeight;
+        out.bytesPerRow = (levelWidth + 3) / 4 * blockBytes(*blockFormat);
+        out.storage = encodeBlocks(*blockFormat, levelPixels, levelWidth, levelHeight);
+        out.bytes = out.storage.data();
+        out.size = out.storage.size();
+        
+        uncompressedBytes += static_cast<size_t>(levelWidth) * levelHeight * 4;
+        compressedBytes += out.size;
+        
+        if (level == 0) {
+            std::vector<uint8_t> decoded = decodeBlocks(*blockFormat, out.bytes, width, height);
+            psnr = blockPsnr(*blockFormat, pixels, decoded.data(), width, height);
+        }
+    }
+    
+    static const char* names[] = {"BC1", "BC4", "BC5", "BC7"};
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << names[static_cast<size_t>(*blockFormat)] << " (" << elapsed.count() * 1000 << " ms): " << uncompressedBytes / (1024.0 * 1024.0) << " MB -> "
+              << compressedBytes / (1024.0 * 1024.0) << " MB, PSNR " << psnr << " dB\n";
+    
+    return levels;
+}
+
+uint64_t writeTextureFile(const uint8_t* pixels, int width, int height, const std::string& destination, MTL::PixelFormat format, uint32_t tileSize) {
+    std::vector<TextureLevel> levels = transcodeTexture(pixels, width, height, format);
+    if (levels.size() > TEXTURE_FILE_MAX_LEVELS) {
+        std::cerr << "Texture converter: " << destination << " needs " << levels.size() << " mip levels, more than the " << TEXTURE_FILE_MAX_LEVELS << " a container holds\n";
+        exit(1);
+    }
+    if (tileSize % 4 != 0) {
+        std::cerr << "Texture converter: tile size " << tileSize << " is not a multiple of 4\n";
+        exit(1);
+    }
+    
+    TextureFileHeader header{};
+    std::memcpy(header.magic, "RTEX", 4);
+    header.version = TEXTURE_FILE_VERSION;
+    header.pixelFormat = static_cast<uint32_t>(format);
+    header.width = static_cast<uint32_t>(width);
+    header.height = static_cast<uint32_t>(height);
+    header.levelCount = static_cast<uint32_t>(levels.size());
+    header.tileSize = tileSize;
+    
+    for (size_t level = 0; level < levels.size() && tileSize != 0; level++) {
+        header.levels[level].width = static_cast<uint32_t>(levels[level].width);
+        header.levels[level].height = static_cast<uint32_t>(levels[level].height);
+        TextureTileLayout layout = tileLayoutOf(header, static_cast<uint32_t>(level));
+        
+        levels[level].storage = tileLevel(levels[level], layout, tileSize, unitSizeOf(format));
+        levels[level].bytes = levels[level].storage.data();
+        levels[level].size = levels[level].storage.size();
+        levels[level].bytesPerRow = layout.tileBytesPerRow;
+    }
+    
+    auto align = [](uint64_t offset) { return (offset + TEXTURE_FILE_ALIGNMENT - 1) / TEXTURE_FILE_ALIGNMENT * TEXTURE_FILE_ALIGNMENT; };
+    uint64_t offset = align(sizeof(TextureFileHeader));
+    for (size_t level = 0; level < levels.size(); level++) {
+        header.levels[level] = TextureFileLevel{offset, levels[level].size, static_cast<uint32_t>(levels[level].width), static_cast<uint32_t>(levels[level].height),
+                                                static_cast<uint32_t>(levels[level].bytesPerRow), 0};
+        offset = align(offset + levels[level].size);
+    }
+    
+    std::ofstream out(destination, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    
+    std::vector<char> padding(TEXTURE_FILE_ALIGNMENT, 0);
+    uint64_t written = sizeof(header);
+    for (size_t level = 0; level < levels.size(); level++) {
+        out.write(padding.data(), static_cast<std::streamsize>(header.levels[level].offset - written));
+        out.write(reinterpret_cast<const char*>(levels[level].bytes), static_cast<std::streamsize>(levels[level].size));
+        written = header.levels[level].offset + levels[level].size;
+    }
+    out.write(padding.data(), static_cast<std::streamsize>(offset - written));
+    
+    if (!out) {
+        std::cerr << "Texture converter: could not write " << destination << "\n";
+        exit(1);
+    }
+    
+    std::cout << "Wrote " << destination << ": " << width << "x" << height << ", " << levels.size() << " levels";
+    if (tileSize != 0) {
+        std::cout << " in " << tileSize << "x" << tileSize << " tiles";
+    }
+    std::cout << ", " << offset / (1024.0 * 1024.0) << " MB\n";
+    
+    return offset;
+}
+
+void convertTexture(const std::string& source, const std::string& destination, MTL::PixelFormat format, uint32_t tileSize) {
+    auto start = std::chrono::steady_clock::now();
+    
+    // Flipped the same way as textures decoded at load time, so both sample identically
+    int width, height, channels;
+    stbi_set_flip_vertically_on_load_thread(true);
+    unsigned char* image = stbi_load(source.c_str(), &width, &height, &channels, decodeChannelsOf(format));
+    if (!image) {
+        std::cerr << "Texture converter: could not decode " << source << ": " << stbi_failure_reason() << "\n";
+        exit(1);
+    }
+    
+    writeTextureFile(image, width, height, destination, format, tileSize);
+    stbi_image_free(image);
+    
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Converted " << source << " -> " << destination << " (" << elapsed.count() * 1000 << " ms)\n";
+}
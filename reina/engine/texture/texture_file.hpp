@@ -0,0 +1,92 @@
+#ifndef texture_file_hpp
+#define texture_file_hpp
+
+#include <Metal/Metal.hpp>
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+
+#include "block_compression.hpp"
+
+constexpr uint32_t TEXTURE_FILE_VERSION = 2;
+constexpr uint32_t TEXTURE_FILE_MAX_LEVELS = 16;
+constexpr size_t TEXTURE_FILE_ALIGNMENT = 16384;  // Largest page size on Apple platforms
+
+struct TextureFileLevel {
+    uint64_t offset;  // From the start of the file, a multiple of TEXTURE_FILE_ALIGNMENT
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerRow;  // Of the whole level, or of one tile in a tiled container
+    uint32_t reserved;
+};
+
+/// Header of a .rtex container. The levels' data follows in the GPU's own layout, each starting page-aligned and the file
+/// padded to a whole page, so a loader can map the file and upload straight from the mapping. A tiled container stores
+/// each level as square tiles in row-major order instead, every tile contiguous and padded to the full tile size at the
+/// right and bottom edges, so a single tile can be read without touching the rest of the level.
+struct TextureFileHeader {
+    char magic[4];         // "RTEX"
+    uint32_t version;
+    uint32_t pixelFormat;  // MTL::PixelFormat
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint32_t tileSize;     // Tile width and height in pixels, a multiple of 4, or 0 for whole levels
+    uint32_t reserved;
+    TextureFileLevel levels[TEXTURE_FILE_MAX_LEVELS];
+};
+
+/// How one level of a tiled container is split into tiles
+struct TextureTileLayout {
+    uint32_t tilesX;
+    uint32_t tilesY;
+    size_t tileBytes;
+    size_t tileBytesPerRow;
+};
+
+/// One mip level in its final layout. bytes points into storage, or at the caller's image for an uncompressed level 0.
+struct TextureLevel {
+    int width;
+    int height;
+    size_t bytesPerRow;
+    size_t size;
+    const uint8_t* bytes;
+    std::vector<uint8_t> storage;
+};
+
+/// The block format a pixel format is encoded with, if it is one of the BC formats the encoder writes
+[[nodiscard]] std::optional<BlockFormat> blockFormatOf(MTL::PixelFormat format);
+[[nodiscard]] bool isSrgbFormat(MTL::PixelFormat format);
+
+/// The header at the start of a container, or nothing if the bytes are not a valid container of this or an earlier
+/// version or its levels extend past fileSize. Version 1 containers read as untiled ones.
+[[nodiscard]] std::optional<TextureFileHeader> readTextureFileHeader(const uint8_t* bytes, size_t size, uint64_t fileSize);
+
+[[nodiscard]] TextureTileLayout tileLayoutOf(const TextureFileHeader& header, uint32_t level);
+
+/// Channels an image is decoded to for a format: as many as an uncompressed format stores, and RGBA for the block
+/// encoder. For uncompressed formats this is also the bytes per pixel.
+[[nodiscard]] int decodeChannelsOf(MTL::PixelFormat format);
+
+/// Pixel format for a color space ("srgb" or "linear"), compression ("none", "bc1", "bc4", "bc5" or "bc7") and channel
+/// count, or nothing for an unknown name or a combination that doesn't exist, such as sRGB BC4. Uncompressed linear
+/// textures can have 1 (R8) or 2 (RG8) channels instead of 4; a count of 0 takes the compression's own.
+[[nodiscard]] std::optional<MTL::PixelFormat> textureFormatFromNames(const std::string& colorSpace, const std::string& compression, int channels = 0);
+
+/// Builds the full mip chain of an image decoded to the format's channels in the pixel format's layout, block
+/// compressing every level for BC formats. Compressed textures report their size and the PSNR of level 0.
+[[nodiscard]] std::vector<TextureLevel> transcodeTexture(const uint8_t* pixels, int width, int height, MTL::PixelFormat format);
+
+/// Writes an image decoded to the format's channels as a .rtex container in that format, tiled if tileSize is not 0.
+/// Returns the size of the file. Exits on failure.
+uint64_t writeTextureFile(const uint8_t* pixels, int width, int height, const std::string& destination, MTL::PixelFormat format, uint32_t tileSize = 0);
+
+/// Decodes a PNG or JPG and writes it as a .rtex container in the given format, tiled if tileSize is not 0. Exits on
+/// failure.
+void convertTexture(const std::string& source, const std::string& destination, MTL::PixelFormat format, uint32_t tileSize = 0);
+
+#endif /* texture_file_hpp */
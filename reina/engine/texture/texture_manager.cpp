@@ -0,0 +1,59 @@
+#include "texture_manager.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+#include "hash.hpp"
+
+std::shared_ptr<Texture> TextureManager::load(const std::string& path, std::span<const uint8_t> encoded, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::PixelFormat format) {
+    std::string pathKey = path + "|" + std::to_string(static_cast<uint64_t>(format));
+    uint64_t contentKey = hashCombine(hashBytes(encoded.data(), encoded.size()), static_cast<uint64_t>(format));
+    
+    // The first caller for a texture publishes a future before decoding, so a duplicate arriving on another thread
+    //  waits for that decode rather than starting its own
+    std::promise<std::shared_ptr<Texture>> promise;
+    SharedTexture existing;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto it = byPath.find(pathKey); it != byPath.end()) {
+            existing = it->second;
+            sharedByPath++;
+        } else {
+            // A matching hash only shares the texture if the files are really the same
+            auto [first, last] = byContent.equal_range(contentKey);
+            for (auto it = first; it != last && !existing.valid(); it++) {
+                if (it->second.format == format && std::ranges::equal(it->second.encoded, encoded)) {
+                    existing = it->second.texture;
+                }
+            }
+            
+            if (existing.valid()) {
+                byPath.emplace(pathKey, existing);
+                sharedByContent++;
+            } else {
+                SharedTexture future = promise.get_future().share();
+                byPath.emplace(pathKey, future);
+                byContent.emplace(contentKey, ContentEntry{std::vector<uint8_t>(encoded.begin(), encoded.end()), format, future});
+                decoded++;
+            }
+        }
+        
+        if (existing.valid()) {
+            sharedBytes += encoded.size();
+        }
+    }
+    
+    if (existing.valid()) {
+        return existing.get();
+    }
+    
+    auto texture = std::make_shared<Texture>(encoded, device, cmdQueue, MTL::TextureUsageShaderRead, format);
+    promise.set_value(texture);
+    return texture;
+}
+
+void TextureManager::printReport() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cout << "Texture manager: " << decoded << " decoded, " << sharedByPath << " shared by path, " << sharedByContent << " shared by content ("
+              << sharedBytes / (1024.0 * 1024.0) << " MB not decoded again)\n";
+}
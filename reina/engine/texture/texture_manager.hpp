@@ -0,0 +1,49 @@
+#ifndef texture_manager_hpp
+#define texture_manager_hpp
+
+#include <Metal/Metal.hpp>
+
+#include <span>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+#include "texture.hpp"
+
+/// Decodes each texture of a scene once. Loads of the same path, or of byte-identical files, in the same format share
+/// one Texture: later callers wait for the first decode instead of repeating it. Files are matched by a hash of their
+/// contents and then compared byte for byte, so a copy of each decoded file is kept. Different textures decode concurrently
+/// on whichever threads call load(), such as the task graph's workers.
+class TextureManager {
+public:
+    /// Decodes and uploads an image file already read into memory for shader reads, or returns the texture already
+    /// loaded from the same path or the same contents
+    [[nodiscard]] std::shared_ptr<Texture> load(const std::string& path, std::span<const uint8_t> encoded, MTL::Device* device, MTL::CommandQueue* cmdQueue, MTL::PixelFormat format);
+    
+    void printReport() const;
+
+private:
+    using SharedTexture = std::shared_future<std::shared_ptr<Texture>>;
+    
+    struct ContentEntry {
+        std::vector<uint8_t> encoded;
+        MTL::PixelFormat format;
+        SharedTexture texture;
+    };
+    
+    std::unordered_map<std::string, SharedTexture> byPath;        // Keyed by path and format
+    std::unordered_multimap<uint64_t, ContentEntry> byContent;   // Keyed by a hash of the file and the format
+    size_t decoded = 0;
+    size_t sharedByPath = 0;
+    size_t sharedByContent = 0;
+    size_t sharedBytes = 0;  // Encoded bytes that didn't have to be decoded again
+    
+    mutable std::mutex mutex;
+};
+
+#endif /* texture_manager_hpp */
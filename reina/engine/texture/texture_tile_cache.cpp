@@ -0,0 +1,396 @@
+#include "texture_tile_cache.hpp"
+#include "parallel.hpp"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <cerrno>
+#include <cstring>
+
+static_assert(MAX_TEXTURE_LEVELS == TEXTURE_FILE_MAX_LEVELS, "SparseTextureInfo must have a first tile for every level a container can store");
+
+namespace {
+
+void readFully(int fd, uint8_t* out, size_t size, uint64_t offset, const std::string& path) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = pread(fd, out + done, size - done, static_cast<off_t>(offset + done));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            std::cerr << "Texture container " << path << ": could not read: " << (result < 0 ? std::strerror(errno) : "unexpected end of file") << "\n";
+            exit(1);
+        }
+        done += static_cast<size_t>(result);
+    }
+}
+
+/// Sparse tiles across and down a level
+MTL::Size tileGridOf(const SparseTextureInfo& info, const TextureFileLevel& level) {
+    return MTL::Size((level.width + info.tileWidth - 1) / info.tileWidth, (level.height + info.tileHeight - 1) / info.tileHeight, 1);
+}
+
+}  // namespace
+
+TextureTileCache::TextureTileCache(size_t budgetBytes) : budgetBytes(budgetBytes) {}
+
+TextureTileCache::~TextureTileCache() {
+    for (SparseTexture& t : textures) {
+        close(t.fd);
+    }
+    textures.clear();
+    
+    if (stampBuffer) {
+        stampBuffer->release();
+    }
+    if (heap) {
+        heap->release();
+    }
+}
+
+std::shared_ptr<Texture> TextureTileCache::add(const std::string& containerPath, MTL::Device* device, MTL::CommandQueue* cmdQueue) {
+    auto start = std::chrono::steady_clock::now();
+    
+    int fd = open(containerPath.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        std::cerr << "Texture container " << containerPath << ": could not open: " << std::strerror(errno) << "\n";
+        exit(1);
+    }
+    
+    TextureFileHeader stored;
+    const size_t headerBytes = std::min(sizeof(stored), static_cast<size_t>(info.st_size));
+    readFully(fd, reinterpret_cast<uint8_t*>(&stored), headerBytes, 0, containerPath);
+    std::optional<TextureFileHeader> header = readTextureFileHeader(reinterpret_cast<const uint8_t*>(&stored), headerBytes, info.st_size);
+    if (!header) {
+        std::cerr << "Texture container " << containerPath << " is truncated or not a .rtex file of version " << TEXTURE_FILE_VERSION << " or older\n";
+        exit(1);
+    }
+    if (header->tileSize == 0) {
+        std::cerr << "Texture container " << containerPath << " is not tiled, so it can't be streamed through a budget. Convert it again with "
+                  << "--convert-texture and a tile size, or remove \"textureBudgetMB\".\n";
+        exit(1);
+    }
+    const MTL::PixelFormat format = static_cast<MTL::PixelFormat>(header->pixelFormat);
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!heap) {
+        // Sparse textures need an Apple6 (A13 or M1) GPU or later
+        if (!device->supportsFamily(MTL::GPUFamilyApple6)) {
+            std::cerr << "Texture tile cache: the GPU has no sparse textures, so \"textureBudgetMB\" can't be used on it\n";
+            exit(1);
+        }
+    
+        tileBytes = device->sparseTileSizeInBytes();
+        capacity = budgetBytes / tileBytes;
+    
+        MTL::HeapDescriptor* heapDescriptor = MTL::HeapDescriptor::alloc()->init();
+        heapDescriptor->setType(MTL::HeapTypeSparse);
+        heapDescriptor->setStorageMode(MTL::StorageModePrivate);
+        heapDescriptor->setSize(capacity * tileBytes);
+        heap = capacity > 0 ? device->newHeap(heapDescriptor) : nullptr;
+        heapDescriptor->release();
+    
+        if (!heap) {
+            std::cerr << "Texture tile cache: could not create a sparse heap of " << budgetBytes / (1024.0 * 1024.0) << " MB, which must hold at least one "
+                      << tileBytes / 1024 << " KB tile\n";
+            exit(1);
+        }
+    }
+    
+    MTL::TextureDescriptor* descriptor = MTL::TextureDescriptor::alloc()->init();
+    descriptor->setPixelFormat(format);
+    descriptor->setWidth(header->width);
+    descriptor->setHeight(header->height);
+    descriptor->setMipmapLevelCount(header->levelCount);
+    descriptor->setUsage(MTL::TextureUsageShaderRead);
+    descriptor->setStorageMode(MTL::StorageModePrivate);
+    MTL::Texture* sparse = heap->newTexture(descriptor);
+    descriptor->release();
+    
+    const uint32_t index = static_cast<uint32_t>(textures.size());
+    SparseTexture& t = textures.emplace_back();
+    t.path = containerPath;
+    t.fd = fd;
+    t.header = *header;
+    t.info = {};
+    
+    MTL::Size tileSize = device->sparseTileSize(MTL::TextureType2D, format, 1);
+    t.info.tileWidth = static_cast<uint32_t>(tileSize.width);
+    t.info.tileHeight = static_cast<uint32_t>(tileSize.height);
+    
+    // The mip tail packs every level smaller than a tile into whole tiles that are mapped together. A chain that ends
+    //  before reaching the tail keeps its coarsest level resident instead.
+    const bool hasTail = sparse->firstMipmapInTail() < header->levelCount;
+    t.info.residentLevel = hasTail ? static_cast<uint32_t>(sparse->firstMipmapInTail()) : header->levelCount - 1;
+    
+    t.firstTile = stampCount;
+    t.tileCount = 0;
+    for (uint32_t level = 0; level < t.info.residentLevel; level++) {
+        MTL::Size grid = tileGridOf(t.info, header->levels[level]);
+        t.info.levelFirstTile[level] = t.firstTile + t.tileCount;
+        t.tileCount += static_cast<uint32_t>(grid.width * grid.height);
+    }
+    
+    MTL::Size residentGrid = tileGridOf(t.info, header->levels[t.info.residentLevel]);
+    const size_t residentTiles = hasTail ? (sparse->tailSizeInBytes() + tileBytes - 1) / tileBytes : residentGrid.width * residentGrid.height;
+    if (pinnedTiles + residentTiles > capacity) {
+        std::cerr << "Texture tile cache: the " << budgetBytes / (1024.0 * 1024.0) << " MB budget can't hold the resident levels of " << containerPath
+                  << " next to those of the " << index << " textures before it\n";
+        exit(1);
+    }
+    pinnedTiles += residentTiles;
+    
+    std::shared_ptr<Texture> texture = std::make_shared<Texture>(sparse, static_cast<int>(header->width), static_cast<int>(header->height), decodeChannelsOf(format));
+    t.texture = texture;
+    
+    UploadPlan plan;
+    std::vector<TileMapping> maps = {{index, t.info.residentLevel, hasTail ? MTL::Region(0, 0, 0, 1, 1, 1) : MTL::Region(0, 0, 0, residentGrid.width, residentGrid.height, 1)}};
+    for (uint32_t level = t.info.residentLevel; level < header->levelCount; level++) {
+        const TextureFileLevel& l = header->levels[level];
+        planRegion(index, level, MTL::Region(0, 0, 0, l.width, l.height, 1), plan);
+    }
+    upload(device, cmdQueue, plan, {}, maps);
+    
+    // Nothing has sampled the new tiles yet, so the grown stamp buffer starts zeroed like the first one. Frames never
+    //  stamp 0.
+    stampCount += t.tileCount;
+    if (stampBuffer) {
+        stampBuffer->release();
+    }
+    stampBuffer = device->newBuffer(std::max<size_t>(stampCount, 1) * sizeof(uint32_t), MTL::ResourceStorageModeShared);
+    std::memset(stampBuffer->contents(), 0, stampBuffer->length());
+    lruPosition.resize(stampCount, lru.end());
+    
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Texture container " << containerPath << " (" << elapsed.count() * 1000 << " ms): " << header->width << "x" << header->height << ", "
+              << t.tileCount << " streamed " << t.info.tileWidth << "x" << t.info.tileHeight << " tiles over " << t.info.residentLevel
+              << " levels, " << residentTiles << " resident\n";
+    return texture;
+}
+
+SparseTextureInfo TextureTileCache::getInfo(const Texture& texture) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const SparseTexture& t : textures) {
+        if (t.texture.get() == &texture) {
+            return t.info;
+        }
+    }
+    return SparseTextureInfo{};
+}
+
+MTL::Buffer* TextureTileCache::getStampBuffer() const {
+    return stampBuffer;
+}
+
+void TextureTileCache::update(MTL::CommandQueue* cmdQueue, uint32_t stamp) {
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    lastFrame = TileCacheFrameStats{};
+    if (stampCount == 0) {
+        return;
+    }
+    
+    // The frame's resident tiles move to the front of the LRU list, and the rest of what it sampled is missing. Coarser
+    //  levels load first, since finer levels fall back on them.
+    const uint32_t* stamps = static_cast<const uint32_t*>(stampBuffer->contents());
+    std::vector<std::pair<uint32_t, uint32_t>> missing;  // Level and tile
+    for (uint32_t tile = 0; tile < stampCount; tile++) {
+        if (stamps[tile] != stamp) {
+            continue;
+        }
+    
+        lastFrame.sampled++;
+        if (lruPosition[tile] != lru.end()) {
+            lastFrame.resident++;
+            lru.splice(lru.begin(), lru, lruPosition[tile]);
+        } else {
+            missing.emplace_back(addressOf(tile).level, tile);
+        }
+    }
+    std::sort(missing.begin(), missing.end(), std::greater<>());
+    
+    // Evicting stops at the first tile the frame sampled, since every tile behind it was sampled too
+    const size_t wanted = std::min(missing.size(), MAX_LOADS_PER_UPDATE);
+    size_t free = capacity - pinnedTiles - lru.size();
+    std::vector<TileMapping> unmaps;
+    while (free < wanted && !lru.empty() && stamps[lru.back()] != stamp) {
+        const uint32_t victim = lru.back();
+        lru.pop_back();
+        lruPosition[victim] = lru.end();
+    
+        TileAddress address = addressOf(victim);
+        unmaps.push_back({address.texture, address.level, MTL::Region(address.x, address.y, 0, 1, 1, 1)});
+        free++;
+    }
+    
+    UploadPlan plan;
+    std::vector<TileMapping> maps;
+    for (size_t i = 0; i < std::min(wanted, free); i++) {
+        const uint32_t tile = missing[i].second;
+        TileAddress address = addressOf(tile);
+        maps.push_back({address.texture, address.level, MTL::Region(address.x, address.y, 0, 1, 1, 1)});
+        planRegion(address.texture, address.level, pixelRegionOf(address), plan);
+    
+        lru.push_front(tile);
+        lruPosition[tile] = lru.begin();
+    }
+    if (!unmaps.empty() || !maps.empty()) {
+        upload(cmdQueue->device(), cmdQueue, plan, unmaps, maps);
+    }
+    
+    lastFrame.loaded = maps.size();
+    lastFrame.evicted = unmaps.size();
+    totalSampled += lastFrame.sampled;
+    totalResident += lastFrame.resident;
+    totalLoaded += lastFrame.loaded;
+    totalEvicted += lastFrame.evicted;
+    
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    lastFrame.ms = elapsed.count() * 1000;
+}
+
+void TextureTileCache::printReport() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    auto percent = [](size_t part, size_t whole) {
+        return whole > 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 100.0;
+    };
+    std::cout << "Texture tiles (" << lastFrame.ms << " ms): " << lastFrame.sampled << " sampled (" << lastFrame.sampled * tileBytes / (1024.0 * 1024.0)
+              << " MB working set), " << percent(lastFrame.resident, lastFrame.sampled) << "% resident (" << percent(totalResident, totalSampled)
+              << "% overall), " << lastFrame.loaded << " loaded, " << lastFrame.evicted << " evicted, " << lru.size() + pinnedTiles << "/"
+              << capacity << " tiles in use\n";
+}
+
+void TextureTileCache::addMemoryUsage(MemoryReport& report) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    
+    size_t gpuBytes = heap ? heap->size() : 0;
+    if (stampBuffer) {
+        gpuBytes += stampBuffer->allocatedSize();
+    }
+    
+    // A list node holds the tile and two links
+    const size_t cpuBytes = lruPosition.capacity() * sizeof(lruPosition[0]) + lru.size() * (sizeof(uint32_t) + 2 * sizeof(void*));
+    report.add(MemorySubsystem::Textures, cpuBytes, gpuBytes);
+}
+
+TextureTileCache::TileAddress TextureTileCache::addressOf(uint32_t tile) const {
+    // Textures own consecutive ranges of tiles in the order they were added. One without streamed tiles shares its first
+    //  tile with the next texture, which is the one found.
+    auto owner = std::upper_bound(textures.begin(), textures.end(), tile, [](uint32_t tile, const SparseTexture& t) {
+        return tile < t.firstTile;
+    });
+    const uint32_t index = static_cast<uint32_t>(owner - textures.begin()) - 1;
+    const SparseTexture& t = textures[index];
+    
+    uint32_t level = 0;
+    while (level + 1 < t.info.residentLevel && t.info.levelFirstTile[level + 1] <= tile) {
+        level++;
+    }
+    
+    const uint32_t tilesX = static_cast<uint32_t>(tileGridOf(t.info, t.header.levels[level]).width);
+    const uint32_t offset = tile - t.info.levelFirstTile[level];
+    return {index, level, offset % tilesX, offset / tilesX};
+}
+
+MTL::Region TextureTileCache::pixelRegionOf(const TileAddress& address) const {
+    const SparseTexture& t = textures[address.texture];
+    const TextureFileLevel& l = t.header.levels[address.level];
+    const uint32_t x = address.x * t.info.tileWidth;
+    const uint32_t y = address.y * t.info.tileHeight;
+    return MTL::Region(x, y, 0, std::min(t.info.tileWidth, l.width - x), std::min(t.info.tileHeight, l.height - y), 1);
+}
+
+void TextureTileCache::planRegion(uint32_t texture, uint32_t level, MTL::Region region, UploadPlan& plan) const {
+    const SparseTexture& t = textures[texture];
+    const TextureFileLevel& l = t.header.levels[level];
+    const TextureTileLayout layout = tileLayoutOf(t.header, level);
+    const uint32_t size = t.header.tileSize;
+    
+    // Stored tiles are addressed in blocks for BC formats and in pixels otherwise
+    const uint32_t unit = blockFormatOf(static_cast<MTL::PixelFormat>(t.header.pixelFormat)) ? 4 : 1;
+    const size_t unitBytes = layout.tileBytesPerRow / (size / unit);
+    
+    const uint32_t x0 = static_cast<uint32_t>(region.origin.x);
+    const uint32_t y0 = static_cast<uint32_t>(region.origin.y);
+    const uint32_t x1 = x0 + static_cast<uint32_t>(region.size.width);
+    const uint32_t y1 = y0 + static_cast<uint32_t>(region.size.height);
+    
+    for (uint32_t tileY = y0 / size; tileY <= (y1 - 1) / size; tileY++) {
+        for (uint32_t tileX = x0 / size; tileX <= (x1 - 1) / size; tileX++) {
+            const uint64_t fileOffset = l.offset + (static_cast<uint64_t>(tileY) * layout.tilesX + tileX) * layout.tileBytes;
+            auto [read, inserted] = plan.stagingOffsets.try_emplace({texture, fileOffset}, plan.stagingBytes);
+            if (inserted) {
+                plan.reads.push_back({texture, fileOffset, layout.tileBytes, plan.stagingBytes});
+                plan.stagingBytes += layout.tileBytes;
+            }
+    
+            // The part of the stored tile inside the region. Sparse and stored tile sizes are multiples of the block
+            //  size, so it starts on a block.
+            const uint32_t left = std::max(x0, tileX * size);
+            const uint32_t top = std::max(y0, tileY * size);
+            const uint32_t right = std::min(x1, (tileX + 1) * size);
+            const uint32_t bottom = std::min(y1, (tileY + 1) * size);
+            const size_t inner = (top - tileY * size) / unit * layout.tileBytesPerRow + (left - tileX * size) / unit * unitBytes;
+            const size_t rows = (bottom - top + unit - 1) / unit;
+    
+            plan.copies.push_back({texture, level, MTL::Region(left, top, 0, right - left, bottom - top, 1), read->second + inner,
+                                   layout.tileBytesPerRow, rows * layout.tileBytesPerRow});
+        }
+    }
+}
+
+void TextureTileCache::upload(MTL::Device* device, MTL::CommandQueue* cmdQueue, const UploadPlan& plan, const std::vector<TileMapping>& unmaps, const std::vector<TileMapping>& maps) const {
+    MTL::Buffer* staging = nullptr;
+    if (plan.stagingBytes > 0) {
+        staging = device->newBuffer(plan.stagingBytes, MTL::ResourceStorageModeShared);
+        trackStagingAlloc(plan.stagingBytes);
+    
+        // Every tile is its own pread, so the worker threads read different tiles at once
+        uint8_t* contents = static_cast<uint8_t*>(staging->contents());
+        parallelFor(plan.reads.size(), 8, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const StoredTileRead& read = plan.reads[i];
+                const SparseTexture& t = textures[read.texture];
+                readFully(t.fd, contents + read.stagingOffset, read.size, read.fileOffset, t.path);
+            }
+        });
+    }
+    
+    MTL::CommandBuffer* cmdBuffer = cmdQueue->commandBuffer();
+    if (!unmaps.empty() || !maps.empty()) {
+        // Unmapping first returns heap tiles for the new mappings to take
+        MTL::ResourceStateCommandEncoder* mappings = cmdBuffer->resourceStateCommandEncoder();
+        for (const TileMapping& unmap : unmaps) {
+            mappings->updateTextureMapping(textures[unmap.texture].texture->texture, MTL::SparseTextureMappingModeUnmap, unmap.region, unmap.level, 0);
+        }
+        for (const TileMapping& map : maps) {
+            mappings->updateTextureMapping(textures[map.texture].texture->texture, MTL::SparseTextureMappingModeMap, map.region, map.level, 0);
+        }
+        mappings->endEncoding();
+    }
+    if (!plan.copies.empty()) {
+        MTL::BlitCommandEncoder* blit = cmdBuffer->blitCommandEncoder();
+        for (const StoredTileCopy& copy : plan.copies) {
+            blit->copyFromBuffer(staging, copy.stagingOffset, copy.bytesPerRow, copy.bytesPerImage, copy.region.size,
+                                 textures[copy.texture].texture->texture, 0, copy.level, copy.region.origin);
+        }
+        blit->endEncoding();
+    }
+    cmdBuffer->commit();
+    cmdBuffer->waitUntilCompleted();
+    
+    if (staging) {
+        staging->release();
+        trackStagingRelease(plan.stagingBytes);
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef texture_tile_cache_hpp
+#define texture_tile_cache_hpp
+
+#include <Metal/Metal.hpp>
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "shared.hpp"
+#include "texture.hpp"
+#include "texture_file.hpp"
+#include "memory_report.hpp"
+
+/// What one update() of a TextureTileCache found and did
+struct TileCacheFrameStats {
+    size_t sampled = 0;   // Tiles the frame stamped, its working set
+    size_t resident = 0;  // Of those, tiles that were already resident
+    size_t loaded = 0;
+    size_t evicted = 0;
+    double ms = 0;
+};
+
+/// Out-of-core textures. Each tiled .rtex container becomes a sparse texture whose tiles are mapped from one sparse heap
+/// the size of the budget, and only its mip tail (the levels smaller than a tile) is resident up front. The kernel stamps
+/// every tile it samples with the frame and falls back to coarser levels where a tile isn't resident. After each frame,
+/// update() reads the stamps, loads the missing tiles from their files, and unmaps the least recently sampled tiles when
+/// the heap is full.
+class TextureTileCache {
+public:
+    /// Tiles are mapped from a heap of budgetBytes, rounded down to whole tiles
+    explicit TextureTileCache(size_t budgetBytes);
+    ~TextureTileCache();
+    
+    TextureTileCache(const TextureTileCache&) = delete;
+    TextureTileCache& operator=(const TextureTileCache&) = delete;
+    
+    /// Creates a sparse texture for a tiled .rtex container and uploads its mip tail. Exits if the file is not a tiled
+    /// container, the GPU has no sparse textures, or the mip tails no longer fit in the budget. Safe to call from several
+    /// threads at once, but not while frames are rendering.
+    std::shared_ptr<Texture> add(const std::string& containerPath, MTL::Device* device, MTL::CommandQueue* cmdQueue);
+    
+    /// How the kernel samples a texture: its tile grid if the cache owns it, otherwise a tileWidth of 0
+    [[nodiscard]] SparseTextureInfo getInfo(const Texture& texture) const;
+    
+    /// One stamp per tile, bound at TILE_STAMP_BUFFER_IDX
+    [[nodiscard]] MTL::Buffer* getStampBuffer() const;
+    
+    /// Reads the stamps of a finished frame, in which the kernel stamped stamp, and loads up to MAX_LOADS_PER_UPDATE of
+    /// the sampled tiles that aren't resident, coarsest levels first. Tiles sampled in this frame are never evicted, so a
+    /// working set larger than the budget loads what fits.
+    void update(MTL::CommandQueue* cmdQueue, uint32_t stamp);
+    
+    /// Prints the last update's working set, hit rate, loads and evictions, and the hit rate over every update
+    void printReport() const;
+    
+    /// Adds the heap and the stamp buffer. The sparse textures themselves hold no memory outside the heap.
+    void addMemoryUsage(MemoryReport& report) const;
+    
+    static constexpr size_t MAX_LOADS_PER_UPDATE = 256;
+
+private:
+    struct SparseTexture {
+        std::shared_ptr<Texture> texture;
+        std::string path;
+        int fd;
+        TextureFileHeader header;
+        SparseTextureInfo info;
+        uint32_t firstTile;  // Its tiles are the stamps from here, over the levels before info.residentLevel
+        uint32_t tileCount;
+    };
+    
+    struct TileAddress {
+        uint32_t texture;
+        uint32_t level;
+        uint32_t x;
+        uint32_t y;
+    };
+    
+    /// A tile region mapped or unmapped in one texture level, in tiles
+    struct TileMapping {
+        uint32_t texture;
+        uint32_t level;
+        MTL::Region region;
+    };
+    
+    /// A tile of a container read into the staging buffer once, however many copies use it
+    struct StoredTileRead {
+        uint32_t texture;
+        uint64_t fileOffset;
+        size_t size;
+        size_t stagingOffset;
+    };
+    
+    /// Part of a stored tile copied into a texture level
+    struct StoredTileCopy {
+        uint32_t texture;
+        uint32_t level;
+        MTL::Region region;
+        size_t stagingOffset;
+        size_t bytesPerRow;
+        size_t bytesPerImage;
+    };
+    
+    struct UploadPlan {
+        std::vector<StoredTileRead> reads;
+        std::vector<StoredTileCopy> copies;
+        std::map<std::pair<uint32_t, uint64_t>, size_t> stagingOffsets;  // Of each read, by texture and file offset
+        size_t stagingBytes = 0;
+    };
+    
+    [[nodiscard]] TileAddress addressOf(uint32_t tile) const;
+    [[nodiscard]] MTL::Region pixelRegionOf(const TileAddress& address) const;
+    
+    /// Adds the reads and copies that fill a pixel region of a texture level from its container's tiles
+    void planRegion(uint32_t texture, uint32_t level, MTL::Region region, UploadPlan& plan) const;
+    
+    /// Reads the plan's tiles in parallel, then unmaps, maps and copies in one command buffer and waits for it
+    void upload(MTL::Device* device, MTL::CommandQueue* cmdQueue, const UploadPlan& plan, const std::vector<TileMapping>& unmaps, const std::vector<TileMapping>& maps) const;
+    
+    size_t budgetBytes;
+    size_t tileBytes = 0;
+    size_t capacity = 0;     // Tiles the heap holds
+    size_t pinnedTiles = 0;  // Taken by the mip tails
+    MTL::Heap* heap = nullptr;
+    MTL::Buffer* stampBuffer = nullptr;
+    uint32_t stampCount = 0;
+    std::vector<SparseTexture> textures;
+    
+    std::list<uint32_t> lru;  // Resident tiles, most recently sampled first
+    std::vector<std::list<uint32_t>::iterator> lruPosition;  // Per tile, lru.end() while it isn't resident
+    
+    TileCacheFrameStats lastFrame;
+    size_t totalSampled = 0;
+    size_t totalResident = 0;
+    size_t totalLoaded = 0;
+    size_t totalEvicted = 0;
+    
+    mutable std::mutex mutex;
+};
+
+#endif /* texture_tile_cache_hpp */
@@ -0,0 +1,104 @@
+#include "batch_reader.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+BatchFileReader::BatchFileReader(const std::vector<std::string>& paths, size_t queueDepth) : files(paths.size()) {
+    start = std::chrono::steady_clock::now();
+    
+    for (size_t i = 0; i < paths.size(); i++) {
+        File& file = files[i];
+        file.path = paths[i];
+        
+        file.fd = open(file.path.c_str(), O_RDONLY);
+        struct stat info;
+        if (file.fd < 0 || fstat(file.fd, &info) != 0) {
+            std::cerr << "Batch reader: " << file.path << ": " << std::strerror(errno) << "\n";
+            exit(1);
+        }
+        
+        file.size = static_cast<size_t>(info.st_size);
+        file.data = std::unique_ptr<uint8_t[]>(new uint8_t[std::max<size_t>(file.size, 1)]);
+        totalBytes += file.size;
+        
+        // The whole file is read anyway, so ask for aggressive read-ahead
+#ifdef __APPLE__
+        fcntl(file.fd, F_RDAHEAD, 1);
+#else
+        posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        
+        for (size_t offset = 0; offset < file.size; offset += BLOCK_SIZE) {
+            blocks.push_back({i, offset, std::min(BLOCK_SIZE, file.size - offset)});
+            file.blocksLeft++;
+        }
+        filesLeft += file.blocksLeft > 0 ? 1 : 0;
+    }
+    
+    workerCount = std::min(std::max<size_t>(queueDepth, 1), blocks.size());
+    workers.reserve(workerCount);
+    for (size_t worker = 0; worker < workerCount; worker++) {
+        workers.emplace_back(&BatchFileReader::work, this);
+    }
+}
+
+BatchFileReader::~BatchFileReader() {
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    
+    for (File& file : files) {
+        close(file.fd);
+    }
+}
+
+void BatchFileReader::work() {
+    for (size_t b = nextBlock++; b < blocks.size(); b = nextBlock++) {
+        const Block& block = blocks[b];
+        File& file = files[block.file];
+        
+        size_t done = 0;
+        while (done < block.size) {
+            ssize_t got = pread(file.fd, file.data.get() + block.offset + done, block.size - done, static_cast<off_t>(block.offset + done));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                std::cerr << "Batch reader: " << file.path << ": " << (got < 0 ? std::strerror(errno) : "file shrank while reading") << "\n";
+                exit(1);
+            }
+            done += static_cast<size_t>(got);
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--file.blocksLeft > 0) {
+            continue;
+        }
+        
+        fileDone.notify_all();
+        if (--filesLeft == 0) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << "Batch reader (" << elapsed.count() * 1000 << " ms): " << files.size() << " files, " << totalBytes / (1024.0 * 1024.0) << " MB, "
+                      << totalBytes / (1024.0 * 1024.0) / std::max(elapsed.count(), 1e-9) << " MB/s with " << workerCount << " reads in flight\n";
+        }
+    }
+}
+
+std::span<const uint8_t> BatchFileReader::wait(size_t file) {
+    std::unique_lock<std::mutex> lock(mutex);
+    fileDone.wait(lock, [&] { return files[file].blocksLeft == 0; });
+    
+    return std::span<const uint8_t>(files[file].data.get(), files[file].size);
+}
+
+void BatchFileReader::release(size_t file) {
+    std::lock_guard<std::mutex> lock(mutex);
+    assert(files[file].blocksLeft == 0);
+    files[file].data.reset();
+}
@@ -0,0 +1,67 @@
+#ifndef batch_reader_hpp
+#define batch_reader_hpp
+
+#include <string>
+#include <vector>
+#include <span>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+/// Reads many whole files at once. Every file is split into blocks and all blocks are queued up front, then serviced by a
+/// pool of pread workers, so the storage sees up to queueDepth requests in flight instead of one. Files are read in the
+/// order given and each can be taken as soon as its own blocks are done.
+class BatchFileReader {
+public:
+    static constexpr size_t DEFAULT_QUEUE_DEPTH = 16;
+    static constexpr size_t BLOCK_SIZE = 4 << 20;
+    
+    /// Opens every file and starts reading in the background. Exits if a file can't be opened.
+    explicit BatchFileReader(const std::vector<std::string>& paths, size_t queueDepth = DEFAULT_QUEUE_DEPTH);
+    ~BatchFileReader();
+    
+    BatchFileReader(const BatchFileReader&) = delete;
+    BatchFileReader& operator=(const BatchFileReader&) = delete;
+    
+    /// Blocks until the file has been read completely and returns its bytes, valid until release or destruction
+    [[nodiscard]] std::span<const uint8_t> wait(size_t file);
+    
+    /// Frees a file's bytes once they have been decoded
+    void release(size_t file);
+
+private:
+    struct File {
+        std::string path;
+        int fd = -1;
+        size_t size = 0;
+        std::unique_ptr<uint8_t[]> data;
+        size_t blocksLeft = 0;
+    };
+    
+    struct Block {
+        size_t file;
+        size_t offset;
+        size_t size;
+    };
+    
+    void work();
+    
+    std::vector<File> files;
+    std::vector<Block> blocks;
+    std::atomic<size_t> nextBlock = 0;
+    std::vector<std::thread> workers;
+    size_t workerCount = 0;
+    
+    std::mutex mutex;
+    std::condition_variable fileDone;
+    size_t filesLeft = 0;
+    size_t totalBytes = 0;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif /* batch_reader_hpp */
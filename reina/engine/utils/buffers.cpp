@@ -1,8 +1,10 @@
 #include "buffers.hpp"
+#include "memory_report.hpp"
 
-MTL::Buffer* makePrivateBuffer(MTL::Device* device, MTL::CommandQueue* cmdQueue, void* data, uint32_t size) {
+MTL::Buffer* makePrivateBuffer(MTL::Device* device, MTL::CommandQueue* cmdQueue, const void* data, size_t size) {
     MTL::Buffer* staging = device->newBuffer(data, size, MTL::StorageModeShared);
     MTL::Buffer* dst = device->newBuffer(size, MTL::ResourceStorageModePrivate);
+    trackStagingAlloc(size);
     
     MTL::CommandBuffer* cmdBuffer = cmdQueue->commandBuffer();
     MTL::BlitCommandEncoder* blit = cmdBuffer->blitCommandEncoder();
@@ -12,6 +14,7 @@ MTL::Buffer* makePrivateBuffer(MTL::Device* device, MTL::CommandQueue* cmdQueue,
     cmdBuffer->waitUntilCompleted();
     
     staging->release();
+    trackStagingRelease(size);
     
     return dst;
 }
@@ -3,6 +3,6 @@
 
 #include <Metal/Metal.hpp>
 
-MTL::Buffer* makePrivateBuffer(MTL::Device* device, MTL::CommandQueue* cmdQueue, void* data, uint32_t size);
+MTL::Buffer* makePrivateBuffer(MTL::Device* device, MTL::CommandQueue* cmdQueue, const void* data, size_t size);
 
 #endif /* buffers_hpp */
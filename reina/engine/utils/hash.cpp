@@ -0,0 +1,17 @@
+#include "hash.hpp"
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = hashCombine(seed, static_cast<uint64_t>(size));
+    
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = hashCombine(hash, word);
+    }
+    
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes + i, size - i);
+    return hashCombine(hash, tail);
+}
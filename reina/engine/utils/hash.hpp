@@ -0,0 +1,24 @@
+#ifndef hash_hpp
+#define hash_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+/// Mixes a 64-bit value into a running hash
+inline uint64_t hashCombine(uint64_t seed, uint64_t value) {
+    value *= 0x9E3779B97F4A7C15ull;
+    value ^= value >> 32;
+    return (seed ^ value) * 0xD6E8FEB86659FD93ull + 0x632BE59BD9B4E019ull;
+}
+
+inline uint64_t hashCombine(uint64_t seed, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return hashCombine(seed, static_cast<uint64_t>(bits));
+}
+
+/// Hashes a byte range eight bytes at a time. Not cryptographic, only meant for content deduplication.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+#endif /* hash_hpp */
@@ -0,0 +1,303 @@
+#include "json.hpp"
+
+#include <cstdlib>
+#include <cstdint>
+#include <cctype>
+
+namespace {
+
+class JsonParser {
+public:
+    JsonParser(std::string_view text, std::string& error) : text(text), error(error) {}
+    
+    bool parseDocument(JsonValue& out) {
+        if (!parseValue(out, 0)) {
+            return false;
+        }
+        
+        skipWhitespace();
+        if (pos != text.size()) {
+            return fail("trailing characters");
+        }
+        return true;
+    }
+    
+private:
+    static constexpr int MAX_DEPTH = 256;
+    
+    std::string_view text;
+    std::string& error;
+    size_t pos = 0;
+    
+    bool fail(const char* message) {
+        error = std::string(message) + " at byte " + std::to_string(pos);
+        return false;
+    }
+    
+    void skipWhitespace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            pos++;
+        }
+    }
+    
+    bool consume(std::string_view literal) {
+        if (text.substr(pos, literal.size()) != literal) {
+            return false;
+        }
+        pos += literal.size();
+        return true;
+    }
+    
+    bool parseValue(JsonValue& out, int depth) {
+        if (depth > MAX_DEPTH) {
+            return fail("nesting too deep");
+        }
+        
+        skipWhitespace();
+        if (pos >= text.size()) {
+            return fail("unexpected end of input");
+        }
+        
+        char c = text[pos];
+        if (c == '{') {
+            return parseObject(out, depth);
+        }
+        if (c == '[') {
+            return parseArray(out, depth);
+        }
+        if (c == '"') {
+            out.type = JsonValue::Type::String;
+            return parseString(out.string);
+        }
+        if (consume("true")) {
+            out.type = JsonValue::Type::Bool;
+            out.boolean = true;
+            return true;
+        }
+        if (consume("false")) {
+            out.type = JsonValue::Type::Bool;
+            out.boolean = false;
+            return true;
+        }
+        if (consume("null")) {
+            out.type = JsonValue::Type::Null;
+            return true;
+        }
+        return parseNumber(out);
+    }
+    
+    bool parseObject(JsonValue& out, int depth) {
+        out.type = JsonValue::Type::Object;
+        pos++;  // {
+        
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == '}') {
+            pos++;
+            return true;
+        }
+        
+        while (true) {
+            skipWhitespace();
+            if (pos >= text.size() || text[pos] != '"') {
+                return fail("expected object key");
+            }
+            
+            std::string key;
+            if (!parseString(key)) {
+                return false;
+            }
+            
+            skipWhitespace();
+            if (pos >= text.size() || text[pos] != ':') {
+                return fail("expected ':'");
+            }
+            pos++;
+            
+            out.object.emplace_back(std::move(key), JsonValue{});
+            if (!parseValue(out.object.back().second, depth + 1)) {
+                return false;
+            }
+            
+            skipWhitespace();
+            if (pos < text.size() && text[pos] == ',') {
+                pos++;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == '}') {
+                pos++;
+                return true;
+            }
+            return fail("expected ',' or '}'");
+        }
+    }
+    
+    bool parseArray(JsonValue& out, int depth) {
+        out.type = JsonValue::Type::Array;
+        pos++;  // [
+        
+        skipWhitespace();
+        if (pos < text.size() && text[pos] == ']') {
+            pos++;
+            return true;
+        }
+        
+        while (true) {
+            out.array.emplace_back();
+            if (!parseValue(out.array.back(), depth + 1)) {
+                return false;
+            }
+            
+            skipWhitespace();
+            if (pos < text.size() && text[pos] == ',') {
+                pos++;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == ']') {
+                pos++;
+                return true;
+            }
+            return fail("expected ',' or ']'");
+        }
+    }
+    
+    static void appendUtf8(std::string& out, uint32_t codepoint) {
+        if (codepoint < 0x80) {
+            out += static_cast<char>(codepoint);
+        } else if (codepoint < 0x800) {
+            out += static_cast<char>(0xC0 | (codepoint >> 6));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        } else if (codepoint < 0x10000) {
+            out += static_cast<char>(0xE0 | (codepoint >> 12));
+            out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (codepoint >> 18));
+            out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (codepoint & 0x3F));
+        }
+    }
+    
+    bool parseHex4(uint32_t& out) {
+        if (pos + 4 > text.size()) {
+            return fail("truncated \\u escape");
+        }
+        
+        out = 0;
+        for (int i = 0; i < 4; i++) {
+            char h = text[pos++];
+            out <<= 4;
+            if (h >= '0' && h <= '9') out |= h - '0';
+            else if (h >= 'a' && h <= 'f') out |= h - 'a' + 10;
+            else if (h >= 'A' && h <= 'F') out |= h - 'A' + 10;
+            else return fail("bad \\u escape");
+        }
+        return true;
+    }
+    
+    bool parseString(std::string& out) {
+        pos++;  // opening quote
+        
+        while (pos < text.size()) {
+            char c = text[pos++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            
+            if (pos >= text.size()) {
+                break;
+            }
+            
+            char escape = text[pos++];
+            switch (escape) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t codepoint;
+                    if (!parseHex4(codepoint)) {
+                        return false;
+                    }
+                    
+                    // Surrogate pairs encode code points above the BMP
+                    if (codepoint >= 0xD800 && codepoint < 0xDC00 && consume("\\u")) {
+                        uint32_t low;
+                        if (!parseHex4(low)) {
+                            return false;
+                        }
+                        codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    appendUtf8(out, codepoint);
+                    break;
+                }
+                default:
+                    return fail("bad escape");
+            }
+        }
+        
+        return fail("unterminated string");
+    }
+    
+    bool parseNumber(JsonValue& out) {
+        size_t start = pos;
+        while (pos < text.size() && (std::isdigit(static_cast<unsigned char>(text[pos])) || text[pos] == '-' || text[pos] == '+' || text[pos] == '.' || text[pos] == 'e' || text[pos] == 'E')) {
+            pos++;
+        }
+        
+        if (start == pos) {
+            return fail("unexpected character");
+        }
+        
+        std::string token(text.substr(start, pos - start));
+        char* end = nullptr;
+        out.number = std::strtod(token.c_str(), &end);
+        if (end != token.c_str() + token.size()) {
+            pos = start;
+            return fail("bad number");
+        }
+        
+        out.type = JsonValue::Type::Number;
+        return true;
+    }
+};
+
+}
+
+const JsonValue* JsonValue::find(std::string_view key) const {
+    for (const auto& [name, value] : object) {
+        if (name == key) {
+            return &value;
+        }
+    }
+    return nullptr;
+}
+
+double JsonValue::getNumber(std::string_view key, double fallback) const {
+    const JsonValue* value = find(key);
+    return value && value->isNumber() ? value->number : fallback;
+}
+
+std::string JsonValue::getString(std::string_view key, const std::string& fallback) const {
+    const JsonValue* value = find(key);
+    return value && value->isString() ? value->string : fallback;
+}
+
+bool JsonValue::getBool(std::string_view key, bool fallback) const {
+    const JsonValue* value = find(key);
+    return value && value->type == Type::Bool ? value->boolean : fallback;
+}
+
+bool parseJson(std::string_view text, JsonValue& out, std::string& error) {
+    out = JsonValue{};
+    JsonParser parser(text, error);
+    return parser.parseDocument(out);
+}
@@ -0,0 +1,39 @@
+#ifndef json_hpp
+#define json_hpp
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/// Minimal JSON document tree. Objects keep their keys in file order and are searched linearly, which is fine for the
+/// small headers and scene descriptions it is used for.
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+    
+    Type type = Type::Null;
+    bool boolean = false;
+    double number = 0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::vector<std::pair<std::string, JsonValue>> object;
+    
+    [[nodiscard]] bool isNull() const { return type == Type::Null; }
+    [[nodiscard]] bool isNumber() const { return type == Type::Number; }
+    [[nodiscard]] bool isString() const { return type == Type::String; }
+    [[nodiscard]] bool isArray() const { return type == Type::Array; }
+    [[nodiscard]] bool isObject() const { return type == Type::Object; }
+    
+    /// Member with the given key, or nullptr if this is not an object or has no such member
+    [[nodiscard]] const JsonValue* find(std::string_view key) const;
+    
+    [[nodiscard]] double getNumber(std::string_view key, double fallback) const;
+    [[nodiscard]] std::string getString(std::string_view key, const std::string& fallback = "") const;
+    [[nodiscard]] bool getBool(std::string_view key, bool fallback) const;
+};
+
+/// Parses a complete JSON document. On failure returns false and describes the problem (with its byte offset) in error.
+bool parseJson(std::string_view text, JsonValue& out, std::string& error);
+
+#endif /* json_hpp */
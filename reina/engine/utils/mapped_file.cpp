@@ -0,0 +1,67 @@
+#include "mapped_file.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <algorithm>
+
+MappedFile::MappedFile(const std::string& filepath) {
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Could not open " << filepath << "\n";
+        exit(1);
+    }
+    
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        std::cerr << "Could not stat " << filepath << "\n";
+        exit(1);
+    }
+    
+    length = static_cast<size_t>(st.st_size);
+    if (length > 0) {
+        void* ptr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            std::cerr << "Could not map " << filepath << "\n";
+            exit(1);
+        }
+        mapping = static_cast<const uint8_t*>(ptr);
+    }
+    
+    // The mapping keeps its own reference to the file
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (mapping) {
+        munmap(const_cast<uint8_t*>(mapping), length);
+    }
+}
+
+const uint8_t* MappedFile::data() const {
+    return mapping;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+void MappedFile::adviseSequential() const {
+    if (mapping) {
+        madvise(const_cast<uint8_t*>(mapping), length, MADV_SEQUENTIAL);
+    }
+}
+
+void MappedFile::release(size_t offset, size_t size) const {
+    if (!mapping || offset >= length) {
+        return;
+    }
+    
+    const size_t pageSize = static_cast<size_t>(getpagesize());
+    size_t begin = offset / pageSize * pageSize;
+    size_t end = std::min(length, offset + size);
+    madvise(const_cast<uint8_t*>(mapping + begin), end - begin, MADV_DONTNEED);
+}
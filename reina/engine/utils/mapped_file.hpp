@@ -0,0 +1,33 @@
+#ifndef mapped_file_hpp
+#define mapped_file_hpp
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+/// Read-only memory mapping of a whole file. Pages are faulted in by the OS as they are touched, so nothing is read up
+/// front.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filepath);
+    ~MappedFile();
+    
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    
+    [[nodiscard]] const uint8_t* data() const;
+    [[nodiscard]] size_t size() const;
+    
+    /// Hints that the file will be read front to back so the OS reads ahead aggressively
+    void adviseSequential() const;
+    
+    /// Drops the resident pages of a range that has been consumed. They are re-read from disk if touched again, which lets
+    /// files larger than RAM be streamed through the mapping.
+    void release(size_t offset, size_t size) const;
+    
+private:
+    const uint8_t* mapping = nullptr;
+    size_t length = 0;
+};
+
+#endif /* mapped_file_hpp */
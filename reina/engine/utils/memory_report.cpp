@@ -0,0 +1,50 @@
+#include "memory_report.hpp"
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+std::atomic<size_t> stagingBytes = 0;
+std::atomic<size_t> peakStagingBytes = 0;
+
+}
+
+void MemoryReport::add(MemorySubsystem subsystem, size_t cpu, size_t gpu) {
+    cpuBytes[static_cast<size_t>(subsystem)] += cpu;
+    gpuBytes[static_cast<size_t>(subsystem)] += gpu;
+}
+
+void MemoryReport::print() const {
+    static const char* names[MEMORY_SUBSYSTEM_COUNT] = {"geometry", "accel structs", "textures", "framebuffers", "staging (peak)"};
+    constexpr double MB = 1024.0 * 1024.0;
+    
+    size_t cpuTotal = 0;
+    size_t gpuTotal = 0;
+    
+    std::cout << "Memory:\n" << std::fixed << std::setprecision(2);
+    for (size_t i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+        std::cout << "  " << std::left << std::setw(16) << names[i] << std::right
+                  << std::setw(10) << cpuBytes[i] / MB << " MB CPU" << std::setw(10) << gpuBytes[i] / MB << " MB GPU\n";
+        cpuTotal += cpuBytes[i];
+        gpuTotal += gpuBytes[i];
+    }
+    std::cout << "  " << std::left << std::setw(16) << "total" << std::right
+              << std::setw(10) << cpuTotal / MB << " MB CPU" << std::setw(10) << gpuTotal / MB << " MB GPU\n";
+    std::cout << std::defaultfloat;
+}
+
+void trackStagingAlloc(size_t bytes) {
+    size_t now = stagingBytes += bytes;
+    size_t peak = peakStagingBytes.load();
+    while (now > peak && !peakStagingBytes.compare_exchange_weak(peak, now)) {}
+}
+
+void trackStagingRelease(size_t bytes) {
+    stagingBytes -= bytes;
+}
+
+size_t getPeakStagingBytes() {
+    return peakStagingBytes;
+}
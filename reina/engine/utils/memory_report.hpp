@@ -0,0 +1,33 @@
+#ifndef memory_report_hpp
+#define memory_report_hpp
+
+#include <cstddef>
+
+enum class MemorySubsystem {
+    Geometry,
+    AccelerationStructures,
+    Textures,
+    Framebuffers,
+    Staging
+};
+
+constexpr size_t MEMORY_SUBSYSTEM_COUNT = 5;
+
+/// Bytes held per subsystem, split into CPU and GPU memory. Each owner adds what it holds and the engine prints the total.
+class MemoryReport {
+public:
+    void add(MemorySubsystem subsystem, size_t cpuBytes, size_t gpuBytes);
+    void print() const;
+
+private:
+    size_t cpuBytes[MEMORY_SUBSYSTEM_COUNT] = {};
+    size_t gpuBytes[MEMORY_SUBSYSTEM_COUNT] = {};
+};
+
+/// Staging and scratch buffers only live for the duration of an upload or build, so they are counted as they are created
+/// and released and reported by their peak. Safe to call from several threads.
+void trackStagingAlloc(size_t bytes);
+void trackStagingRelease(size_t bytes);
+[[nodiscard]] size_t getPeakStagingBytes();
+
+#endif /* memory_report_hpp */
@@ -0,0 +1,36 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+void parallelFor(size_t count, size_t minChunk, const std::function<void(size_t begin, size_t end)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    
+    size_t maxChunks = (count + std::max<size_t>(minChunk, 1) - 1) / std::max<size_t>(minChunk, 1);
+    size_t chunkCount = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), maxChunks);
+    if (chunkCount <= 1) {
+        fn(0, count);
+        return;
+    }
+    
+    size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    std::vector<std::thread> threads;
+    threads.reserve(chunkCount - 1);
+    
+    // The caller takes the first chunk itself instead of idling on join
+    for (size_t chunk = 1; chunk < chunkCount; chunk++) {
+        size_t begin = chunk * chunkSize;
+        size_t end = std::min(count, begin + chunkSize);
+        if (begin < end) {
+            threads.emplace_back(fn, begin, end);
+        }
+    }
+    fn(0, std::min(count, chunkSize));
+    
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
@@ -0,0 +1,11 @@
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <functional>
+#include <cstddef>
+
+/// Splits [0, count) into contiguous chunks of at least minChunk items and runs fn(begin, end) for each chunk on its own
+/// thread, up to one per hardware thread. Returns once every chunk is done. Small ranges run inline on the caller.
+void parallelFor(size_t count, size_t minChunk, const std::function<void(size_t begin, size_t end)>& fn);
+
+#endif /* parallel_hpp */
@@ -0,0 +1,186 @@
+#include "task_graph.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <algorithm>
+#include <cassert>
+
+TaskGraph::TaskId TaskGraph::add(const std::string& name, std::function<void()> fn, const std::vector<TaskId>& dependencies, bool mainThread) {
+    TaskId id = tasks.size();
+    
+    Task task;
+    task.name = name;
+    task.fn = std::move(fn);
+    task.dependencies = dependencies;
+    task.mainThread = mainThread;
+    
+    for (TaskId dependency : dependencies) {
+        assert(dependency < id);
+        tasks[dependency].dependents.push_back(id);
+    }
+    
+    tasks.push_back(std::move(task));
+    return id;
+}
+
+void TaskGraph::run() {
+    auto origin = std::chrono::steady_clock::now();
+    auto msSinceOrigin = [&] {
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - origin;
+        return elapsed.count() * 1000;
+    };
+    
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<TaskId> workerQueue;
+    std::deque<TaskId> mainQueue;
+    size_t remaining = tasks.size();
+    size_t mainRemaining = 0;
+    
+    for (TaskId id = 0; id < tasks.size(); id++) {
+        Task& task = tasks[id];
+        task.waitingOn = task.dependencies.size();
+        mainRemaining += task.mainThread ? 1 : 0;
+        
+        if (task.waitingOn == 0) {
+            (task.mainThread ? mainQueue : workerQueue).push_back(id);
+        }
+    }
+    
+    // Runs a task with the lock released, then releases its dependents. Called and returns with the lock held.
+    auto execute = [&](TaskId id, size_t thread, std::unique_lock<std::mutex>& lock) {
+        Task& task = tasks[id];
+        
+        lock.unlock();
+        double startMs = msSinceOrigin();
+        task.fn();
+        double endMs = msSinceOrigin();
+        lock.lock();
+        
+        task.thread = thread;
+        task.startMs = startMs;
+        task.endMs = endMs;
+        
+        remaining--;
+        mainRemaining -= task.mainThread ? 1 : 0;
+        for (TaskId dependent : task.dependents) {
+            if (--tasks[dependent].waitingOn == 0) {
+                (tasks[dependent].mainThread ? mainQueue : workerQueue).push_back(dependent);
+            }
+        }
+        wake.notify_all();
+    };
+    
+    size_t workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    workerCount = std::min(workerCount, tasks.size() - mainRemaining);
+    
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount);
+    for (size_t worker = 0; worker < workerCount; worker++) {
+        workers.emplace_back([&, thread = worker + 1] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                wake.wait(lock, [&] { return remaining == 0 || !workerQueue.empty(); });
+                if (workerQueue.empty()) {
+                    return;
+                }
+                
+                TaskId id = workerQueue.front();
+                workerQueue.pop_front();
+                execute(id, thread, lock);
+            }
+        });
+    }
+    
+    // The calling thread owns the main thread tasks. It only helps with worker tasks once all of those are done, so a long
+    //  worker task can never delay one of them.
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (remaining > 0) {
+            wake.wait(lock, [&] { return remaining == 0 || !mainQueue.empty() || (mainRemaining == 0 && !workerQueue.empty()); });
+            
+            if (!mainQueue.empty()) {
+                TaskId id = mainQueue.front();
+                mainQueue.pop_front();
+                execute(id, 0, lock);
+            } else if (mainRemaining == 0 && !workerQueue.empty()) {
+                TaskId id = workerQueue.front();
+                workerQueue.pop_front();
+                execute(id, 0, lock);
+            }
+        }
+    }
+    
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    
+    wallMs = msSinceOrigin();
+}
+
+void TaskGraph::printTimeline() const {
+    constexpr int BAR_WIDTH = 60;
+    
+    size_t nameWidth = 0;
+    double summedMs = 0;
+    for (const Task& task : tasks) {
+        nameWidth = std::max(nameWidth, task.name.size());
+        summedMs += task.endMs - task.startMs;
+    }
+    
+    const double msPerColumn = std::max(wallMs, 1e-3) / BAR_WIDTH;
+    
+    std::cout << "Startup timeline (" << wallMs << " ms wall, " << summedMs << " ms summed over tasks):\n";
+    for (const Task& task : tasks) {
+        int first = std::min(static_cast<int>(task.startMs / msPerColumn), BAR_WIDTH - 1);
+        int last = std::clamp(static_cast<int>(task.endMs / msPerColumn), first, BAR_WIDTH - 1);
+        
+        std::string bar(BAR_WIDTH, ' ');
+        std::fill(bar.begin() + first, bar.begin() + last + 1, '#');
+        
+        std::cout << "  " << std::left << std::setw(static_cast<int>(nameWidth)) << task.name << std::right
+                  << " t" << std::setw(2) << task.thread << " |" << bar << "| "
+                  << std::fixed << std::setprecision(1) << task.startMs << " - " << task.endMs << " ms\n"
+                  << std::defaultfloat << std::setprecision(6);
+    }
+    
+    if (tasks.empty()) {
+        return;
+    }
+    
+    // Walk back from the task that finished last, each time to the dependency that finished last, i.e. the one that
+    //  actually held the task back
+    std::vector<TaskId> path;
+    TaskId current = 0;
+    for (TaskId id = 1; id < tasks.size(); id++) {
+        if (tasks[id].endMs > tasks[current].endMs) {
+            current = id;
+        }
+    }
+    
+    while (true) {
+        path.push_back(current);
+        
+        const std::vector<TaskId>& dependencies = tasks[current].dependencies;
+        if (dependencies.empty()) {
+            break;
+        }
+        current = *std::max_element(dependencies.begin(), dependencies.end(), [&](TaskId a, TaskId b) {
+            return tasks[a].endMs < tasks[b].endMs;
+        });
+    }
+    
+    double pathMs = 0;
+    std::cout << "Critical path:";
+    for (auto it = path.rbegin(); it != path.rend(); it++) {
+        const Task& task = tasks[*it];
+        pathMs += task.endMs - task.startMs;
+        std::cout << (it == path.rbegin() ? " " : " -> ") << task.name << " (" << task.endMs - task.startMs << " ms)";
+    }
+    std::cout << "\n  " << pathMs << " ms of work on the path, " << wallMs - pathMs << " ms between them\n";
+}
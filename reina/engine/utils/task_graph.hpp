@@ -0,0 +1,43 @@
+#ifndef task_graph_hpp
+#define task_graph_hpp
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+/// Tasks with dependencies, run on a pool of threads as soon as everything they depend on has finished. Records when each
+/// task ran, so the timeline and the critical path through it can be printed afterwards.
+class TaskGraph {
+public:
+    using TaskId = size_t;
+    
+    /// Adds a task that starts once every task in dependencies has finished. Dependencies must already be added, so the
+    /// graph can't have cycles. Main thread tasks only run on the thread that calls run(), for APIs such as AppKit that
+    /// require it.
+    TaskId add(const std::string& name, std::function<void()> fn, const std::vector<TaskId>& dependencies = {}, bool mainThread = false);
+    
+    /// Runs every task and returns once all have finished. Ready tasks start in the order they were added.
+    void run();
+    
+    /// Prints each task as a bar on a shared time axis, then the chain of tasks that determined the total time
+    void printTimeline() const;
+
+private:
+    struct Task {
+        std::string name;
+        std::function<void()> fn;
+        std::vector<TaskId> dependencies;
+        std::vector<TaskId> dependents;
+        bool mainThread = false;
+        size_t waitingOn = 0;
+        size_t thread = 0;  // 0 is the thread that called run()
+        double startMs = 0;
+        double endMs = 0;
+    };
+    
+    std::vector<Task> tasks;
+    double wallMs = 0;
+};
+
+#endif /* task_graph_hpp */
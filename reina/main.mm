@@ -1,12 +1,58 @@
 #include "mtl_engine.hpp"
+#include "texture_file.hpp"
+#include "orm_packing.hpp"
 
 #include <stb/stb_image.h>
 
-int main() {
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <optional>
+#include <vector>
+#include <string>
+
+int main(int argc, char** argv) {
+    // Converts a PNG or JPG to a .rtex container offline, so scenes can map it instead of decoding at load time
+    if (argc > 1 && std::strcmp(argv[1], "--convert-texture") == 0) {
+        std::optional<MTL::PixelFormat> format;
+        int tileSize = 0;
+        if (argc >= 4 && argc <= 8) {
+            format = textureFormatFromNames(argc > 4 ? argv[4] : "srgb", argc > 5 ? argv[5] : "none", argc > 7 ? std::atoi(argv[7]) : 0);
+            tileSize = argc > 6 ? std::atoi(argv[6]) : 0;
+        }
+        if (!format || tileSize < 0 || tileSize % 4 != 0) {
+            std::cerr << "Usage: " << argv[0] << " --convert-texture <source> <destination.rtex> [srgb|linear] [none|bc1|bc4|bc5|bc7] [tile size] [channels]\n";
+            return 1;
+        }
+        
+        convertTexture(argv[2], argv[3], *format, static_cast<uint32_t>(tileSize));
+        return 0;
+    }
+    
+    // Packs occlusion, roughness and metalness maps into one linear .rtex texture; "-" leaves a channel at its default
+    if (argc > 1 && std::strcmp(argv[1], "--pack-orm") == 0) {
+        std::optional<MTL::PixelFormat> format;
+        int tileSize = 0;
+        if (argc >= 6 && argc <= 8) {
+            format = textureFormatFromNames("linear", argc > 6 ? argv[6] : "none", 4);
+            tileSize = argc > 7 ? std::atoi(argv[7]) : 0;
+        }
+        if (!format || tileSize < 0 || tileSize % 4 != 0) {
+            std::cerr << "Usage: " << argv[0] << " --pack-orm <destination.rtex> <occlusion|-> <roughness|-> <metalness|-> [none|bc1|bc7] [tile size]\n";
+            return 1;
+        }
+        
+        auto source = [](const char* path) { return std::strcmp(path, "-") == 0 ? std::string() : std::string(path); };
+        int width, height;
+        std::vector<uint8_t> packed = packOrm(OrmSources{source(argv[3]), source(argv[4]), source(argv[5])}, width, height);
+        writeTextureFile(packed.data(), width, height, argv[2], *format, static_cast<uint32_t>(tileSize));
+        return 0;
+    }
+    
     MTLEngine engine;
-    engine.init();
+    engine.init(argc > 1 ? argv[1] : "assets/scenes/default.json");
     engine.run();
     engine.cleanup();
-
+    
     return 0;
 }
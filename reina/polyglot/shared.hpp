@@ -10,39 +10,70 @@
 // #define DEBUG_SHOW_NORMALS
 // #define DEBUG_DISABLE_TONEMAPPING
 // #define DEBUG_SKY_COLOR_GRAY
+// #define DEBUG_VALIDATE_VERTEX_COMPRESSION  // On by default in Debug builds, below
 #define SKIP_NAN_SAMPLES
+// #define QUANTIZE_POSITIONS  // 16-bit positions relative to each model's bounds instead of 32-bit floats
+// #define APPLY_OCCLUSION_MAPS  // Darken diffuse bounces by occlusion maps. Paths already find that occlusion, so it counts twice
 
 #ifdef DEBUG_SHOW_NORMALS
 #define DEBUG_DISABLE_TONEMAPPING
 #define DEBUG_SKY_COLOR_GRAY
 #endif
 
+// Xcode's Debug configuration defines DEBUG; NDEBUG is left undefined in every configuration
+#if defined(DEBUG) && !defined(DEBUG_VALIDATE_VERTEX_COMPRESSION)
+#define DEBUG_VALIDATE_VERTEX_COMPRESSION
+#endif
+
 SHARED_CONST float EPS = 1e-7;
 
 SHARED_CONST uint INPUT_TEXTURE_IDX = 0;
 SHARED_CONST uint OUTPUT_TEXTURE_IDX = 1;
 SHARED_CONST uint ACC_STRUCT_BUFFER_IDX = 0;
 SHARED_CONST uint CAMERA_BUFFER_IDX = 1;
-SHARED_CONST uint VERTICES_BUFFER_IDX = 2;
+SHARED_CONST uint POSITION_BUFFER_IDX = 2;
 SHARED_CONST uint INDICES_BUFFER_IDX = 3;
 SHARED_CONST uint FRAME_PARAMS_BUFFER_IDX = 4;
 SHARED_CONST uint INSTANCE_DATA_BUFFER_IDX = 5;
 SHARED_CONST uint MATERIAL_BUFFER_IDX = 6;
 SHARED_CONST uint TEXTURE_ARRAY_BUFFER_IDX = 7;
+SHARED_CONST uint SUBMESH_BUFFER_IDX = 8;
+SHARED_CONST uint INSTANCE_MATERIAL_BUFFER_IDX = 9;
+SHARED_CONST uint SHADING_BUFFER_IDX = 10;
+SHARED_CONST uint SPARSE_TEXTURE_INFO_BUFFER_IDX = 11;
+SHARED_CONST uint TILE_STAMP_BUFFER_IDX = 12;
 SHARED_CONST uint NUM_TEXTURES = 16;
 SHARED_CONST uint TEXTURE_ARRAY_IDX = 2;  // Binds textures from TEXTURE_ARRAY_IDX to TEXTURE_ARRAY_IDX + NUM_TEXTURES - 1
+SHARED_CONST uint ATLAS_MIP_LEVELS = 4;  // Mip levels of an atlas entry its gutters keep free of neighbouring entries
+SHARED_CONST uint MAX_TEXTURE_LEVELS = 16;
 
 #ifdef __METAL_VERSION__
     #include <metal_stdlib>
     #define MATH_PREFIX metal
 #else
     #include <simd/simd.h>
+    #include <cstdint>
+    #include <cstring>
     #define MATH_PREFIX simd
 #endif
 
+#ifdef __METAL_VERSION__
+    typedef packed_float2 PackedFloat2;
+    typedef packed_float3 PackedFloat3;
+#else
+    struct PackedFloat2 { float x, y; };
+    struct PackedFloat3 { float x, y, z; };
+#endif
+
+/// Unorm16 position relative to the owning model's bounds. w is padding so each vertex stays 8-byte aligned.
+struct QuantizedPosition {
+    uint16_t x, y, z, w;
+};
+
 struct CameraData {
     MATH_PREFIX::float4x4 invView;
     MATH_PREFIX::float4x4 invProj;
+    float pixelSpreadAngle;  // Angle one pixel subtends, the spread of a camera ray's cone
 };
 
 struct FrameParams {
@@ -50,6 +81,17 @@ struct FrameParams {
     uint samplesPerBatch;
 };
 
+/// How the kernel samples one texture slot. tileWidth is 0 for a fully resident texture. A sparse texture of a
+/// TextureTileCache is split into tiles of tileWidth x tileHeight per level, and the kernel stamps each tile it samples in
+/// the tile stamp buffer, a level's tiles in row-major order from levelFirstTile.
+struct SparseTextureInfo {
+    uint32_t tileWidth;
+    uint32_t tileHeight;
+    uint32_t residentLevel;  // Levels from this one on are always resident, so sampling can fall back to it
+    uint32_t reserved;
+    uint32_t levelFirstTile[MAX_TEXTURE_LEVELS];
+};
+
 struct FullscreenQuadVertexData {
     MATH_PREFIX::float4 position;
     MATH_PREFIX::float2 textureCoordinate;
@@ -60,16 +102,28 @@ struct Material {
     int32_t textureID;
     int32_t normalMapID;
     int32_t roughnessMapID;
+    int32_t metalnessMapID;
+    int32_t occlusionMapID;
+    uint32_t roughnessChannel;  // Channel of its map each value is read from, so one packed ORM texture can hold all three
+    uint32_t metalnessChannel;
+    uint32_t occlusionChannel;
     MATH_PREFIX::float3 color;
     MATH_PREFIX::float3 emission;
     float roughness;
+    
+    // UV scale (xy) and offset (zw) of each map within its texture: (1, 1, 0, 0), unless the map is an atlas entry
+    MATH_PREFIX::float4 textureRect;
+    MATH_PREFIX::float4 normalMapRect;
+    MATH_PREFIX::float4 roughnessMapRect;
+    MATH_PREFIX::float4 metalnessMapRect;
+    MATH_PREFIX::float4 occlusionMapRect;
 };
 
 struct ModelVertexData {
     MATH_PREFIX::float3 pos, normal, tangent;
     MATH_PREFIX::float2 uv;
     float sign;
-    
+
 #ifndef __METAL_VERSION__
     bool operator==(const ModelVertexData& rhs) const {
         /// WARNING: tangents and signs are not included in this comparison because this is for unordered_map before MikkTSpace calculations
@@ -82,9 +136,177 @@ struct ModelVertexData {
 #endif // !__METAL_VERSION__
 };
 
+/// Tightly packed position stream read by acceleration structure builds and hit reconstruction. 12 bytes per vertex, or 8
+/// with QUANTIZE_POSITIONS.
+#ifdef QUANTIZE_POSITIONS
+typedef QuantizedPosition VertexPosition;
+#else
+typedef PackedFloat3 VertexPosition;
+#endif
+
+/// Attributes only read once the closest hit is known, kept out of the position stream so builds and intersection don't
+/// pull them through the cache. See the encode/decode functions below for the bit layouts.
+struct VertexShadingData {
+    uint32_t normal;   // Octahedral, 2x snorm16
+    uint32_t tangent;  // Octahedral, 2x snorm16, bitangent sign in the lowest bit
+    uint32_t uv;       // 2x half
+};
+
+// Vertex compression. These are written against plain scalar math so the CPU encoder and the kernels produce and decode
+//  identical bits.
+
+inline float sharedAbs(float x) {
+    return x < 0.0f ? -x : x;
+}
+
+inline float sharedSignNotZero(float x) {
+    return x >= 0.0f ? 1.0f : -1.0f;
+}
+
+inline float sharedClamp(float x, float lo, float hi) {
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+inline MATH_PREFIX::float3 makeFloat3(float x, float y, float z) {
+#ifdef __METAL_VERSION__
+    return float3(x, y, z);
+#else
+    return simd_make_float3(x, y, z);
+#endif
+}
+
+inline uint32_t packSnorm16(float v) {
+    float scaled = sharedClamp(v, -1.0f, 1.0f) * 32767.0f;
+    int32_t q = static_cast<int32_t>(scaled + (scaled >= 0.0f ? 0.5f : -0.5f));
+    return static_cast<uint32_t>(q) & 0xFFFFu;
+}
+
+inline float unpackSnorm16(uint32_t bits) {
+    int32_t q = static_cast<int32_t>(bits << 16) >> 16;  // Sign extend
+    float v = static_cast<float>(q) / 32767.0f;
+    return v < -1.0f ? -1.0f : v;
+}
+
+inline uint32_t packUnorm16(float v) {
+    return static_cast<uint32_t>(sharedClamp(v, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+inline float unpackUnorm16(uint32_t bits) {
+    return static_cast<float>(bits & 0xFFFFu) / 65535.0f;
+}
+
+/// Maps a unit vector onto the octahedron and then onto [-1, 1]^2, packed as 2x snorm16.
+inline uint32_t encodeOctahedral(MATH_PREFIX::float3 n) {
+    float invL1 = 1.0f / (sharedAbs(n.x) + sharedAbs(n.y) + sharedAbs(n.z) + EPS);
+    float x = n.x * invL1;
+    float y = n.y * invL1;
+    
+    if (n.z < 0.0f) {
+        float wrappedX = (1.0f - sharedAbs(y)) * sharedSignNotZero(x);
+        float wrappedY = (1.0f - sharedAbs(x)) * sharedSignNotZero(y);
+        x = wrappedX;
+        y = wrappedY;
+    }
+    
+    return packSnorm16(x) | (packSnorm16(y) << 16);
+}
+
+inline MATH_PREFIX::float3 decodeOctahedral(uint32_t bits) {
+    float x = unpackSnorm16(bits & 0xFFFFu);
+    float y = unpackSnorm16(bits >> 16);
+    float z = 1.0f - sharedAbs(x) - sharedAbs(y);
+    
+    if (z < 0.0f) {
+        float unwrappedX = (1.0f - sharedAbs(y)) * sharedSignNotZero(x);
+        float unwrappedY = (1.0f - sharedAbs(x)) * sharedSignNotZero(y);
+        x = unwrappedX;
+        y = unwrappedY;
+    }
+    
+    return MATH_PREFIX::normalize(makeFloat3(x, y, z));
+}
+
+/// The bitangent sign replaces the lowest bit of the second component, which costs at most one snorm16 step of precision.
+inline uint32_t encodeTangent(MATH_PREFIX::float3 tangent, float sign) {
+    return (encodeOctahedral(tangent) & ~0x10000u) | (sign >= 0.0f ? 0x10000u : 0u);
+}
+
+inline MATH_PREFIX::float3 decodeTangent(uint32_t bits) {
+    return decodeOctahedral(bits);
+}
+
+inline float decodeTangentSign(uint32_t bits) {
+    return (bits & 0x10000u) != 0 ? 1.0f : -1.0f;
+}
+
+inline uint32_t encodeHalf2(MATH_PREFIX::float2 v) {
+#ifdef __METAL_VERSION__
+    return as_type<uint32_t>(half2(v));
+#else
+    _Float16 halves[2] = { static_cast<_Float16>(v.x), static_cast<_Float16>(v.y) };
+    uint32_t bits;
+    std::memcpy(&bits, halves, sizeof(bits));
+    return bits;
+#endif
+}
+
+inline MATH_PREFIX::float2 decodeHalf2(uint32_t bits) {
+#ifdef __METAL_VERSION__
+    return float2(as_type<half2>(bits));
+#else
+    _Float16 halves[2];
+    std::memcpy(halves, &bits, sizeof(bits));
+    return simd::float2{ static_cast<float>(halves[0]), static_cast<float>(halves[1]) };
+#endif
+}
+
+/// boundsMin and boundsExtent describe the model's axis-aligned bounds. A zero extent on an axis (flat model) maps to 0.
+inline QuantizedPosition encodeQuantizedPosition(MATH_PREFIX::float3 pos, MATH_PREFIX::float3 boundsMin, MATH_PREFIX::float3 boundsExtent) {
+    MATH_PREFIX::float3 rel = (pos - boundsMin) / MATH_PREFIX::max(boundsExtent, MATH_PREFIX::float3(EPS));
+    
+    QuantizedPosition out;
+    out.x = static_cast<uint16_t>(packUnorm16(rel.x));
+    out.y = static_cast<uint16_t>(packUnorm16(rel.y));
+    out.z = static_cast<uint16_t>(packUnorm16(rel.z));
+    out.w = 0;
+    return out;
+}
+
+inline MATH_PREFIX::float3 decodeQuantizedPosition(QuantizedPosition q, MATH_PREFIX::float3 boundsMin, MATH_PREFIX::float3 boundsExtent) {
+    return boundsMin + makeFloat3(unpackUnorm16(q.x), unpackUnorm16(q.y), unpackUnorm16(q.z)) * boundsExtent;
+}
+
+inline MATH_PREFIX::float3 decodePosition(QuantizedPosition q, MATH_PREFIX::float3 boundsMin, MATH_PREFIX::float3 boundsExtent) {
+    return decodeQuantizedPosition(q, boundsMin, boundsExtent);
+}
+
+inline MATH_PREFIX::float3 decodePosition(PackedFloat3 p, MATH_PREFIX::float3 boundsMin, MATH_PREFIX::float3 boundsExtent) {
+    return makeFloat3(p.x, p.y, p.z);
+}
+
+/// A contiguous range of a model's index buffer drawn with one material slot. Each submesh is one geometry in the model's
+/// bottom-level acceleration structure, so the intersection's geometry_id indexes straight into the model's submesh table.
+struct SubmeshData {
+    uint32_t indexOffset;  // Relative to the start of the model's indices
+    uint32_t indexCount;
+    uint32_t materialSlot;
+};
+
+SHARED_CONST uint32_t INSTANCE_FLAG_16BIT_INDICES = 1;
+
+// Instance masks used to pick a LOD per ray class
+SHARED_CONST uint32_t LOD_MASK_PRIMARY = 1;    // Camera rays and rays after specular bounces only
+SHARED_CONST uint32_t LOD_MASK_SECONDARY = 2;  // Rays after at least one diffuse bounce
+
 struct InstanceData {
-    uint32_t indexOffset;
-    uint32_t materialIdx;
+    uint64_t indexByteOffset;  // Start of the model's indices in the scene index buffer, which can pass 4 GB
+    uint32_t vertexOffset;     // Added to the model's local indices
+    uint32_t submeshOffset;    // Start of the model's submeshes in the scene submesh buffer
+    uint32_t materialOffset;   // Start of this instance's material slot -> material index table
+    uint32_t flags;
+    float secondaryOffset;     // How far secondary rays leaving this instance start off its surface, in world space
+    MATH_PREFIX::float3 boundsMin;     // Model bounds, used to decode quantized positions
+    MATH_PREFIX::float3 boundsExtent;
     MATH_PREFIX::float4x4 transform;
 };
 
@@ -7,6 +7,17 @@
 using namespace metal;
 using namespace metal::raytracing;
 
+// Spread a bounce adds to the ray cone. A diffuse bounce scatters over the whole hemisphere, so after one textures are
+//  sampled close to their coarsest levels. Glossy bounces add the GGX alpha.
+constant float DIFFUSE_CONE_SPREAD = 0.5;
+
+/// A path's ray footprint for texture LOD: width where the ray starts, and how fast it grows per unit distance
+/// (Akenine-Möller et al., "Improved Shader and Texture Level of Detail Using Ray Cones")
+struct RayCone {
+    float width;
+    float spread;
+};
+
 struct HitInfo {
     bool hit;
     bool backface;
@@ -15,8 +26,13 @@ struct HitInfo {
     float3x3 tbn;
     float3x3 mappedTBN;
     float roughness;
+    float metalness;
+    float occlusion;
     uint32_t materialIdx;
     float2 uv;
+    float coneWidth;   // Width of the ray cone at the hit
+    float textureLod;  // Mip level for a 1x1 texture; sampleCone adds the texture's own size
+    float secondaryOffset;  // Extra distance off the surface for rays that go on to trace the secondary LODs
 };
 
 float3 computeGeometryNormal(float3 v0, float3 v1, float3 v2) {
@@ -28,8 +44,88 @@ T geomInterpolate(float3 bary, T a, T b, T c) {
     return a * bary.x + b * bary.y + c * bary.z;
 }
 
-HitInfo intersectScene(ray r, intersector<triangle_data, instancing> i, acceleration_structure<instancing> as, device const ModelVertexData* vertices, device const uint* indices, device const Material* materials, device const InstanceData* instanceData, const array<texture2d<float>, NUM_TEXTURES> textures) {
-    intersection_result<triangle_data, instancing> hitResult = i.intersect(r, as);
+/// Where sampling records the tiles of sparse textures it reads, for the TextureTileCache to load after the frame
+struct TileFeedback {
+    constant SparseTextureInfo* infos;  // Per texture slot
+    device atomic_uint* stamps;
+    uint stamp;  // The frame index plus one, so a stamp of 0 was never sampled
+};
+
+/// Samples a sparse texture, stamping the tiles of the two levels trilinear filtering reads. Where a tile isn't resident
+/// yet the sample steps to coarser levels, down to the resident level that always is.
+float4 sampleSparse(texture2d<float> tex, sampler s, bool repeat, float2 uv, float lod, constant SparseTextureInfo& info, thread const TileFeedback& feedback) {
+    float2 wrapped = repeat ? fract(uv) : saturate(uv);
+    uint2 tileSize = uint2(info.tileWidth, info.tileHeight);
+    uint finest = uint(clamp(lod, 0.0, float(info.residentLevel)));
+    for (uint l = finest; l < min(finest + 2, info.residentLevel); l++) {
+        uint2 size = uint2(tex.get_width(l), tex.get_height(l));
+        uint2 tiles = (size + tileSize - 1) / tileSize;
+        uint2 tile = min(uint2(wrapped * float2(size)) / tileSize, tiles - 1);
+        
+        // Every thread sampling a tile stores the same stamp, so it is only written once it changes
+        device atomic_uint* stamp = feedback.stamps + info.levelFirstTile[l] + tile.y * tiles.x + tile.x;
+        if (atomic_load_explicit(stamp, memory_order_relaxed) != feedback.stamp) {
+            atomic_store_explicit(stamp, feedback.stamp, memory_order_relaxed);
+        }
+    }
+    
+    for (float l = max(lod, 0.0); ; l = floor(l) + 1) {
+        auto color = tex.sparse_sample(s, uv, level(l));
+        if (color.resident() || l >= float(info.residentLevel)) {
+            return color.value();
+        }
+    }
+}
+
+/// Samples at the mip level matching the ray cone's footprint on the hit triangle
+float4 sampleCone(texture2d<float> tex, constant SparseTextureInfo& sparse, sampler s, bool repeat, thread const HitInfo& hit, thread const TileFeedback& feedback) {
+    float lod = hit.textureLod + 0.5 * log2(float(tex.get_width() * tex.get_height()));
+    if (sparse.tileWidth != 0) {
+        return sampleSparse(tex, s, repeat, hit.uv, lod, sparse, feedback);
+    }
+    return tex.sample(s, hit.uv, level(lod));
+}
+
+/// sampleCone for a map that may be an entry of a texture atlas, placed by rect's UV scale (xy) and offset (zw). The
+/// entry's UVs wrap or clamp within it as the sampler would, and its mip level is capped where the gutters around it
+/// stop keeping the neighbouring entries out. Atlas pages are never sparse.
+float4 sampleAtlas(texture2d<float> tex, constant SparseTextureInfo& sparse, sampler s, bool repeat, float4 rect, thread const HitInfo& hit, thread const TileFeedback& feedback) {
+    if (all(rect == float4(1, 1, 0, 0))) {
+        return sampleCone(tex, sparse, s, repeat, hit, feedback);
+    }
+    
+    float2 uv = (repeat ? fract(hit.uv) : saturate(hit.uv)) * rect.xy + rect.zw;
+    float lod = hit.textureLod + 0.5 * log2(float(tex.get_width() * tex.get_height()) * rect.x * rect.y);
+    return tex.sample(s, uv, level(min(lod, float(ATLAS_MIP_LEVELS - 1))));
+}
+
+/// Reads one channel of a material map, or returns value without one. Maps packed into one texture are fetched once:
+/// the last fetch is kept in fetchedID, fetchedRect and fetched. Different entries of one atlas differ in their rect.
+float sampleMapChannel(int mapID, float4 rect, uint channel, float value, const array<texture2d<float>, NUM_TEXTURES> textures, sampler s, thread const HitInfo& hit, thread const TileFeedback& feedback, thread int& fetchedID, thread float4& fetchedRect, thread float4& fetched) {
+    if (mapID < 0) {
+        return value;
+    }
+    if (mapID != fetchedID || any(rect != fetchedRect)) {
+        fetched = sampleAtlas(textures[mapID], feedback.infos[mapID], s, false, rect, hit, feedback);
+        fetchedID = mapID;
+        fetchedRect = rect;
+    }
+    return fetched[channel];
+}
+
+/// Reads the i-th index of an instance's model, which may be stored as 16 or 32 bits, and rebases it into the scene buffers.
+uint fetchIndex(device const uchar* indices, InstanceData instance, uint i) {
+    device const uchar* modelIndices = indices + instance.indexByteOffset;
+    
+    uint idx = (instance.flags & INSTANCE_FLAG_16BIT_INDICES) != 0
+        ? uint(reinterpret_cast<device const ushort*>(modelIndices)[i])
+        : reinterpret_cast<device const uint*>(modelIndices)[i];
+    
+    return idx + instance.vertexOffset;
+}
+
+HitInfo intersectScene(ray r, RayCone cone, uint mask, intersector<triangle_data, instancing> i, acceleration_structure<instancing> as, device const VertexPosition* positions, device const VertexShadingData* shading, device const uchar* indices, device const Material* materials, device const InstanceData* instanceData, device const SubmeshData* submeshes, device const uint* instanceMaterials, const array<texture2d<float>, NUM_TEXTURES> textures, thread const TileFeedback& feedback) {
+    intersection_result<triangle_data, instancing> hitResult = i.intersect(r, as, mask);
     
     HitInfo hitInfo;
     
@@ -39,66 +135,90 @@ HitInfo intersectScene(ray r, intersector<triangle_data, instancing> i, accelera
     }
     
     hitInfo.hit = true;
-    hitInfo.materialIdx = instanceData[hitResult.instance_id].materialIdx;
+    
+    InstanceData instance = instanceData[hitResult.instance_id];
+    SubmeshData submesh = submeshes[instance.submeshOffset + hitResult.geometry_id];
+    hitInfo.materialIdx = instanceMaterials[instance.materialOffset + submesh.materialSlot];
+    hitInfo.secondaryOffset = instance.secondaryOffset;
     
     float3 bary = float3(0, hitResult.triangle_barycentric_coord);
     bary.x = 1.0 - bary.y - bary.z;
     
-    float4x4 modelMatrix = instanceData[hitResult.instance_id].transform;
-    int idxOffset = instanceData[hitResult.instance_id].indexOffset;
+    float4x4 modelMatrix = instance.transform;
+    uint idxOffset = submesh.indexOffset + hitResult.primitive_id * 3;
     
-    int i0 = indices[idxOffset + hitResult.primitive_id * 3];
-    int i1 = indices[idxOffset + hitResult.primitive_id * 3 + 1];
-    int i2 = indices[idxOffset + hitResult.primitive_id * 3 + 2];
-    
-    ModelVertexData v0 = vertices[i0];
-    ModelVertexData v1 = vertices[i1];
-    ModelVertexData v2 = vertices[i2];
+    uint i0 = fetchIndex(indices, instance, idxOffset);
+    uint i1 = fetchIndex(indices, instance, idxOffset + 1);
+    uint i2 = fetchIndex(indices, instance, idxOffset + 2);
     
     // Transform the vertices into world space to account for instance rotation
-    v0.pos = float3(modelMatrix * float4(v0.pos, 1));
-    v1.pos = float3(modelMatrix * float4(v1.pos, 1));
-    v2.pos = float3(modelMatrix * float4(v2.pos, 1));
+    float3 p0 = float3(modelMatrix * float4(decodePosition(positions[i0], instance.boundsMin, instance.boundsExtent), 1));
+    float3 p1 = float3(modelMatrix * float4(decodePosition(positions[i1], instance.boundsMin, instance.boundsExtent), 1));
+    float3 p2 = float3(modelMatrix * float4(decodePosition(positions[i2], instance.boundsMin, instance.boundsExtent), 1));
     
     hitInfo.pos = r.origin + r.direction * hitResult.distance;
     
-    hitInfo.geomNormal = computeGeometryNormal(v0.pos, v1.pos, v2.pos);
+    hitInfo.geomNormal = computeGeometryNormal(p0, p1, p2);
     hitInfo.backface = dot(hitInfo.geomNormal, r.direction) > 0;
     if (hitInfo.backface) {
         hitInfo.geomNormal *= -1;
     }
     
-    hitInfo.uv = geomInterpolate(bary, v0.uv, v1.uv, v2.uv);
+    // Shading attributes are only fetched for the closest hit
+    VertexShadingData s0 = shading[i0];
+    VertexShadingData s1 = shading[i1];
+    VertexShadingData s2 = shading[i2];
+    
+    float2 uv0 = decodeHalf2(s0.uv);
+    float2 uv1 = decodeHalf2(s1.uv);
+    float2 uv2 = decodeHalf2(s2.uv);
+    hitInfo.uv = geomInterpolate(bary, uv0, uv1, uv2);
+    
+    // Ray cone texture LOD: the cone's width at the hit, stretched by the grazing angle, against how many texels of a
+    //  1x1 texture cover a unit of the triangle's surface
+    float worldArea = length(cross(p1 - p0, p2 - p0));
+    float uvArea = abs((uv1.x - uv0.x) * (uv2.y - uv0.y) - (uv2.x - uv0.x) * (uv1.y - uv0.y));
+    hitInfo.coneWidth = cone.width + cone.spread * hitResult.distance;
+    hitInfo.textureLod = 0.5 * log2(max(uvArea, EPS) / max(worldArea, EPS))
+        + log2(max(hitInfo.coneWidth, EPS) / max(abs(dot(hitInfo.geomNormal, r.direction)), EPS));
     
-    float w = geomInterpolate(bary, v0.sign, v1.sign, v2.sign);
+    float w = geomInterpolate(bary, decodeTangentSign(s0.tangent), decodeTangentSign(s1.tangent), decodeTangentSign(s2.tangent));
     hitInfo.tbn = float3x3(
-        geomInterpolate(bary, v0.tangent, v1.tangent, v2.tangent),
+        geomInterpolate(bary, decodeTangent(s0.tangent), decodeTangent(s1.tangent), decodeTangent(s2.tangent)),
         float3(0),
-        geomInterpolate(bary, v0.normal, v1.normal, v2.normal)
+        geomInterpolate(bary, decodeOctahedral(s0.normal), decodeOctahedral(s1.normal), decodeOctahedral(s2.normal))
     );
     
     hitInfo.tbn[1] = w * cross(hitInfo.tbn[2], hitInfo.tbn[0]);
     
-    constexpr sampler s(address::clamp_to_edge, filter::linear);
+    constexpr sampler s(address::clamp_to_edge, filter::linear, mip_filter::linear);
     
     hitInfo.mappedTBN = hitInfo.tbn;
-    int normalMapID = materials[hitInfo.materialIdx].normalMapID;
-    if (normalMapID >= 0) {
-        float3 normalMapValue = float3(textures[normalMapID].sample(s, hitInfo.uv)) * 2.0 - 1.0;
+    Material material = materials[hitInfo.materialIdx];
+    if (material.normalMapID >= 0) {
+        // Z is rebuilt from X and Y, so two-channel (BC5) normal maps work the same as RGB ones
+        float2 normalXY = sampleAtlas(textures[material.normalMapID], feedback.infos[material.normalMapID], s, false, material.normalMapRect, hitInfo, feedback).xy * 2.0 - 1.0;
+        float3 normalMapValue = float3(normalXY, sqrt(saturate(1.0 - dot(normalXY, normalXY))));
         
         float3 N = normalize(hitInfo.tbn * normalMapValue);
         float3 T = hitInfo.tbn[0];
         T = normalize(T - N * dot(T, N));
         float3 B = cross(N, T);
-
+        
         hitInfo.mappedTBN = float3x3(T, B, N);
     }
     
-    hitInfo.roughness = materials[hitInfo.materialIdx].roughness;
-    int roughnessMapID = materials[hitInfo.materialIdx].roughnessMapID;
-    if (roughnessMapID >= 0) {
-        hitInfo.roughness = textures[normalMapID].sample(s, hitInfo.uv).r;
-    }
+    // Roughness, metalness and occlusion usually come packed in one ORM texture, which is then fetched once for all three
+    int fetchedID = -1;
+    float4 fetchedRect = float4(0);
+    float4 fetched = float4(0);
+    hitInfo.roughness = sampleMapChannel(material.roughnessMapID, material.roughnessMapRect, material.roughnessChannel, material.roughness, textures, s, hitInfo, feedback, fetchedID, fetchedRect, fetched);
+    hitInfo.metalness = sampleMapChannel(material.metalnessMapID, material.metalnessMapRect, material.metalnessChannel, material.materialID == 1 ? 1.0 : 0.0, textures, s, hitInfo, feedback, fetchedID, fetchedRect, fetched);
+#ifdef APPLY_OCCLUSION_MAPS
+    hitInfo.occlusion = sampleMapChannel(material.occlusionMapID, material.occlusionMapRect, material.occlusionChannel, 1.0, textures, s, hitInfo, feedback, fetchedID, fetchedRect, fetched);
+#else
+    hitInfo.occlusion = 1.0;
+#endif
     
     return hitInfo;
 }
@@ -118,12 +238,12 @@ float2 concentricSampleDisk(float u1, float u2) {
     // map to [-1,1]^2
     float sx = 2.0f * u1 - 1.0f;
     float sy = 2.0f * u2 - 1.0f;
-
+    
     // handle degeneracy at the origin
     if (sx == 0.0f && sy == 0.0f) {
         return float2(0.0f, 0.0f);
     }
-
+    
     float r, theta;
     if (abs(sx) > abs(sy)) {
         r = sx;
@@ -132,7 +252,7 @@ float2 concentricSampleDisk(float u1, float u2) {
         r = sy;
         theta = (M_PI_F / 2.0f) - (M_PI_F / 4.0f) * (sx / sy);
     }
-
+    
     return float2(r * cos(theta), r * sin(theta));
 }
 
@@ -141,16 +261,16 @@ inline float3 sampleCosineHemisphere(float3 N, thread uint& seed) {
     // generate two uniforms
     float u1 = rand(seed);
     float u2 = rand(seed);
-
+    
     // sample concentric disk
     float2 d = concentricSampleDisk(u1, u2);
     float x = d.x;
     float y = d.y;
     float z = sqrt(max(0.0f, 1.0f - x*x - y*y)); // hemisphere z
-
+    
     // local-space direction (z = up)
     float3 localDir = float3(x, y, z); // already normalized approximately
-
+    
     // build ONB and transform to world
     float3 T, B;
     buildONB(N, T, B);
@@ -166,25 +286,25 @@ ray getStartingRay(
     float4x4 invProjection
 ) {
     float2 randomPixelCenter = pixel + float2(0.5) + 0.375 * randomGaussian(seed);  // For antialiasing
-
+    
     float2 ndc = float2(
         (randomPixelCenter.x / resolution.x) * 2.0 - 1.0,
         (randomPixelCenter.y / resolution.y) * 2.0 - 1.0
     );
-
+    
     float4 clipPos = float4(ndc, 0.0, 1.0);
-
+    
     // Unproject from clip space to view space using the inverse projection matrix
     float4 viewPos = float4(invProjection * clipPos);
     viewPos /= viewPos.w;  // Perspective divide.
-
+    
     float3 viewDir = normalize(viewPos.xyz);
-
+    
     // Transform the view-space direction to world space using the inverse view matrix.
     // Use a w component of 0.0 to indicate that we're transforming a direction.
     float4 worldDir4 = float4(invView * float4(viewDir, 0.0));
     float3 rayDirection = normalize(worldDir4.xyz);
-
+    
     float3 origin = invView[3].xyz;
     float3 focalPoint = origin + rayDirection; // * pushConstants.focusDist;
 //    float2 lensOffset = randomInUnitHexagon(pld.rngState) * pushConstants.defocusMultiplier;
@@ -192,14 +312,14 @@ ray getStartingRay(
     
     float3 right = normalize(invView[0].xyz);
     float3 up = normalize(invView[1].xyz);
-
+    
     // Offset the origin by the lens offset.
     float3 offset = right * lensOffset.x + up * lensOffset.y;
     float3 newOrigin = origin + offset;
-
+    
     // Recompute the ray direction so that the ray goes through the focal point.
     float3 newDirection = normalize(focalPoint - newOrigin);
-
+    
     return ray(newOrigin, newDirection);
 }
 
@@ -207,39 +327,58 @@ float3 skyColor(float3 dir) {
 #ifdef DEBUG_SKY_COLOR_GRAY
     return float3(0.5);
 #endif
-    
+
     return mix(float3(0), float3(1), saturate(dir.y * 0.5 + 0.5));
 }
 
-float3 runRaytrace(ray r, intersector<triangle_data, instancing> i, device const ModelVertexData* vertices, device const InstanceData* instanceData, device const uint* indices, device const Material* materials, acceleration_structure<instancing> as, thread uint& seed, const array<texture2d<float>, NUM_TEXTURES> textures) {
+float3 runRaytrace(ray r, intersector<triangle_data, instancing> i, device const VertexPosition* positions, device const VertexShadingData* shading, device const InstanceData* instanceData, device const uchar* indices, device const Material* materials, device const SubmeshData* submeshes, device const uint* instanceMaterials, acceleration_structure<instancing> as, thread uint& seed, const array<texture2d<float>, NUM_TEXTURES> textures, thread const TileFeedback& feedback, float pixelSpreadAngle) {
     float3 throughput = float3(1);
     float3 incomingLight = float3(0);
     
+    RayCone cone = {0, pixelSpreadAngle};
+    
+    // Once a path has bounced diffusely its ray cone is wide enough to trace the coarser secondary LODs
+    uint lodMask = LOD_MASK_PRIMARY;
+    
     for (int tracedSegments = 0; tracedSegments < 10; tracedSegments++) {
-        HitInfo hit = intersectScene(r, i, as, vertices, indices, materials, instanceData, textures);
+        HitInfo hit = intersectScene(r, cone, lodMask, i, as, positions, shading, indices, materials, instanceData, submeshes, instanceMaterials, textures, feedback);
         
         if (!hit.hit) {
             incomingLight += skyColor(r.direction) * throughput;
             break;
         }
-        
+
 #ifdef DEBUG_SHOW_NORMALS
         return hit.tbn[2] * 0.5 + 0.5;
 #endif
-        
+
         Material mat = materials[hit.materialIdx];
         
         float3 color = mat.color;
         if (mat.textureID >= 0) {
-            constexpr sampler s(address::repeat, filter::linear);
-            color *= float3(textures[mat.textureID].sample(s, hit.uv));
+            constexpr sampler s(address::repeat, filter::linear, mip_filter::linear);
+            color *= float3(sampleAtlas(textures[mat.textureID], feedback.infos[mat.textureID], s, true, mat.textureRect, hit, feedback));
         }
         
         r.origin = hit.pos + hit.tbn[2] * 0.0001;
+        cone.width = hit.coneWidth;
+        
+        // A metalness map picks the metal lobe with that probability; without one the material's type decides
+        bool metal = hit.metalness >= 1.0 || (hit.metalness > 0.0 && rand(seed) < hit.metalness);
         
-        if (mat.materialID == 0) {
+        if (!metal) {
+#ifdef APPLY_OCCLUSION_MAPS
+            color *= hit.occlusion;
+#endif
             r.direction = sampleCosineHemisphere(hit.mappedTBN[2], seed);
+            lodMask = LOD_MASK_SECONDARY;
+            cone.spread += DIFFUSE_CONE_SPREAD;
+            
+            // The secondary LOD of the surface just hit can lie up to its simplification distance away from it
+            r.origin += hit.tbn[2] * hit.secondaryOffset;
         } else {
+            cone.spread += hit.roughness * hit.roughness;
+            
             float3 wi = -r.direction;
             
             // float3x3 tbn, float anisotropic, float roughness, float3 wi, thread uint& rngState)
@@ -268,28 +407,33 @@ float3 runRaytrace(ray r, intersector<triangle_data, instancing> i, device const
 
 kernel void raytraceMain(acceleration_structure<instancing> as[[buffer(ACC_STRUCT_BUFFER_IDX)]],
                          constant CameraData& matrices [[buffer(CAMERA_BUFFER_IDX)]],
-                         device const ModelVertexData* vertices [[buffer(VERTICES_BUFFER_IDX)]],
-                         device const uint* indices [[buffer(INDICES_BUFFER_IDX)]],
+                         device const VertexPosition* positions [[buffer(POSITION_BUFFER_IDX)]],
+                         device const VertexShadingData* shading [[buffer(SHADING_BUFFER_IDX)]],
+                         device const uchar* indices [[buffer(INDICES_BUFFER_IDX)]],
                          device const InstanceData* instanceData [[buffer(INSTANCE_DATA_BUFFER_IDX)]],
                          device const Material* materials [[buffer(MATERIAL_BUFFER_IDX)]],
+                         device const SubmeshData* submeshes [[buffer(SUBMESH_BUFFER_IDX)]],
+                         device const uint* instanceMaterials [[buffer(INSTANCE_MATERIAL_BUFFER_IDX)]],
                          constant FrameParams& frameParams [[buffer(FRAME_PARAMS_BUFFER_IDX)]],
                          texture2d<float, access::read_write> inTex [[texture(INPUT_TEXTURE_IDX)]],
                          texture2d<float, access::read_write> outTex [[texture(OUTPUT_TEXTURE_IDX)]],
                          const array<texture2d<float>, NUM_TEXTURES> textures [[texture(TEXTURE_ARRAY_IDX)]],
+                         constant SparseTextureInfo* sparseInfos [[buffer(SPARSE_TEXTURE_INFO_BUFFER_IDX)]],
+                         device atomic_uint* tileStamps [[buffer(TILE_STAMP_BUFFER_IDX)]],
                          uint2 gid [[thread_position_in_grid]]) {
 #ifdef DEBUG_SHOW_NORMALS
     uint raysPerBatch = 1;
 #else
     uint raysPerBatch = frameParams.samplesPerBatch;
 #endif
-    
+
     uint width  = outTex.get_width();
     uint height = outTex.get_height();
-
+    
     if (gid.x >= width || gid.y >= height) {
         return;
     }
-
+    
     uint raw = gid.x + gid.y * width + frameParams.frameIndex * 73856093u;
     uint seed = hash(raw);
     if (seed == 0) seed = 1;
@@ -297,10 +441,12 @@ kernel void raytraceMain(acceleration_structure<instancing> as[[buffer(ACC_STRUC
     intersector<triangle_data, instancing> intersect;
     ray r;
     
+    TileFeedback feedback = {sparseInfos, tileStamps, frameParams.frameIndex + 1};
+    
     float3 sum = float3(0);
     for (uint i = 0; i < raysPerBatch; i++) {
         r = getStartingRay(seed, float2(gid), float2(width, height), matrices.invView, matrices.invProj);
-        sum += runRaytrace(r, intersect, vertices, instanceData, indices, materials, as, seed, textures);
+        sum += runRaytrace(r, intersect, positions, shading, instanceData, indices, materials, submeshes, instanceMaterials, as, seed, textures, feedback, matrices.pixelSpreadAngle);
     }
     
     float4 thisColor = float4(sum / raysPerBatch, 1);
@@ -312,7 +458,7 @@ kernel void raytraceMain(acceleration_structure<instancing> as[[buffer(ACC_STRUC
         float4 oldColor = inTex.read(gid.xy);
         newColor = (oldColor * frameParams.frameIndex + thisColor) / float(frameParams.frameIndex + 1);
     }
-
+    
     if (any(isinf(newColor))) {
         newColor = float4(1, 1, 0, 1);
     } else if (any(isnan(newColor))) {